@@ -8,7 +8,15 @@ namespace cdb {
 cdb_client::cdb_client(std::string const &ip, std::uint16_t port)
     : reactor_(new cdb_tcp_server::reactor{1})
     , tcp_client_(reactor_.get())
-    , ip_(ip), port_(port) {}
+    , ip_(ip), port_(port)
+    , shm_(false) {}
+
+cdb_client::cdb_client(std::string const &unix_path, bool shm)
+    : reactor_(new cdb_tcp_server::reactor{1})
+    , tcp_client_(reactor_.get())
+    , port_(0)
+    , unix_path_(unix_path)
+    , shm_(shm) {}
 
 bool cdb_client::ensure_connection()
 {
@@ -16,7 +24,12 @@ bool cdb_client::ensure_connection()
     {
         try
         {
-            tcp_client_.connect(ip_, port_);
+            if (unix_path_.empty())
+                tcp_client_.connect(ip_, port_);
+            else if (shm_)
+                tcp_client_.connect_shm(unix_path_);
+            else
+                tcp_client_.connect_unix(unix_path_);
         }
         catch (std::exception &e)
         {
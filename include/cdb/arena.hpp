@@ -0,0 +1,116 @@
+/// File: arena.hpp
+/// ===============
+/// Copyright 2020 Cloud-fantasy team
+/// Bump allocator for memory that is all freed at once.
+#ifndef CDB_ARENA_HPP
+#define CDB_ARENA_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+namespace cdb {
+
+/// Arena hands memory out of large blocks by bumping a pointer, and
+/// takes it all back at once with reset(): allocations aren't freed one
+/// by one. It's meant for what lives as long as a batch of requests.
+/// Memory is kept across resets, so that once an arena has grown to what
+/// a batch takes it no longer hits the heap.
+/// NOTE: this class is not thread-safe.
+class arena {
+public:
+    /// Blocks are at least [block_size] bytes.
+    explicit arena(std::size_t block_size = 4096);
+    ~arena();
+
+    arena(const arena&) = delete;
+    arena &operator=(const arena&) = delete;
+
+public:
+    /// Memory kept by reset() is capped to this, so that a batch far
+    /// larger than usual doesn't hold onto its memory.
+    static const std::size_t max_retained = 1 << 20;
+
+    /// [size] bytes aligned on [align], a power of 2.
+    void *allocate(std::size_t size, std::size_t align = alignof(std::max_align_t))
+    {
+        std::uintptr_t p = (reinterpret_cast<std::uintptr_t>(ptr_) + align - 1) & ~(align - 1);
+        if (ptr_ != nullptr && p + size <= reinterpret_cast<std::uintptr_t>(end_))
+        {
+            ptr_ = reinterpret_cast<char*>(p + size);
+            return reinterpret_cast<void*>(p);
+        }
+        return allocate_block(size, align);
+    }
+
+    /// Copy of the [size] bytes at [data].
+    char *copy(const char *data, std::size_t size);
+
+    /// Free everything allocated so far.
+    void reset();
+
+    /// Bytes of the blocks held.
+    std::size_t capacity() const { return capacity_; }
+
+private:
+    /// Start a new block to allocate [size] bytes from.
+    void *allocate_block(std::size_t size, std::size_t align);
+
+    struct block {
+        char *data;
+        std::size_t size;
+    };
+
+    std::size_t block_size_;
+    std::size_t capacity_;
+
+    /// Blocks allocated since the last reset, the current one last.
+    std::vector<block> blocks_;
+
+    /// Free part of the current block.
+    char *ptr_;
+    char *end_;
+};
+
+/// Allocator for containers whose memory comes from an arena, and is
+/// freed with it. Default-constructed, it allocates from the heap.
+template <typename T>
+class arena_allocator {
+public:
+    typedef T value_type;
+
+    arena_allocator() : arena_(nullptr) {}
+    explicit arena_allocator(arena &a) : arena_(&a) {}
+
+    template <typename U>
+    arena_allocator(const arena_allocator<U> &other) : arena_(other.arena_) {}
+
+    T *allocate(std::size_t n)
+    {
+        if (arena_ == nullptr)
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *p, std::size_t)
+    {
+        if (arena_ == nullptr)
+            ::operator delete(p);
+    }
+
+    template <typename U>
+    bool operator==(const arena_allocator<U> &other) const { return arena_ == other.arena_; }
+    template <typename U>
+    bool operator!=(const arena_allocator<U> &other) const { return arena_ != other.arena_; }
+
+private:
+    template <typename U>
+    friend class arena_allocator;
+
+    arena *arena_;
+};
+
+}    // namespace cdb
+
+#endif
@@ -18,6 +18,10 @@ class cdb_client {
 public:
     /// Ctor.
     cdb_client(const std::string &ip, std::uint16_t port);
+    /// Connect through the coordinator's Unix domain socket at [path]
+    /// instead, when on the same host. With [shm], [path] is its
+    /// shm_socket and requests go through shared memory rings.
+    explicit cdb_client(const std::string &unix_path, bool shm = false);
     ~cdb_client() { reactor_->stop(); }
 
     /// Disallow copy/move explicitly.
@@ -98,6 +102,10 @@ private:
 
     std::string ip_;
     std::uint16_t port_;
+
+    /// Used instead of [ip_] and [port_] if not empty.
+    std::string unix_path_;
+    bool shm_;
 };
 
 } // namespace cdb
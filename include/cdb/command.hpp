@@ -5,8 +5,11 @@
 #ifndef COMMAND_HPP
 #define COMMAND_HPP
 
+#include <cstdint>
 #include <string>
+#include <utility>
 #include <vector>
+#include "arena.hpp"
 #include "rpc/msgpack.hpp"
 
 namespace cdb {
@@ -18,122 +21,314 @@ const command_type CMD_SET = 1;
 const command_type CMD_DEL = 2;
 const command_type CMD_UNKNOWN = 3;
 
-/// Base command class.
-class command {
-public:
-    /// Ctor.
-    command(command_type type = CMD_UNKNOWN) : type(type) {}
-    virtual ~command() = default;
+/// GET key
+struct get_command {
+    get_command() = default;
+    explicit get_command(std::string key) : key(std::move(key)) {}
 
-    /// Tag
-    command_type type = CMD_UNKNOWN;
+    std::string key;
+};
 
-    /// Returns the args of this command. 
-    /// NOTE: all args are serialized as std::string.
-    virtual std::vector<std::string> args() const = 0;
-    virtual void set_id(std::uint32_t) {}
-    virtual std::uint32_t id() const { return 0; }
+/// SET key value
+struct set_command {
+    set_command() = default;
+    set_command(std::string key, std::string value)
+        : key(std::move(key)), value(std::move(value)) {}
+
+    /// id is init'd by coordinator.
+    std::uint32_t id = 0;
+    std::string key;
+    std::string value;
+};
+
+/// DEL key1 key2 ...
+struct del_command {
+    del_command() = default;
+    explicit del_command(std::vector<std::string> keys) : keys(std::move(keys)) {}
 
-    // Make it serializable.
-    MSGPACK_DEFINE_ARRAY(type);
+    /// id is init'd by coordinator.
+    std::uint32_t id = 0;
+    std::vector<std::string> keys;
 };
 
-/// GET key
-class get_command : public command {
+/// Any of the commands above, held by value: a tagged union. Code that
+/// depends on the kind of command visit()s it, with a visitor overloading
+/// operator() for each of them; the overload is picked at compile time,
+/// and the tag is only looked at once.
+/// Commands pack with msgpack as the command they hold.
+class command {
 public:
     /// Ctors.
-    get_command();
-    get_command(std::string &&key);
-    get_command(const get_command &);
-    get_command(get_command &&);
-    virtual ~get_command() = default;
+    command(get_command cmd) : type_(CMD_GET), get_(std::move(cmd)) {}
+    command(set_command cmd) : type_(CMD_SET), set_(std::move(cmd)) {}
+    command(del_command cmd) : type_(CMD_DEL), del_(std::move(cmd)) {}
+    command(const command &cmd);
+    command(command &&cmd);
+    ~command();
 
     /// Assignment.
-    get_command& operator=(get_command);
-    get_command& operator=(get_command&&);
+    command &operator=(command cmd);
+
+    /// Tag.
+    command_type type() const { return type_; }
+
+    /// id of SET and DEL; 0 for GET.
+    std::uint32_t id() const;
+
+    /// Call [visitor] with the command held. All overloads must return
+    /// the same type.
+    template <typename Visitor>
+    auto visit(Visitor &&visitor) const -> decltype(visitor(std::declval<const get_command&>()))
+    {
+        switch (type_)
+        {
+        case CMD_SET:
+            return visitor(set_);
+        case CMD_DEL:
+            return visitor(del_);
+        default:
+            return visitor(get_);
+        }
+    }
 
-    /// GETTER.
-    std::string &key() { return key_; }
-    const std::string &key() const { return key_; }
+private:
+    friend void swap(command &a, command &b);
+
+    /// Construct the same kind of command as [cmd] from it.
+    void construct_from(const command &cmd);
+    void construct_from(command &&cmd);
+    void destroy();
+
+    command_type type_;
+    union {
+        get_command get_;
+        set_command set_;
+        del_command del_;
+    };
+};
 
-    virtual std::vector<std::string> args() const override;
+/// Non-owning view of [size] bytes at [data].
+struct string_ref {
+    string_ref() = default;
+    string_ref(const char *data, std::size_t size) : data(data), size(size) {}
 
-    MSGPACK_DEFINE_ARRAY(MSGPACK_BASE(command), key_)
+    std::string str() const { return std::string(data, size); }
 
-private:
-    friend void swap(get_command &a, get_command &b);
-    /// Key into the store.
-    std::string key_;
+    const char *data = nullptr;
+    std::size_t size = 0;
 };
 
-/// SET key value
-class set_command : public command {
-public:
-    /// Ctors.
-    set_command();
-    set_command(std::string &&key, std::string &&value);
-    set_command(const set_command&);
-    set_command(set_command&&);
-    virtual ~set_command() = default;
-
-    /// Assignment.
-    set_command& operator=(set_command);
-    set_command& operator=(set_command&&);
+/// A command as parsed, its strings being views into the bytes it was
+/// parsed from: it's valid as long as they are. The coordinator forwards
+/// it to the participants as is: msgpack packs it exactly as the
+/// get_command, set_command or del_command it stands for, so that they
+/// unpack it as such.
+struct command_ref {
+    command_ref() = default;
+    /// [args] are allocated from [a].
+    explicit command_ref(arena &a) : args(arena_allocator<string_ref>(a)) {}
+
+    /// Tag.
+    command_type type = CMD_UNKNOWN;
 
-    /// GETTER.
-    virtual void set_id(std::uint32_t id) override { id_ = id; }
-    virtual std::uint32_t id() const override { return id_; }
+    /// id is init'd by coordinator, for SET and DEL.
+    std::uint32_t id = 0;
 
-    std::string &key() { return key_; }
-    const std::string &key() const { return key_; }
+    /// The bulk strings following the command type: the keys of DEL,
+    /// the key then the value of SET.
+    /// NOTE: GET keys and SET values of more than one string are them
+    /// all, separated by spaces.
+    std::vector<string_ref, arena_allocator<string_ref>> args;
+};
 
-    std::string &value() { return value_; }
-    const std::string &value() const { return value_; }
+} // namespace cdb
 
-    virtual std::vector<std::string> args() const override;
+namespace clmdep_msgpack {
+MSGPACK_API_VERSION_NAMESPACE(v1) {
+namespace adaptor {
+
+/// The commands pack as arrays, their first element being the array
+/// [type]. Unpacking doesn't look at it: the RPC tells the type.
+
+template <>
+struct pack<cdb::get_command> {
+    template <typename Stream>
+    packer<Stream>& operator()(packer<Stream>& o, const cdb::get_command& v) const {
+        o.pack_array(2);
+        o.pack_array(1);
+        o.pack(cdb::CMD_GET);
+        o.pack(v.key);
+        return o;
+    }
+};
 
-    MSGPACK_DEFINE_ARRAY(MSGPACK_BASE(command), id_, key_, value_)
+template <>
+struct convert<cdb::get_command> {
+    clmdep_msgpack::object const& operator()(clmdep_msgpack::object const& o, cdb::get_command& v) const {
+        if (o.type != clmdep_msgpack::type::ARRAY || o.via.array.size < 2)
+            throw clmdep_msgpack::type_error();
+        o.via.array.ptr[1].convert(v.key);
+        return o;
+    }
+};
 
-private:
-    friend void swap(set_command &a, set_command &b);
+template <>
+struct pack<cdb::set_command> {
+    template <typename Stream>
+    packer<Stream>& operator()(packer<Stream>& o, const cdb::set_command& v) const {
+        o.pack_array(4);
+        o.pack_array(1);
+        o.pack(cdb::CMD_SET);
+        o.pack(v.id);
+        o.pack(v.key);
+        o.pack(v.value);
+        return o;
+    }
+};
 
-    /// id_ is init'd by coordinator.
-    std::uint32_t id_ = 0;
-    std::string key_;
-    std::string value_;
+template <>
+struct convert<cdb::set_command> {
+    clmdep_msgpack::object const& operator()(clmdep_msgpack::object const& o, cdb::set_command& v) const {
+        if (o.type != clmdep_msgpack::type::ARRAY || o.via.array.size < 4)
+            throw clmdep_msgpack::type_error();
+        o.via.array.ptr[1].convert(v.id);
+        o.via.array.ptr[2].convert(v.key);
+        o.via.array.ptr[3].convert(v.value);
+        return o;
+    }
 };
 
-/// DEL key1 key2 ...
-class del_command : public command {
-public:
-    /// Ctors.
-    del_command();
-    del_command(std::vector<std::string> &&args);
-    del_command(const del_command&);
-    del_command(del_command&&);
-    virtual ~del_command() = default;
+template <>
+struct pack<cdb::del_command> {
+    template <typename Stream>
+    packer<Stream>& operator()(packer<Stream>& o, const cdb::del_command& v) const {
+        o.pack_array(3);
+        o.pack_array(1);
+        o.pack(cdb::CMD_DEL);
+        o.pack(v.id);
+        o.pack(v.keys);
+        return o;
+    }
+};
 
-    /// Assignment.
-    del_command& operator=(del_command);
-    del_command& operator=(del_command&&);
+template <>
+struct convert<cdb::del_command> {
+    clmdep_msgpack::object const& operator()(clmdep_msgpack::object const& o, cdb::del_command& v) const {
+        if (o.type != clmdep_msgpack::type::ARRAY || o.via.array.size < 3)
+            throw clmdep_msgpack::type_error();
+        o.via.array.ptr[1].convert(v.id);
+        o.via.array.ptr[2].convert(v.keys);
+        return o;
+    }
+};
 
-    virtual void set_id(std::uint32_t id) override { id_ = id; }
-    virtual std::uint32_t id() const override { return id_; }
-    void set_keys(std::vector<std::string> const &keys) { keys_ = keys; }
+template <>
+struct pack<cdb::command> {
+    template <typename Stream>
+    struct visitor {
+        template <typename T>
+        packer<Stream>& operator()(const T& cmd) const { return o.pack(cmd); }
 
-    virtual std::vector<std::string> args() const override;
+        packer<Stream>& o;
+    };
 
-    MSGPACK_DEFINE_ARRAY(MSGPACK_BASE(command), id_, keys_);
+    template <typename Stream>
+    packer<Stream>& operator()(packer<Stream>& o, const cdb::command& v) const {
+        return v.visit(visitor<Stream>{ o });
+    }
+};
 
-private:
-    friend void swap(del_command &a, del_command &b);
+template <>
+struct convert<cdb::command> {
+    clmdep_msgpack::object const& operator()(clmdep_msgpack::object const& o, cdb::command& v) const {
+        /// Here, the type is what tells.
+        if (o.type != clmdep_msgpack::type::ARRAY || o.via.array.size < 1
+            || o.via.array.ptr[0].type != clmdep_msgpack::type::ARRAY || o.via.array.ptr[0].via.array.size < 1)
+            throw clmdep_msgpack::type_error();
+
+        switch (o.via.array.ptr[0].via.array.ptr[0].as<cdb::command_type>())
+        {
+        case cdb::CMD_GET:
+            v = o.as<cdb::get_command>();
+            break;
+        case cdb::CMD_SET:
+            v = o.as<cdb::set_command>();
+            break;
+        case cdb::CMD_DEL:
+            v = o.as<cdb::del_command>();
+            break;
+        default:
+            throw clmdep_msgpack::type_error();
+        }
+        return o;
+    }
+};
 
-    /// id_ is init'd by coordinator.
-    std::uint32_t id_ = 0;
-    std::vector<std::string> keys_;
+template <>
+struct pack<cdb::command_ref> {
+    template <typename Stream>
+    packer<Stream>& operator()(packer<Stream>& o, const cdb::command_ref& v) const {
+        auto pack_str = [&](const cdb::string_ref &str) {
+            o.pack_str(static_cast<uint32_t>(str.size));
+            if (str.size)
+                o.pack_str_body(str.data, static_cast<uint32_t>(str.size));
+        };
+
+        /// args[first] onwards, separated by spaces.
+        auto pack_joined = [&](std::size_t first) {
+            std::size_t size = first < v.args.size() ? v.args.size() - first - 1 : 0;
+            for (std::size_t i = first; i < v.args.size(); i++)
+                size += v.args[i].size;
+
+            o.pack_str(static_cast<uint32_t>(size));
+            for (std::size_t i = first; i < v.args.size(); i++)
+            {
+                if (i != first)
+                    o.pack_str_body(" ", 1);
+                if (v.args[i].size)
+                    o.pack_str_body(v.args[i].data, static_cast<uint32_t>(v.args[i].size));
+            }
+        };
+
+        /// The array [type] commands start with.
+        auto pack_base = [&]() {
+            o.pack_array(1);
+            o.pack(v.type);
+        };
+
+        switch (v.type)
+        {
+        case cdb::CMD_GET:
+            o.pack_array(2);
+            pack_base();
+            pack_joined(0);
+            break;
+        case cdb::CMD_SET:
+            o.pack_array(4);
+            pack_base();
+            o.pack(v.id);
+            pack_str(v.args.empty() ? cdb::string_ref() : v.args[0]);
+            pack_joined(1);
+            break;
+        case cdb::CMD_DEL:
+            o.pack_array(3);
+            pack_base();
+            o.pack(v.id);
+            o.pack_array(static_cast<uint32_t>(v.args.size()));
+            for (auto &key : v.args)
+                pack_str(key);
+            break;
+        default:
+            pack_base();
+            break;
+        }
+        return o;
+    }
 };
 
-} // namespace cdb
+} // namespace adaptor
+} // MSGPACK_API_VERSION_NAMESPACE(v1)
+} // namespace clmdep_msgpack
 
 
 #endif
\ No newline at end of file
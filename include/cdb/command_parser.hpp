@@ -11,41 +11,48 @@
 
 namespace cdb {
 
-/// Command parser parses a command from the given data.
-/// If the given data is not complete, the parser simply rejects
-/// and throws a parse_error.
+/// Command parser parses the commands a client streams, one RESP array
+/// of bulk strings at a time. It's resumable: handed the first bytes of a
+/// command, it parses as far as they go and remembers where it stopped,
+/// so that once more bytes have arrived only those are looked at. Bulk
+/// strings are skipped over rather than scanned, and aren't copied: the
+/// commands refer to them where they are. Running out of bytes is no
+/// error, and nothing throws.
+/// Commands that arrived whole, as pipelined ones do, are framed in one
+/// go rather than byte by byte.
 /// We've designed the parser to be synchronous. This simplified the whole
 /// coordinator design.
 class command_parser {
 public:
-    /*
-    Move sementics.
-    */
-    /// Ctor.
-    command_parser() = default;
-    command_parser(const command_parser&) = delete;
-    command_parser(command_parser &&);
-    ~command_parser() = default;
-
-    /// Convenient ctor.
-    command_parser(std::vector<char> &&data);
-
-    /// Assignment.
-    command_parser& operator=(const command_parser&) = delete;
-    command_parser& operator=(command_parser &&);
+    /// Outcome of feed().
+    enum class status
+    {
+        /// A command was parsed.
+        COMMAND,
+        /// The command isn't complete yet.
+        NEED_MORE,
+        /// Not a valid command, see error().
+        SYNTAX_ERROR,
+    };
 
-    /// GETTER
-    std::vector<char> &data() { return data_; }
-    const std::vector<char> &data() const { return data_; }
+    /// Ctor.
+    command_parser();
 
-    /// Read a command from the given data.
-    std::unique_ptr<command> read_command();
+    /// Parse the command starting at [data], of which [size] bytes have
+    /// arrived so far.
+    /// After NEED_MORE, call again with the same bytes in front once more
+    /// have arrived: parsing resumes where it stopped. The bytes may have
+    /// moved in memory meanwhile.
+    /// After COMMAND, [cmd] is set, referring to the first [cmd_size]
+    /// bytes of [data], and the parser is ready for the next command.
+    /// After SYNTAX_ERROR, it stays in error until reset().
+    status feed(const char *data, std::size_t size, command_ref &cmd, std::size_t &cmd_size);
 
-    /// Indicating whether parser is done.
-    bool is_done();
+    /// Forget the command being parsed, and any error.
+    void reset();
 
-    /// How many bytes are left to be parsed.
-    std::size_t bytes_parsed();
+    /// What was wrong, after SYNTAX_ERROR.
+    const char *error() const { return error_; }
 
     /// Encoders for GET/SET/DEL commands.
     static std::string encode_get(std::string const &key);
@@ -58,35 +65,57 @@ public:
     static std::string separator;
 
 private:
-    /// Read a single charactor.
-    char read_char();
-    /// Unread a single charactor.
-    char peek_char();
+    /// Where the parser stands within the current command.
+    enum class state
+    {
+        ARRAY_MARKER,
+        ARRAY_LENGTH,
+        ARRAY_LF,
+        BULK_MARKER,
+        BULK_LENGTH,
+        BULK_LENGTH_LF,
+        BULK_DATA,
+        BULK_CR,
+        BULK_LF,
+        ERROR,
+    };
+
+    /// Enter the error state.
+    status fail(const char *msg);
+
+    /// Fast path, for a command that has all arrived: frame it in one go,
+    /// its lengths and separators found by the kernels of resp_scan.hpp,
+    /// and set [offset_] past it. Return false, the parser being reset,
+    /// if it hasn't all arrived or is malformed; feed() then goes through
+    /// it byte by byte.
+    bool read_command(const char *data, std::size_t size);
+
+    /// The first bulk string of [data] is in: check it's a known
+    /// command with enough args.
+    bool read_command_type(const char *data);
+
+    /// Point [cmd] at the bulk strings of [data].
+    void make_command(const char *data, command_ref &cmd) const;
 
-    /// Read a RESP bulk string.
-    std::string read_bulk_string();
+private:
+    state state_;
 
-    /// Read the number of elems in the current RESP array.
-    std::size_t read_num_elem();
+    /// Bytes of the current command parsed so far.
+    std::size_t offset_;
 
-    /// Type of the command.
-    command_type read_command_type();
+    /// Length being read, and the number of its digits.
+    std::size_t length_;
+    std::size_t num_digits_;
 
-    /// Specific commands.
-    std::unique_ptr<command> read_get_command(std::size_t num_elem);
-    std::unique_ptr<command> read_set_command(std::size_t num_elem);
-    std::unique_ptr<command> read_del_command(std::size_t num_elem);
+    /// Number of elems announced by the array header.
+    std::size_t num_elem_;
 
-    void expect_char(char ch, const std::string &msg = "mismatching char");
-    void expect_separator();
+    /// Offset within the command and size of each bulk string read.
+    std::vector<std::pair<std::size_t, std::size_t>> args_;
 
-private:
-    /// Buffer for data from [client_].
-    std::vector<char> data_;
-    std::size_t idx_;
+    command_type type_;
 
-    /// Starting index of a command.
-    std::size_t start_idx_;
+    const char *error_;
 };
 
 }    // namespace cdb
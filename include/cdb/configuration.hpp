@@ -37,6 +37,24 @@ private:
     Extended fields.
     */
     void num_workers(configuration *conf, const std::string &value);
+    void num_reactors(configuration *conf, const std::string &value);
+    void io_uring(configuration *conf, const std::string &value);
+    void client_idle_timeout(configuration *conf, const std::string &value);
+    void client_read_timeout(configuration *conf, const std::string &value);
+    void client_output_watermark(configuration *conf, const std::string &value);
+    void client_pending_watermark(configuration *conf, const std::string &value);
+    void max_connections(configuration *conf, const std::string &value);
+    void max_buffered_bytes(configuration *conf, const std::string &value);
+    void accept_batch(configuration *conf, const std::string &value);
+    void request_workers(configuration *conf, const std::string &value);
+    void pipeline_depth(configuration *conf, const std::string &value);
+    void unix_socket(configuration *conf, const std::string &value);
+    void shm_socket(configuration *conf, const std::string &value);
+    void handoff_socket(configuration *conf, const std::string &value);
+    void busy_poll(configuration *conf, const std::string &value);
+    void socket_busy_poll(configuration *conf, const std::string &value);
+    void poll_cpus(configuration *conf, const std::string &value);
+    void worker_cpus(configuration *conf, const std::string &value);
     void storage_path(configuration *conf, const std::string &value);
 
     bool get_option(const std::string &line, std::string &op, std::string &value);
@@ -62,7 +80,8 @@ struct configuration {
     std::string addr;
     std::uint16_t port;
 
-    /// Number of callback workers.
+    /// Number of callback workers. The coordinator runs that many on
+    /// each of its reactors.
     std::size_t num_workers = 2;
 
     configuration() : mode(UNKNOWN) {}
@@ -78,6 +97,60 @@ struct coordinator_configuration : public configuration {
     /// IP address and ports of participants.
     std::vector<std::string> participant_addrs;
     std::vector<std::uint16_t> participant_ports;
+
+    /// Reactors clients are spread across, each pinned to a core.
+    std::size_t num_reactors = 1;
+
+    /// Serve clients through io_uring when the kernel supports it.
+    bool io_uring = false;
+
+    /// Milliseconds after which a client is disconnected if it stays
+    /// idle, or leaves a request incomplete. 0 disables the timeout.
+    std::uint32_t client_idle_timeout = 0;
+    std::uint32_t client_read_timeout = 0;
+
+    /// Flow control, 0 disables a limit. A client stops being read
+    /// while its unsent responses reach a high watermark, in bytes or in
+    /// number, and until they're back at the low one.
+    std::size_t output_low_watermark = 0;
+    std::size_t output_high_watermark = 0;
+    std::size_t pending_low_watermark = 0;
+    std::size_t pending_high_watermark = 0;
+
+    /// Caps over all clients.
+    std::size_t max_connections = 0;
+    std::size_t max_buffered_bytes = 0;
+
+    /// Connections accepted per wakeup of the listening socket.
+    std::size_t accept_batch = 64;
+
+    /// Threads requests are run on, apart from the callback workers.
+    std::size_t request_workers = 8;
+
+    /// Requests a client may have in flight before the coordinator stops
+    /// taking more from it.
+    std::size_t pipeline_depth = 64;
+
+    /// Path of a Unix domain socket also accepting clients, for those
+    /// on the same host. Empty if none.
+    std::string unix_socket;
+
+    /// Same, for clients exchanging requests through shared memory.
+    std::string shm_socket;
+
+    /// Unix domain socket a restarted coordinator takes this one over
+    /// through, without dropping connections. Empty disables it.
+    std::string handoff_socket;
+
+    /// Microseconds the reactors keep polling without blocking after
+    /// events, and the SO_BUSY_POLL of client sockets. 0 disables them.
+    std::uint32_t busy_poll = 0;
+    std::uint32_t socket_busy_poll = 0;
+
+    /// Cores the polling threads and the workers of the reactors are
+    /// pinned to, in turn. Empty keeps reactor i on core i.
+    std::vector<int> poll_cpus;
+    std::vector<int> worker_cpus;
 };
 
 /// Used by participants.
@@ -5,12 +5,19 @@
 #include <mutex>
 #include <condition_variable>
 #include <map>
+#include <memory>
 #include <set>
+#include <utility>
+#include <vector>
+#include "arena.hpp"
 #include "command.hpp"
+#include "command_parser.hpp"
 #include "configuration.hpp"
 #include "record.hpp"
+#include "shared_mutex.hpp"
 #include "rpc/client.h"
 #include "tcp_server/tcp_server.hpp"
+#include "tcp_server/thread_pool.hpp"
 
 namespace cdb {
 
@@ -30,6 +37,136 @@ public:
     void async_start();
 
 private:
+    struct client_state;
+
+    /// Holds the requests taken from a single read, and their responses.
+    /// Reset once they're all sent, to be reused by a later read.
+    struct request_batch {
+        arena memory;
+
+        /// Its requests that weren't sent yet.
+        std::size_t live = 0;
+    };
+
+    /// A command a client sent, from the read that brought it in until
+    /// its response is written. It runs on [request_pool_].
+    struct request : public cdb_tcp_server::pool_task {
+        request(coordinator &owner, client_state &state, request_batch &batch)
+            : owner(owner), state(state), batch(batch), cmd(batch.memory) {}
+
+        void run() override { owner.run_request(*this); }
+        void discard() override;
+
+        coordinator &owner;
+        client_state &state;
+        request_batch &batch;
+
+        /// Its strings are in [batch], which [response] also refers to
+        /// unless it's static.
+        command_ref cmd;
+        string_ref response;
+
+        /// Set once [response] is.
+        bool answered = false;
+
+        /// Disconnect the client once [response] is sent.
+        bool disconnect = false;
+
+        /// Set once it was handed to [request_pool_], and once it has
+        /// run: it no longer holds up the requests after it then.
+        bool started = false;
+        bool done = false;
+
+        /// Keeps [state] alive while it runs.
+        std::shared_ptr<client_state> keep_alive;
+
+        /// Next request of [state], in the order they were sent.
+        request *next = nullptr;
+    };
+
+    /// What the coordinator keeps per client.
+    struct client_state : public std::enable_shared_from_this<client_state> {
+        explicit client_state(std::shared_ptr<tcp_client> client)
+            : client(std::move(client)) {}
+        ~client_state();
+
+        /// Carries a partial command over from one read to the next.
+        command_parser parser;
+
+        std::shared_ptr<tcp_client> client;
+
+        /// Guards what follows: requests run on several threads.
+        std::mutex mutex;
+
+        /// Requests not sent yet, oldest first: their responses go out
+        /// in that order, as a prefix of them is done.
+        request *head = nullptr;
+        request *tail = nullptr;
+        std::size_t in_flight = 0;
+
+        /// Those not started yet.
+        std::size_t waiting = 0;
+
+        /// Set while reading is held for [in_flight] to drop below
+        /// [pipeline_depth].
+        bool held = false;
+
+        /// Set once an error was sent: the client is being disconnected,
+        /// and later responses are dropped.
+        bool closed = false;
+
+        std::vector<std::unique_ptr<request_batch>> batches;
+        std::vector<request_batch*> free_batches;
+
+        /// Scratch space of schedule_requests().
+        std::vector<request*> pending_writes;
+        std::vector<request*> pending_reads;
+    };
+
+    /// Connections to a participant that GETs are sent over, apart from
+    /// [participants_], so that they don't wait for writes to be done.
+    /// There are [request_workers] of them, each making a call at a
+    /// time: rpclib leaves Nagle's algorithm on, which holds pipelined
+    /// calls back.
+    struct reader {
+        reader(const std::string &ip, uint16_t port, std::size_t connections);
+
+        struct connection {
+            connection(const std::string &ip, uint16_t port);
+
+            /// Held during a call.
+            std::mutex mutex;
+            rpc::client client;
+        };
+        std::vector<std::unique_ptr<connection>> connections;
+
+        /// GETs go to the connections in turn.
+        std::atomic<std::size_t> next = ATOMIC_VAR_INIT(0);
+    };
+
+    typedef std::vector<std::pair<std::string/* IP:port */, std::shared_ptr<reader>>> reader_list;
+
+    /// Switch [svr_] to io_uring if configured.
+    void enable_io_uring();
+
+    /// Hand the flow control limits over to [svr_].
+    void apply_flow_control();
+
+    /// Hand the busy polling and CPU affinity settings over to [svr_].
+    void apply_threading();
+
+    /// Hand the extra listening sockets over to [svr_] and, if a handoff
+    /// socket is configured, take the coordinator running there over.
+    /// Return true if one was.
+    bool apply_listeners();
+
+    /// Called by [svr_] once its clients are drained for a successor.
+    /// Stops the heartbeat, which makes start() return.
+    void on_handoff();
+
+    /// Log how often the flow control limits were hit, if that changed.
+    void log_flow_control();
+
     /// Recover coordinator.
     void recovery();
 
@@ -57,37 +194,75 @@ private:
     void handle_new_client(std::shared_ptr<tcp_client> client);
 
     /// Called by callback workers of [svr] whenever a client
-    /// sends a new db request.
-    /// [prev_data] is not null if previous cmd is not complete yet.
+    /// sends new bytes. Commands are parsed in place from the
+    /// client's input buffer; an incomplete one stays there until the
+    /// next read, and the parser of [state] resumes it. Those that
+    /// arrived are copied into a request_batch, then run on
+    /// [request_pool_] as schedule_requests() allows.
     void handle_db_requests(std::shared_ptr<tcp_client> client, 
-                            std::shared_ptr<std::vector<char>> prev_data,
-                            tcp_client::read_result &req);
+                            std::shared_ptr<client_state> state,
+                            tcp_client::buffered_read_result &input);
+
+    /// Start the requests of [state] that nothing sent before them holds
+    /// up. Writes run one at a time, in order. A GET waits for the writes
+    /// before it that touch its key, and a write for the GETs before it
+    /// that read one of its keys.
+    /// NOTE: [state.mutex] is held.
+    void schedule_requests(client_state &state);
+
+    /// Run by [request_pool_].
+    void run_request(request &req);
+
+    /// Called once [req] has run: sends the responses now in order, and
+    /// starts what was waiting for it.
+    void finish_request(request &req);
 
-    void handle_db_get_request(std::shared_ptr<tcp_client> client, 
-                               get_command cmd);
+    /// Write the responses of the requests done at the head of [state],
+    /// in a single write, and release them.
+    /// NOTE: [state.mutex] is held.
+    void flush_responses(client_state &state);
 
-    void handle_db_set_request(std::shared_ptr<tcp_client> client, 
-                               set_command cmd);
+    /// Called by [svr_] when handing off, once clients are no longer
+    /// read: returns once the requests in flight are sent.
+    void wait_for_requests();
 
-    void handle_db_del_request(std::shared_ptr<tcp_client> client, 
-                               del_command cmd);
+    /// Publish [readers_] anew from [participants_], once they changed.
+    /// Only drops readers: connecting takes a while.
+    /// NOTE: [participants_mutex] is held.
+    void update_readers();
 
-    void commit_db_request(std::shared_ptr<tcp_client> client, std::uint32_t id, bool &participant_dead);
-    void abort_db_request(std::shared_ptr<tcp_client> client, std::uint32_t id, bool &participant_dead);
+    /// Connect readers to the participants that lack one, without
+    /// holding [participants_mutex] meanwhile, and publish them.
+    void connect_readers();
 
-    /// Helper.
-    void parse_db_requests(std::vector<char> &data, std::vector<std::unique_ptr<command> > &ret, std::size_t &bytes_parsed);
+    /// SET and DEL set the id of [req]'s command. The response is set
+    /// on [req].
+    void handle_db_get_request(request &req);
 
-    /// Command errors handler.
-    void handle_command_error(std::shared_ptr<tcp_client> client, 
-                              std::shared_ptr<std::vector<char>> data,
-                              bool is_incomplete);
+    void handle_db_set_request(request &req);
 
-    /// Sends a result back to client.
-    void send_result(std::shared_ptr<tcp_client> client, std::string const &ret, tcp_client::write_callback_t cb);
+    void handle_db_del_request(request &req);
 
-    /// Sends an error msg.
-    void send_error(std::shared_ptr<tcp_client> client);
+    /// Make the RPC [func] to all participants at once, and wait for
+    /// their responses until a deadline they share: a 2PC phase takes as
+    /// long as the slowest participant, not all of them in turn. Each
+    /// response is passed to [handler], in the order of [participants_].
+    /// A participant that fails, misses the deadline, or whose response
+    /// [handler] throws on is removed.
+    /// NOTE: lock is acquired before entering this function.
+    template <typename Handler, typename... Args>
+    void call_participants(bool &participant_dead, const std::string &func, Handler handler, Args... args);
+
+    /// [req] is nullptr when called from recovery.
+    void commit_db_request(request *req, std::uint32_t id, bool &participant_dead);
+    void abort_db_request(request *req, std::uint32_t id, bool &participant_dead);
+
+
+    /// Sets the result of [req].
+    void send_result(request &req, string_ref ret);
+
+    /// Sets an error msg; the client is disconnected once it's sent.
+    void send_error(request &req);
 
 private:
     /// config.
@@ -96,6 +271,9 @@ private:
     /// Underlying TCP server.
     tcp_server svr_;
 
+    /// Flow control events already logged.
+    std::uint64_t logged_flow_events_ = 0;
+
     /// Record manager.
     /// NOTE: also protected by [participants_mutex].
     record_manager r_manager_;
@@ -104,6 +282,15 @@ private:
     /// NOTE: protected by [participants_mutex].
     std::map<std::string/* IP:port */, std::unique_ptr<rpc::client>> participants_;
 
+    /// Readers of the participants in [participants_]. Replaced, not modified, as those change: GETs
+    /// keep using the list they took meanwhile.
+    /// NOTE: protected by [readers_mutex].
+    std::shared_ptr<const reader_list> readers_;
+    std::mutex readers_mutex_;
+
+    /// GETs go to the readers in turn.
+    std::atomic<std::size_t> next_reader_ = ATOMIC_VAR_INIT(0);
+
     /// Used for recovery. 
     std::set<std::string> del_keys_;
 
@@ -113,14 +300,31 @@ private:
     std::mutex participants_mutex_;
     std::condition_variable participants_cond_;
 
+    /// Held exclusively while participants apply a COMMIT, and shared
+    /// by GETs: those see it on every participant or on none.
+    shared_mutex commit_mutex_;
+
     /// Flag indicates whether coordinator is started.
     std::atomic<bool> is_started_ = ATOMIC_VAR_INIT(false);
 
     /// Flag indicates wether this coordinator is freshly restarted.
     std::atomic<bool> is_recovered = ATOMIC_VAR_INIT(true);
 
+    /// Set once a successor took over; the record log is its own then.
+    /// NOTE: set with [participants_mutex] held.
+    std::atomic<bool> is_handed_off_ = ATOMIC_VAR_INIT(false);
+
     /// Only used when async_start() is called.
     std::thread async_heartbeat_;
+
+    /// Requests of all clients that weren't sent yet, and what
+    /// wait_for_requests() waits on.
+    std::atomic<std::size_t> requests_in_flight_ = ATOMIC_VAR_INIT(0);
+    std::mutex requests_mutex_;
+    std::condition_variable requests_cond_;
+
+    /// Runs the requests. Last, so that it stops before the rest goes.
+    cdb_tcp_server::thread_pool request_pool_;
 };
 
 } // namespace cdb
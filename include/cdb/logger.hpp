@@ -23,6 +23,9 @@ public:
     /// Ctor.
     logger(level l = level::info) : level_(l) {}
 
+    /// Whether messages of level [l] are logged.
+    bool enabled(level l) const { return level_ >= l; }
+
     void error(const std::string &msg, const std::string &file, std::size_t line);
     void warn(const std::string &msg, const std::string &file, std::size_t line);
     void info(const std::string &msg, const std::string &file, std::size_t line);
@@ -44,8 +47,13 @@ void warn(const std::string &msg, const std::string &file, std::size_t line);
 void info(const std::string &msg, const std::string &file, std::size_t line);
 void debug(const std::string &msg, const std::string &file, std::size_t line);
 
-/// Helper macro to record line and file of the source.
-#define __CDB_LOG(l, msg)   cdb::l(msg, __FILE__, __LINE__)
+/// Helper macro to record line and file of the source. [msg] is only
+/// built if [default_logger] logs level [l].
+#define __CDB_LOG(l, msg)                                               \
+    do {                                                                \
+        if (cdb::default_logger()->enabled(cdb::logger::level::l))      \
+            cdb::l(msg, __FILE__, __LINE__);                            \
+    } while (0)
 
 } // namespace cdb
 
@@ -9,6 +9,7 @@
 #include <atomic>
 #include <condition_variable>
 #include <string>
+#include <map>
 #include <set>
 #include <mutex>
 #include "leveldb/db.h"
@@ -71,15 +72,6 @@ private:
     friend heartbeat_t;
 
 private:
-    /// Comparator.
-    struct command_cmp {
-        bool 
-        operator()(const std::unique_ptr<command> &lhs, const std::unique_ptr<command> &rhs) const
-        {
-            return lhs->id() < rhs->id();
-        }
-    };
-
     participant_configuration conf_;
 
     /// The actual server for responding RPCs.
@@ -100,8 +92,8 @@ private:
     get_snapshot_t *get_snapshot_;
     recover_t *recover_;
 
-    /// Pending requests.
-    std::set<std::unique_ptr<command>, command_cmp> db_requests_;
+    /// Pending requests, by id.
+    std::map<std::uint32_t, command> db_requests_;
 
     /// Monotonically increasing number. We'll use 1 as increment.
     /// The coordinator must assign ids correctly.
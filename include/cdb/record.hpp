@@ -5,6 +5,7 @@
 #ifndef CDB_RECORD_HPP
 #define CDB_RECORD_HPP
 
+#include <array>
 #include <string>
 #include <sstream>
 #include <fstream>
@@ -58,17 +59,18 @@ public:
     /// Used upon coordinator recovery.
     std::uint32_t next_id;
 
+    /// The size of a single record.
+    static const std::uint32_t record_size = 9;
+
     /// Convert to binary.
-    std::vector<unsigned char> to_binary() const;
+    std::array<unsigned char, record_size> to_binary() const;
 
     /// Parse binary to a record.
     static record parse(const std::vector<unsigned char> &binary);
 
-    /// The size of a single record.
-    static const std::uint32_t record_size = 9;
-
 private:
     friend class record_manager;
+    friend struct command_encoder;
     static void encode_uint32_t(std::vector<unsigned char> &binary, std::uint32_t val);
     static void encode_uint8_t(std::vector<unsigned char> &binary, std::uint8_t val);
 
@@ -86,22 +88,27 @@ public:
     /// Log a record.
     void log(const record &r);
 
-    /// Log a command. Used by the participant.
-    void log(const command *cmd);
+    /// Log a SET or DEL command. Used by the participant.
+    void log(const command &cmd);
 
     std::uint32_t next_id() const { return next_id_; }
 
+    /// Forget the in-memory records and read the log again, once
+    /// another process is done appending to it.
+    void reload();
+
     /// GETTER.
     std::map<std::uint32_t, record> &records() { return records_; }
-    std::map<std::uint32_t, std::unique_ptr<command>> &cmds() { return cmds_; }
+    std::map<std::uint32_t, command> &cmds() { return cmds_; }
 
 private:
     /// Initialize [records_]. Called within ctor.
     void init_records();
 
 private:
-    /// Name of the log file.
+    /// Name of the log file, and of the command log.
     std::string file_name_;
+    std::string cmd_file_name_;
 
     /// Actual log file.
     std::fstream file_;
@@ -112,7 +119,7 @@ private:
 
     /// In-memory records.
     std::map<std::uint32_t/* ID */, record> records_;
-    std::map<std::uint32_t/* ID */, std::unique_ptr<command>> cmds_;
+    std::map<std::uint32_t/* ID */, command> cmds_;
 };
 
 } // namespace cdb
@@ -0,0 +1,43 @@
+/// File: resp_scan.hpp
+/// ===================
+/// Copyright 2020 Cloud-fantasy team
+/// Scanning kernels the command parser frames RESP with.
+#ifndef RESP_SCAN_HPP
+#define RESP_SCAN_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace cdb {
+
+/// The implementations scan_digits() can run. The fastest one the CPU
+/// supports is picked at startup.
+enum class scan_kernel
+{
+    SCALAR,
+    SSE2,
+    AVX2,
+};
+
+/// Number of decimal digits [data] starts with, looking at [size] bytes
+/// at most. Ends on the '\r' of a well-formed length line, so this both
+/// checks the digits and finds the separator.
+std::size_t scan_digits(const char *data, std::size_t size);
+
+/// Value of the [size] digits at [data], as checked by scan_digits().
+/// At most 19 of them.
+std::uint64_t parse_digits(const char *data, std::size_t size);
+
+/// The kernel scan_digits() runs.
+scan_kernel active_scan_kernel();
+
+/// Have scan_digits() run [kernel] from now on, for benchmarks. Not
+/// thread-safe. Return false, changing nothing, if the CPU can't run it.
+bool set_scan_kernel(scan_kernel kernel);
+
+/// "scalar", "sse2" or "avx2".
+const char *scan_kernel_name(scan_kernel kernel);
+
+}    // namespace cdb
+
+#endif
@@ -0,0 +1,66 @@
+/// File: shared_mutex.hpp
+/// ======================
+/// Copyright 2020 Cloud-fantasy team
+/// Reader-writer lock, which C++11 lacks.
+#ifndef CDB_SHARED_MUTEX_HPP
+#define CDB_SHARED_MUTEX_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+
+namespace cdb {
+
+/// Any number of shared owners, or one exclusive owner. A waiting
+/// exclusive owner goes first: shared owners arriving after it wait,
+/// so that a steady stream of them can't starve it.
+/// Meets Lockable, so std::lock_guard takes it exclusively.
+class shared_mutex {
+public:
+    shared_mutex() : shared_(0), writers_(0), exclusive_(false) {}
+
+    shared_mutex(const shared_mutex&) = delete;
+    shared_mutex &operator=(const shared_mutex&) = delete;
+
+public:
+    void lock();
+    void unlock();
+
+    void lock_shared();
+    void unlock_shared();
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+
+    /// Shared owners, exclusive owners waiting or holding it, and
+    /// whether one holds it.
+    std::size_t shared_;
+    std::size_t writers_;
+    bool exclusive_;
+};
+
+/// std::shared_lock, for the same reason.
+class shared_lock {
+public:
+    explicit shared_lock(shared_mutex &m) : m_(&m) { m_->lock_shared(); }
+    ~shared_lock() { unlock(); }
+
+    shared_lock(const shared_lock&) = delete;
+    shared_lock &operator=(const shared_lock&) = delete;
+
+    /// Release early.
+    void unlock()
+    {
+        if (m_ != nullptr)
+            m_->unlock_shared();
+        m_ = nullptr;
+    }
+
+private:
+    shared_mutex *m_;
+};
+
+} // namespace cdb
+
+#endif
@@ -0,0 +1,66 @@
+#include <cstring>
+#include "arena.hpp"
+
+namespace cdb {
+
+arena::arena(std::size_t block_size)
+    : block_size_(block_size)
+    , capacity_(0)
+    , ptr_(nullptr)
+    , end_(nullptr) {}
+
+arena::~arena()
+{
+    for (auto &b : blocks_)
+        ::operator delete(b.data);
+}
+
+char *arena::copy(const char *data, std::size_t size)
+{
+    char *p = static_cast<char*>(allocate(size, 1));
+    if (size)
+        std::memcpy(p, data, size);
+    return p;
+}
+
+void arena::reset()
+{
+    /// Trade the blocks for a single one holding what they did, unless
+    /// that's too much to keep.
+    if (blocks_.size() > 1 || capacity_ > max_retained)
+    {
+        for (auto &b : blocks_)
+            ::operator delete(b.data);
+        blocks_.clear();
+
+        std::size_t size = capacity_;
+        capacity_ = 0;
+        if (size <= max_retained)
+        {
+            blocks_.push_back({ static_cast<char*>(::operator new(size)), size });
+            capacity_ = size;
+        }
+    }
+
+    ptr_ = blocks_.empty() ? nullptr : blocks_.front().data;
+    end_ = blocks_.empty() ? nullptr : blocks_.front().data + blocks_.front().size;
+}
+
+void *arena::allocate_block(std::size_t size, std::size_t align)
+{
+    /// Blocks double in size, so that a batch takes few of them.
+    std::size_t block_size = block_size_;
+    if (!blocks_.empty())
+        block_size = blocks_.back().size * 2;
+    if (block_size < size + align)
+        block_size = size + align;
+
+    blocks_.push_back({ static_cast<char*>(::operator new(block_size)), block_size });
+    capacity_ += block_size;
+
+    ptr_ = blocks_.back().data;
+    end_ = ptr_ + block_size;
+    return allocate(size, align);
+}
+
+}    // namespace cdb
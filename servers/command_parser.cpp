@@ -1,228 +1,255 @@
+#include <algorithm>
+#include <cstring>
 #include <sstream>
 #include "errors.hpp"
 #include "common.hpp"
 #include "command_parser.hpp"
+#include "resp_scan.hpp"
 
 namespace cdb {
 
 std::string command_parser::separator = "\r\n";
 
-command_parser::command_parser(std::vector<char> &&data)
-    : data_(std::move(data)), idx_(0), start_idx_(0) {}
+/// Way more digits than any length a request could carry.
+static const std::size_t max_digits = 18;
 
-command_parser::command_parser(command_parser &&cmd_parser)
-    : data_(std::move(cmd_parser.data_)), idx_(cmd_parser.idx_), start_idx_(cmd_parser.start_idx_) {}
+/// Bytes looked at for a length: room for the longest valid one and the
+/// separator after it, rounded up to a full vector.
+static const std::size_t scan_window = 32;
 
-command_parser& command_parser::operator=(command_parser &&cmd_parser)
+/// Read the "<digits>\r\n" at [pos] of [data] into [value], moving [pos]
+/// past it. False if it's malformed or hasn't all arrived.
+static bool read_length_line(const char *data, std::size_t size, std::size_t &pos, std::uint64_t &value)
 {
-    if (this != &cmd_parser)
-    {
-        std::swap(*this, cmd_parser);
-    }
-    return *this;
+    std::size_t available = std::min(size - pos, scan_window);
+    std::size_t n = scan_digits(data + pos, available);
+    if (n == 0 || n > max_digits || n + 2 > available
+        || data[pos + n] != '\r' || data[pos + n + 1] != '\n')
+        return false;
+
+    value = parse_digits(data + pos, n);
+    pos += n + 2;
+    return true;
 }
 
-bool command_parser::is_done()
+/// GET, SET or DEL, or CMD_UNKNOWN.
+static command_type command_type_of(const char *data, std::size_t size)
 {
-    return (idx_ == data_.size());
+    if (size != 3)
+        return CMD_UNKNOWN;
+    if (std::memcmp(data, "GET", 3) == 0)
+        return CMD_GET;
+    if (std::memcmp(data, "SET", 3) == 0)
+        return CMD_SET;
+    if (std::memcmp(data, "DEL", 3) == 0)
+        return CMD_DEL;
+    return CMD_UNKNOWN;
 }
 
-std::size_t command_parser::bytes_parsed()
+command_parser::command_parser()
 {
-    return idx_;
+    reset();
 }
 
-std::unique_ptr<command> command_parser::read_command()
+void command_parser::reset()
 {
-    // Record starting index.
-    start_idx_ = idx_;
-
-    // Must be a RESP array.
-    expect_char('*');
-
-    /// Number of elems composed of this command.
-    std::size_t num_elem = read_num_elem();
-    expect_separator();
-
-    // Type of the command.
-    command_type type = read_command_type();
-    expect_separator();
-
-    switch (type)
-    {
-        case CMD_GET: return read_get_command(num_elem);
-        case CMD_SET: return read_set_command(num_elem);
-        case CMD_DEL: return read_del_command(num_elem);
-        default:
-            __PARSER_THROW_SYNTAX("unregconized command");
-    }
-
-    return nullptr;
+    state_ = state::ARRAY_MARKER;
+    offset_ = 0;
+    length_ = 0;
+    num_digits_ = 0;
+    num_elem_ = 0;
+    args_.clear();
+    type_ = CMD_UNKNOWN;
+    error_ = "";
 }
 
-std::size_t command_parser::read_num_elem()
+command_parser::status command_parser::fail(const char *msg)
 {
-    std::stringstream num_stream;
-    char ch = peek_char();
+    state_ = state::ERROR;
+    error_ = msg;
+    return status::SYNTAX_ERROR;
+}
 
-    /// Consume all numeric char
-    while (ch >= '0' && ch <= '9')
+command_parser::status
+command_parser::feed(const char *data, std::size_t size, command_ref &cmd, std::size_t &cmd_size)
+{
+    if (offset_ == 0 && read_command(data, size))
     {
-        read_char();
-        num_stream << ch;
-        ch = peek_char();
+        make_command(data, cmd);
+        cmd_size = offset_;
+        reset();
+        return status::COMMAND;
     }
 
-    try
+    while (offset_ < size)
     {
-        std::string num_str = num_stream.str();
-        std::size_t num = std::stol(num_str);
+        char ch = data[offset_];
+        switch (state_)
+        {
+        case state::ARRAY_MARKER:
+            // Must be a RESP array.
+            if (ch != '*')
+                return fail("expecting '*'");
+            offset_++;
+            length_ = 0;
+            num_digits_ = 0;
+            state_ = state::ARRAY_LENGTH;
+            break;
+
+        case state::ARRAY_LENGTH:
+        case state::BULK_LENGTH:
+            if (ch >= '0' && ch <= '9')
+            {
+                if (++num_digits_ > max_digits)
+                    return fail("length out of range");
+
+                length_ = length_ * 10 + (ch - '0');
+                offset_++;
+                break;
+            }
+
+            if (ch != '\r' || num_digits_ == 0)
+                return fail("invalid length");
+            offset_++;
+            state_ = state_ == state::ARRAY_LENGTH ? state::ARRAY_LF : state::BULK_LENGTH_LF;
+            break;
+
+        case state::ARRAY_LF:
+            if (ch != '\n')
+                return fail("expecting separator");
+            offset_++;
+
+            /// The command type and at least one arg.
+            if (length_ < 2)
+                return fail("missing args");
+            num_elem_ = length_;
+            state_ = state::BULK_MARKER;
+            break;
+
+        case state::BULK_MARKER:
+            if (ch != '$')
+                return fail("expecting '$'");
+            offset_++;
+            length_ = 0;
+            num_digits_ = 0;
+            state_ = state::BULK_LENGTH;
+            break;
+
+        case state::BULK_LENGTH_LF:
+            if (ch != '\n')
+                return fail("expecting separator");
+            offset_++;
+            args_.emplace_back(offset_, length_);
+            state_ = state::BULK_DATA;
+            break;
+
+        case state::BULK_DATA:
+        {
+            /// Skipped over as a whole, whatever the bytes.
+            std::size_t end = args_.back().first + args_.back().second;
+            if (size - offset_ < end - offset_)
+            {
+                offset_ = size;
+                return status::NEED_MORE;
+            }
+            offset_ = end;
+            state_ = state::BULK_CR;
+            break;
+        }
+
+        case state::BULK_CR:
+            if (ch != '\r')
+                return fail("expecting separator");
+            offset_++;
+            state_ = state::BULK_LF;
+            break;
+
+        case state::BULK_LF:
+            if (ch != '\n')
+                return fail("expecting separator");
+            offset_++;
+
+            if (args_.size() == 1 && !read_command_type(data))
+                return status::SYNTAX_ERROR;
+
+            if (args_.size() < num_elem_)
+            {
+                state_ = state::BULK_MARKER;
+                break;
+            }
+
+            make_command(data, cmd);
+            cmd_size = offset_;
+            reset();
+            return status::COMMAND;
+
+        case state::ERROR:
+            return status::SYNTAX_ERROR;
+        }
+    }
 
-        return num;
-    } catch (std::exception &e) { __PARSER_THROW_SYNTAX("error read_num_elem"); }
+    return state_ == state::ERROR ? status::SYNTAX_ERROR : status::NEED_MORE;
 }
 
-command_type command_parser::read_command_type()
+bool command_parser::read_command(const char *data, std::size_t size)
 {
-    std::string type_str = read_bulk_string();
-    if (type_str == "GET")
-        return CMD_GET;
-    if (type_str == "SET")
-        return CMD_SET;
-    if (type_str == "DEL")
-        return CMD_DEL;
+    std::size_t pos = 1;
+    std::uint64_t num_elem;
+    if (size == 0 || data[0] != '*' || !read_length_line(data, size, pos, num_elem) || num_elem < 2)
+        return false;
 
-    __PARSER_THROW_SYNTAX("unknown command type");
-}
-
-std::unique_ptr<command>
-command_parser::read_get_command(std::size_t num_elem)
-{
-    if (num_elem == 0)
-        __PARSER_THROW_SYNTAX("mismatching args");
+    for (std::uint64_t i = 0; i < num_elem; i++)
+    {
+        std::uint64_t length;
+        if (pos == size || data[pos] != '$' || !read_length_line(data, size, ++pos, length)
+            || size - pos < length + 2 || data[pos + length] != '\r' || data[pos + length + 1] != '\n')
+            break;
 
-    /// Read the key.
-    std::stringstream key_stream;
-    key_stream << read_bulk_string();
-    expect_separator();
+        args_.emplace_back(pos, length);
+        pos += length + 2;
+    }
 
-    /// NOTE: If there are more than one string, we'll concatenate them as a single key.
-    for (std::size_t i = 2; i < num_elem; i++)
+    if (args_.size() == num_elem)
     {
-        key_stream << " " << read_bulk_string();
-        expect_separator();
+        type_ = command_type_of(data + args_[0].first, args_[0].second);
+        if (type_ != CMD_UNKNOWN && (type_ != CMD_SET || num_elem >= 3))
+        {
+            num_elem_ = num_elem;
+            offset_ = pos;
+            return true;
+        }
     }
 
-    std::string key = key_stream.str();
-    std::unique_ptr<command> get_cmd{ new get_command(std::move(key)) };
-    return get_cmd;
+    reset();
+    return false;
 }
 
-std::unique_ptr<command>
-command_parser::read_set_command(std::size_t num_elem)
+bool command_parser::read_command_type(const char *data)
 {
-    if (num_elem < 2)
-        __PARSER_THROW_SYNTAX("missing args");
-
-    /// NOTE: Wasn't mine idea.
-    std::string key = read_bulk_string();
-    expect_separator();
-
-    /// Read the value.
-    std::stringstream value_stream;
-    value_stream << read_bulk_string();
-    expect_separator();
-
-    /// NOTE: if there are more than one string, we'll concatenate them as a single value.
-    for (std::size_t i = 3; i < num_elem; i++)
+    type_ = command_type_of(data + args_[0].first, args_[0].second);
+    if (type_ == CMD_UNKNOWN)
     {
-        value_stream << " " << read_bulk_string();
-        expect_separator();
+        fail("unknown command type");
+        return false;
     }
 
-    std::string value = value_stream.str();
-    std::unique_ptr<command> set_cmd{ new set_command{std::move(key), std::move(value)} };
-    return set_cmd;
-}
-
-std::unique_ptr<command>
-command_parser::read_del_command(std::size_t num_elem)
-{
-    if (num_elem == 0)
-        __PARSER_THROW_SYNTAX("mising args");
-
-    /// Consume as many keys as we can.
-    std::vector<std::string> keys;
-    keys.push_back(read_bulk_string());
-    expect_separator();
-
-    for (std::size_t i = 2; i < num_elem; i++)
+    /// SET takes a key and a value.
+    if (type_ == CMD_SET && num_elem_ < 3)
     {
-        keys.push_back(read_bulk_string());
-        expect_separator();
+        fail("missing args");
+        return false;
     }
 
-    std::unique_ptr<command> del_cmd{ new del_command{ std::move(keys) } };
-    return del_cmd;
-}
-
-/// TODO: I think it'd make more sense to be able to parse simple strings too.
-std::string command_parser::read_bulk_string()
-{
-    expect_char('$', "expecting '$'");
-
-    /// Get the size of the string.
-    std::size_t num_elem = read_num_elem();
-    expect_separator();
-
-    /// Read string itself.
-    std::stringstream type_stream;
-    for (std::size_t i = 0; i < num_elem; i++)
-        type_stream << read_char();
-
-    return type_stream.str();
-}
-
-void command_parser::expect_char(char ch, const std::string &msg)
-{
-    char c = read_char();
-    if (c != ch)
-        __PARSER_THROW_SYNTAX(msg);
-}
-
-void command_parser::expect_separator()
-{
-    char c = read_char();
-    if (c != '\r')
-        __PARSER_THROW_SYNTAX("expect separator");
-
-    c = read_char();
-    if (c != '\n')
-        __PARSER_THROW_SYNTAX("expect separator");
+    return true;
 }
 
-char command_parser::read_char()
+void command_parser::make_command(const char *data, command_ref &cmd) const
 {
-    char ch = peek_char();
-
-    idx_++;
-    return ch;
-}
-
-char command_parser::peek_char()
-{
-    /// Buffer is empty.
-    if (data_.empty())
-    {
-        __PARSER_THROW_INCOMPLETE("fail reading from client");
-    }
-    /// Buffer is full. Discard all data consumed.
-    else if (idx_ == data_.size())
-    {
-        __PARSER_THROW_INCOMPLETE("incomplete command");
-    }
-
-    return data_[idx_];
+    cmd.type = type_;
+    cmd.id = 0;
+    cmd.args.clear();
+    for (std::size_t i = 1; i < args_.size(); i++)
+        cmd.args.emplace_back(data + args_[i].first, args_[i].second);
 }
 
 std::string command_parser::encode_get(std::string const &key) {
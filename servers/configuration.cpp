@@ -22,6 +22,7 @@ participant_configuration::participant_configuration(participant_configuration &
     , storage_path(std::move(conf.storage_path)) {
         addr = std::move(conf.addr);
         port = conf.port;
+        num_workers = conf.num_workers;
     }
 
 participant_configuration &participant_configuration::operator=(participant_configuration &&conf)
@@ -34,6 +35,7 @@ participant_configuration &participant_configuration::operator=(participant_conf
     std::swap(storage_path, conf.storage_path);
     std::swap(addr, conf.addr);
     std::swap(port, conf.port);
+    std::swap(num_workers, conf.num_workers);
     return *this;
 }
 
@@ -45,9 +47,30 @@ coordinator_configuration::coordinator_configuration()
 coordinator_configuration::coordinator_configuration(coordinator_configuration &&conf)
     : configuration(COORDINATOR)
     , participant_addrs(std::move(conf.participant_addrs))
-    , participant_ports(std::move(conf.participant_ports)) {
+    , participant_ports(std::move(conf.participant_ports))
+    , num_reactors(conf.num_reactors)
+    , io_uring(conf.io_uring)
+    , client_idle_timeout(conf.client_idle_timeout)
+    , client_read_timeout(conf.client_read_timeout)
+    , output_low_watermark(conf.output_low_watermark)
+    , output_high_watermark(conf.output_high_watermark)
+    , pending_low_watermark(conf.pending_low_watermark)
+    , pending_high_watermark(conf.pending_high_watermark)
+    , max_connections(conf.max_connections)
+    , max_buffered_bytes(conf.max_buffered_bytes)
+    , accept_batch(conf.accept_batch)
+    , request_workers(conf.request_workers)
+    , pipeline_depth(conf.pipeline_depth)
+    , unix_socket(std::move(conf.unix_socket))
+    , shm_socket(std::move(conf.shm_socket))
+    , handoff_socket(std::move(conf.handoff_socket))
+    , busy_poll(conf.busy_poll)
+    , socket_busy_poll(conf.socket_busy_poll)
+    , poll_cpus(std::move(conf.poll_cpus))
+    , worker_cpus(std::move(conf.worker_cpus)) {
         addr = std::move(conf.addr);
         port = conf.port;
+        num_workers = conf.num_workers;
     }
 
 coordinator_configuration &coordinator_configuration::operator=(coordinator_configuration &&conf)
@@ -59,6 +82,27 @@ coordinator_configuration &coordinator_configuration::operator=(coordinator_conf
     participant_ports = std::move(conf.participant_ports);
     addr = std::move(conf.addr);
     port = conf.port;
+    num_workers = conf.num_workers;
+    num_reactors = conf.num_reactors;
+    io_uring = conf.io_uring;
+    client_idle_timeout = conf.client_idle_timeout;
+    client_read_timeout = conf.client_read_timeout;
+    output_low_watermark = conf.output_low_watermark;
+    output_high_watermark = conf.output_high_watermark;
+    pending_low_watermark = conf.pending_low_watermark;
+    pending_high_watermark = conf.pending_high_watermark;
+    max_connections = conf.max_connections;
+    max_buffered_bytes = conf.max_buffered_bytes;
+    accept_batch = conf.accept_batch;
+    request_workers = conf.request_workers;
+    pipeline_depth = conf.pipeline_depth;
+    unix_socket = std::move(conf.unix_socket);
+    shm_socket = std::move(conf.shm_socket);
+    handoff_socket = std::move(conf.handoff_socket);
+    busy_poll = conf.busy_poll;
+    socket_busy_poll = conf.socket_busy_poll;
+    poll_cpus = std::move(conf.poll_cpus);
+    worker_cpus = std::move(conf.worker_cpus);
     return *this;
 }
 
@@ -81,6 +125,24 @@ configuration_manager::configuration_manager()
     m["coordinator_info"] = std::bind(&configuration_manager::coordinator_info, this, std::placeholders::_1, std::placeholders::_2);
     m["participant_info"] = std::bind(&configuration_manager::participant_info, this, std::placeholders::_1, std::placeholders::_2);
     m["num_workers"] = std::bind(&configuration_manager::num_workers, this, std::placeholders::_1, std::placeholders::_2);
+    m["num_reactors"] = std::bind(&configuration_manager::num_reactors, this, std::placeholders::_1, std::placeholders::_2);
+    m["io_uring"] = std::bind(&configuration_manager::io_uring, this, std::placeholders::_1, std::placeholders::_2);
+    m["client_idle_timeout"] = std::bind(&configuration_manager::client_idle_timeout, this, std::placeholders::_1, std::placeholders::_2);
+    m["client_read_timeout"] = std::bind(&configuration_manager::client_read_timeout, this, std::placeholders::_1, std::placeholders::_2);
+    m["client_output_watermark"] = std::bind(&configuration_manager::client_output_watermark, this, std::placeholders::_1, std::placeholders::_2);
+    m["client_pending_watermark"] = std::bind(&configuration_manager::client_pending_watermark, this, std::placeholders::_1, std::placeholders::_2);
+    m["max_connections"] = std::bind(&configuration_manager::max_connections, this, std::placeholders::_1, std::placeholders::_2);
+    m["max_buffered_bytes"] = std::bind(&configuration_manager::max_buffered_bytes, this, std::placeholders::_1, std::placeholders::_2);
+    m["accept_batch"] = std::bind(&configuration_manager::accept_batch, this, std::placeholders::_1, std::placeholders::_2);
+    m["request_workers"] = std::bind(&configuration_manager::request_workers, this, std::placeholders::_1, std::placeholders::_2);
+    m["pipeline_depth"] = std::bind(&configuration_manager::pipeline_depth, this, std::placeholders::_1, std::placeholders::_2);
+    m["unix_socket"] = std::bind(&configuration_manager::unix_socket, this, std::placeholders::_1, std::placeholders::_2);
+    m["shm_socket"] = std::bind(&configuration_manager::shm_socket, this, std::placeholders::_1, std::placeholders::_2);
+    m["handoff_socket"] = std::bind(&configuration_manager::handoff_socket, this, std::placeholders::_1, std::placeholders::_2);
+    m["busy_poll"] = std::bind(&configuration_manager::busy_poll, this, std::placeholders::_1, std::placeholders::_2);
+    m["socket_busy_poll"] = std::bind(&configuration_manager::socket_busy_poll, this, std::placeholders::_1, std::placeholders::_2);
+    m["poll_cpus"] = std::bind(&configuration_manager::poll_cpus, this, std::placeholders::_1, std::placeholders::_2);
+    m["worker_cpus"] = std::bind(&configuration_manager::worker_cpus, this, std::placeholders::_1, std::placeholders::_2);
     m["storage_path"] = std::bind(&configuration_manager::storage_path, this, std::placeholders::_1, std::placeholders::_2);
 }
 
@@ -201,6 +263,251 @@ configuration_manager::num_workers(configuration *conf, const std::string &value
     } catch (std::exception &e) { __CONF_THROW("invalid number of workers"); }
 }
 
+void
+configuration_manager::num_reactors(configuration *conf, const std::string &value)
+{
+    if (conf->mode != configuration::COORDINATOR)
+        __CONF_THROW("num_reactors specified in participant configuration");
+
+    try
+    {
+        std::size_t reactors = std::stoul(value);
+        if (reactors == 0)
+            throw std::invalid_argument("num_reactors");
+        static_cast<coordinator_configuration*>(conf)->num_reactors = reactors;
+    } catch (std::exception &e) { __CONF_THROW("invalid num_reactors"); }
+}
+
+void
+configuration_manager::io_uring(configuration *conf, const std::string &value)
+{
+    if (conf->mode != configuration::COORDINATOR)
+        __CONF_THROW("io_uring specified in participant configuration");
+
+    if (value == "on")
+        static_cast<coordinator_configuration*>(conf)->io_uring = true;
+    else if (value == "off")
+        static_cast<coordinator_configuration*>(conf)->io_uring = false;
+    else
+        __CONF_THROW("invalid io_uring, expect on or off");
+}
+
+void
+configuration_manager::client_idle_timeout(configuration *conf, const std::string &value)
+{
+    if (conf->mode != configuration::COORDINATOR)
+        __CONF_THROW("client_idle_timeout specified in participant configuration");
+
+    try
+    {
+        static_cast<coordinator_configuration*>(conf)->client_idle_timeout = std::stoul(value);
+    } catch (std::exception &e) { __CONF_THROW("invalid client_idle_timeout"); }
+}
+
+void
+configuration_manager::client_read_timeout(configuration *conf, const std::string &value)
+{
+    if (conf->mode != configuration::COORDINATOR)
+        __CONF_THROW("client_read_timeout specified in participant configuration");
+
+    try
+    {
+        static_cast<coordinator_configuration*>(conf)->client_read_timeout = std::stoul(value);
+    } catch (std::exception &e) { __CONF_THROW("invalid client_read_timeout"); }
+}
+
+/// "<low> <high>", low not above high.
+static void parse_watermarks(const std::string &value, std::size_t &low, std::size_t &high)
+{
+    std::istringstream ss{value};
+    if (!(ss >> low >> high) || low > high)
+        __CONF_THROW("invalid watermarks, expect <low> <high>");
+}
+
+void
+configuration_manager::client_output_watermark(configuration *conf, const std::string &value)
+{
+    if (conf->mode != configuration::COORDINATOR)
+        __CONF_THROW("client_output_watermark specified in participant configuration");
+
+    auto coor_conf = static_cast<coordinator_configuration*>(conf);
+    parse_watermarks(value, coor_conf->output_low_watermark, coor_conf->output_high_watermark);
+}
+
+void
+configuration_manager::client_pending_watermark(configuration *conf, const std::string &value)
+{
+    if (conf->mode != configuration::COORDINATOR)
+        __CONF_THROW("client_pending_watermark specified in participant configuration");
+
+    auto coor_conf = static_cast<coordinator_configuration*>(conf);
+    parse_watermarks(value, coor_conf->pending_low_watermark, coor_conf->pending_high_watermark);
+}
+
+void
+configuration_manager::max_connections(configuration *conf, const std::string &value)
+{
+    if (conf->mode != configuration::COORDINATOR)
+        __CONF_THROW("max_connections specified in participant configuration");
+
+    try
+    {
+        static_cast<coordinator_configuration*>(conf)->max_connections = std::stoul(value);
+    } catch (std::exception &e) { __CONF_THROW("invalid max_connections"); }
+}
+
+void
+configuration_manager::max_buffered_bytes(configuration *conf, const std::string &value)
+{
+    if (conf->mode != configuration::COORDINATOR)
+        __CONF_THROW("max_buffered_bytes specified in participant configuration");
+
+    try
+    {
+        static_cast<coordinator_configuration*>(conf)->max_buffered_bytes = std::stoul(value);
+    } catch (std::exception &e) { __CONF_THROW("invalid max_buffered_bytes"); }
+}
+
+void
+configuration_manager::accept_batch(configuration *conf, const std::string &value)
+{
+    if (conf->mode != configuration::COORDINATOR)
+        __CONF_THROW("accept_batch specified in participant configuration");
+
+    try
+    {
+        std::size_t batch = std::stoul(value);
+        if (batch == 0)
+            throw std::invalid_argument("accept_batch");
+        static_cast<coordinator_configuration*>(conf)->accept_batch = batch;
+    } catch (std::exception &e) { __CONF_THROW("invalid accept_batch"); }
+}
+
+void
+configuration_manager::request_workers(configuration *conf, const std::string &value)
+{
+    if (conf->mode != configuration::COORDINATOR)
+        __CONF_THROW("request_workers specified in participant configuration");
+
+    try
+    {
+        std::size_t workers = std::stoul(value);
+        if (workers == 0)
+            throw std::invalid_argument("request_workers");
+        static_cast<coordinator_configuration*>(conf)->request_workers = workers;
+    } catch (std::exception &e) { __CONF_THROW("invalid request_workers"); }
+}
+
+void
+configuration_manager::pipeline_depth(configuration *conf, const std::string &value)
+{
+    if (conf->mode != configuration::COORDINATOR)
+        __CONF_THROW("pipeline_depth specified in participant configuration");
+
+    try
+    {
+        std::size_t depth = std::stoul(value);
+        if (depth == 0)
+            throw std::invalid_argument("pipeline_depth");
+        static_cast<coordinator_configuration*>(conf)->pipeline_depth = depth;
+    } catch (std::exception &e) { __CONF_THROW("invalid pipeline_depth"); }
+}
+
+void
+configuration_manager::unix_socket(configuration *conf, const std::string &value)
+{
+    if (conf->mode != configuration::COORDINATOR)
+        __CONF_THROW("unix_socket specified in participant configuration");
+
+    if (value.empty())
+        __CONF_THROW("invalid unix_socket");
+    static_cast<coordinator_configuration*>(conf)->unix_socket = value;
+}
+
+void
+configuration_manager::shm_socket(configuration *conf, const std::string &value)
+{
+    if (conf->mode != configuration::COORDINATOR)
+        __CONF_THROW("shm_socket specified in participant configuration");
+
+    if (value.empty())
+        __CONF_THROW("invalid shm_socket");
+    static_cast<coordinator_configuration*>(conf)->shm_socket = value;
+}
+
+void
+configuration_manager::handoff_socket(configuration *conf, const std::string &value)
+{
+    if (conf->mode != configuration::COORDINATOR)
+        __CONF_THROW("handoff_socket specified in participant configuration");
+
+    if (value.empty())
+        __CONF_THROW("invalid handoff_socket");
+    static_cast<coordinator_configuration*>(conf)->handoff_socket = value;
+}
+
+void
+configuration_manager::busy_poll(configuration *conf, const std::string &value)
+{
+    if (conf->mode != configuration::COORDINATOR)
+        __CONF_THROW("busy_poll specified in participant configuration");
+
+    try
+    {
+        static_cast<coordinator_configuration*>(conf)->busy_poll = std::stoul(value);
+    } catch (std::exception &e) { __CONF_THROW("invalid busy_poll"); }
+}
+
+void
+configuration_manager::socket_busy_poll(configuration *conf, const std::string &value)
+{
+    if (conf->mode != configuration::COORDINATOR)
+        __CONF_THROW("socket_busy_poll specified in participant configuration");
+
+    try
+    {
+        static_cast<coordinator_configuration*>(conf)->socket_busy_poll = std::stoul(value);
+    } catch (std::exception &e) { __CONF_THROW("invalid socket_busy_poll"); }
+}
+
+/// "<cpu>,<cpu>,...".
+static void parse_cpus(const std::string &value, std::vector<int> &cpus)
+{
+    cpus.clear();
+
+    std::istringstream ss{value};
+    std::string cpu;
+    while (std::getline(ss, cpu, ','))
+    {
+        try
+        {
+            std::size_t end;
+            int n = std::stoi(cpu, &end);
+            if (n < 0 || cpu.find_first_not_of(" \t\r", end) != std::string::npos)
+                throw std::invalid_argument("cpu");
+            cpus.push_back(n);
+        } catch (std::exception &e) { __CONF_THROW("invalid cpu list, expect <cpu>,<cpu>,..."); }
+    }
+}
+
+void
+configuration_manager::poll_cpus(configuration *conf, const std::string &value)
+{
+    if (conf->mode != configuration::COORDINATOR)
+        __CONF_THROW("poll_cpus specified in participant configuration");
+
+    parse_cpus(value, static_cast<coordinator_configuration*>(conf)->poll_cpus);
+}
+
+void
+configuration_manager::worker_cpus(configuration *conf, const std::string &value)
+{
+    if (conf->mode != configuration::COORDINATOR)
+        __CONF_THROW("worker_cpus specified in participant configuration");
+
+    parse_cpus(value, static_cast<coordinator_configuration*>(conf)->worker_cpus);
+}
+
 void
 configuration_manager::storage_path(configuration *conf, const std::string &value)
 {
@@ -2,6 +2,8 @@
 #include <ctime>
 #include <iostream>
 #include <chrono>
+#include <cstring>
+#include <future>
 #include "errors.hpp"
 #include "logger.hpp"
 #include "common.hpp"
@@ -13,9 +15,40 @@ namespace cdb {
 
 coordinator::coordinator(coordinator_configuration &&conf)
     : conf_(std::move(conf))
-    , svr_()
+    , svr_(conf_.num_reactors, conf_.num_workers)
     , r_manager_("coordinator.log")
-    , participants_() {}
+    , participants_()
+    , request_pool_(conf_.request_workers) {}
+
+coordinator::reader::connection::connection(const std::string &ip, uint16_t port)
+    : client(ip, port)
+{
+    client.set_timeout(RPC_TIMEOUT);
+}
+
+coordinator::reader::reader(const std::string &ip, uint16_t port, std::size_t connections)
+{
+    for (std::size_t i = 0; i < connections; i++)
+        this->connections.emplace_back(new connection(ip, port));
+}
+
+coordinator::client_state::~client_state()
+{
+    /// Requests keep it alive while they run: those left never ran.
+    while (head != nullptr)
+    {
+        request *req = head;
+        head = req->next;
+        req->~request();
+    }
+}
+
+void coordinator::request::discard()
+{
+    /// [request_pool_] stopped first.
+    owner.send_error(*this);
+    owner.finish_request(*this);
+}
 
 void coordinator::start()
 {
@@ -24,12 +57,24 @@ void coordinator::start()
 
     is_started_ = true;
 
+    enable_io_uring();
+    apply_flow_control();
+    apply_threading();
+
+    /// Clients taken over are served as soon as [svr_] starts: recover
+    /// first. Otherwise bind first, which fails if another coordinator
+    /// is running here.
+    bool took_over = apply_listeners();
+    if (took_over)
+        recovery();
     svr_.start(conf_.addr, 
                conf_.port,
                std::bind(&coordinator::handle_new_client, this, std::placeholders::_1));
+    if (!took_over)
+        recovery();
 
-    recovery();
     heartbeat_participants();
+    __CDB_LOG(info, "handed over to the new coordinator");
 }
 
 /// Starts the heartbeat mechanism in a separate worker thread.
@@ -40,14 +85,98 @@ void coordinator::async_start()
 
     is_started_ = true;
 
+    enable_io_uring();
+    apply_flow_control();
+    apply_threading();
+
+    /// Same as above.
+    bool took_over = apply_listeners();
+    if (took_over)
+        recovery();
     svr_.start(conf_.addr,
                conf_.port,
                std::bind(&coordinator::handle_new_client, this, std::placeholders::_1));
-    
-    recovery();
+    if (!took_over)
+        recovery();
+
     async_heartbeat_ = std::thread(std::bind(&coordinator::heartbeat_participants, this));
 }
 
+void coordinator::enable_io_uring()
+{
+    if (conf_.io_uring && !svr_.enable_io_uring())
+        __CDB_LOG(warn, "io_uring is unavailable, falling back to the reactor");
+}
+
+void coordinator::apply_flow_control()
+{
+    auto &fc = svr_.get_flow_control();
+    fc.low_watermark = conf_.output_low_watermark;
+    fc.high_watermark = conf_.output_high_watermark;
+    fc.low_pending_writes = conf_.pending_low_watermark;
+    fc.high_pending_writes = conf_.pending_high_watermark;
+    fc.max_buffered_bytes = conf_.max_buffered_bytes;
+    svr_.set_max_connections(conf_.max_connections);
+    svr_.set_accept_batch(conf_.accept_batch);
+}
+
+void coordinator::apply_threading()
+{
+    svr_.set_cpu_affinity(conf_.poll_cpus, conf_.worker_cpus);
+    svr_.set_busy_poll(std::chrono::microseconds(conf_.busy_poll), conf_.socket_busy_poll);
+}
+
+bool coordinator::apply_listeners()
+{
+    if (!conf_.unix_socket.empty())
+        svr_.listen_unix(conf_.unix_socket);
+    if (!conf_.shm_socket.empty())
+        svr_.listen_shm(conf_.shm_socket);
+    if (conf_.handoff_socket.empty())
+        return false;
+
+    svr_.listen_handoff(conf_.handoff_socket);
+    svr_.set_handoff_callback(std::bind(&coordinator::on_handoff, this));
+    svr_.set_drain_callback(std::bind(&coordinator::wait_for_requests, this));
+    if (!svr_.take_over(conf_.handoff_socket))
+        return false;
+
+    /// The predecessor is done with the log: what it logged since the
+    /// ctor read it counts.
+    r_manager_.reload();
+    __CDB_LOG(info, "took over from the running coordinator");
+    return true;
+}
+
+void coordinator::on_handoff()
+{
+    /// The heartbeat may be resolving unfinished records: wait for it to
+    /// let go of the lock, and keep it from taking it again.
+    std::lock_guard<std::mutex> lock(participants_mutex_);
+    is_handed_off_ = true;
+    participants_cond_.notify_all();
+}
+
+void coordinator::log_flow_control()
+{
+    auto &fc = svr_.get_flow_control();
+    std::uint64_t watermark_pauses = fc.watermark_pauses;
+    std::uint64_t buffered_bytes_pauses = fc.buffered_bytes_pauses;
+    std::uint64_t rejected_connections = fc.rejected_connections;
+    std::uint64_t accept_pauses = fc.accept_pauses;
+
+    std::uint64_t events = watermark_pauses + buffered_bytes_pauses + rejected_connections + accept_pauses;
+    if (events == logged_flow_events_)
+        return;
+    logged_flow_events_ = events;
+
+    __CDB_LOG(info, "flow control: watermark pauses " + std::to_string(watermark_pauses)
+                    + ", max_buffered_bytes pauses " + std::to_string(buffered_bytes_pauses)
+                    + ", rejected connections " + std::to_string(rejected_connections)
+                    + ", accept pauses " + std::to_string(accept_pauses)
+                    + ", buffered bytes " + std::to_string(fc.buffered_bytes.load()));
+}
+
 void coordinator::recovery()
 {
     /// next_id_ initialization.
@@ -64,6 +193,7 @@ void coordinator::recovery()
     /// Initialize participants.
     init_participants();
     handle_unfinished_records();
+    connect_readers();
 }
 
 void coordinator::handle_unfinished_records()
@@ -95,6 +225,8 @@ void coordinator::handle_unfinished_records()
             break;
         }
     }
+    if (participant_dead)
+        update_readers();
     __CDB_LOG(debug, "handle_unfinished_records returned");
 }
 
@@ -109,6 +241,7 @@ void coordinator::init_participants()
         auto port = conf_.participant_ports[i];
         init_participant(ip, port);
     }
+    update_readers();
 }
 
 /// NOTE: The caller must acquired the lock.
@@ -153,7 +286,7 @@ PARTICIPANT_UP_TO_DATE:
 
 void coordinator::heartbeat_participants()
 {
-    for (;;)
+    while (!is_handed_off_)
     {
         const auto &addrs = conf_.participant_addrs;
         const auto &ports = conf_.participant_ports;
@@ -167,6 +300,8 @@ void coordinator::heartbeat_participants()
                 client.call("HEARTBEAT");
 
                 std::unique_lock<std::mutex> lock(participants_mutex_);
+                if (is_handed_off_)
+                    return;
 
                 std::string addr = addrs[i] + ":" + std::to_string(ports[i]);
                 if (!participants_.count(addr))
@@ -181,6 +316,9 @@ void coordinator::heartbeat_participants()
 
                         handle_unfinished_records();
                     }
+
+                    /// Recovering it may have removed others.
+                    update_readers();
                 }
                 __CDB_LOG(debug, "heartbeat: participants_.size() == " + std::to_string(participants_.size()));
             }
@@ -190,10 +328,17 @@ void coordinator::heartbeat_participants()
                 std::unique_lock<std::mutex> lock(participants_mutex_);
                 std::string addr = addrs[i] + ":" + std::to_string(ports[i]);
                 if (participants_.count(addr))
+                {
                     participants_.erase(addr);
+                    update_readers();
+                }
             }
         }
 
+        /// Readers of the participants added back.
+        connect_readers();
+        log_flow_control();
+
         {
             std::unique_lock<std::mutex> lock(participants_mutex_);
             participants_cond_.wait_for(lock, std::chrono::seconds(1));
@@ -270,143 +415,485 @@ void coordinator::handle_new_client(std::shared_ptr<tcp_client> client)
 {
     __CDB_LOG(info, "handle_new_client");
     try {
-        /// Asynchronously read a db request from client.
-        client->async_read({
-            1024,   /* 1024 is big enough for most db request. */
-            std::bind(&coordinator::handle_db_requests, this, client, nullptr, std::placeholders::_1)
-        });
+        client->set_idle_timeout(std::chrono::milliseconds{conf_.client_idle_timeout});
+        client->set_read_deadline(std::chrono::milliseconds{conf_.client_read_timeout});
+
+        /// Stream db requests from client; handle_db_requests runs
+        /// whenever new bytes arrive. [state] carries a partial
+        /// command over from one read to the next.
+        std::shared_ptr<client_state> state = std::make_shared<client_state>(client);
+        client->start_reading(
+            std::bind(&coordinator::handle_db_requests, this, client, state, std::placeholders::_1));
     } catch(std::runtime_error &e) {
         /// Client disconnected.
         __CDB_LOG(error, "client disconnected");
     }
 }
 
+/// The string [obj] holds, as as<std::string>() takes it, but where
+/// it is rather than copied.
+static string_ref string_of(const clmdep_msgpack::object &obj)
+{
+    switch (obj.type)
+    {
+    case clmdep_msgpack::type::STR:
+        return { obj.via.str.ptr, obj.via.str.size };
+    case clmdep_msgpack::type::BIN:
+        return { obj.via.bin.ptr, obj.via.bin.size };
+    default:
+        throw clmdep_msgpack::type_error();
+    }
+}
+
+/// Copy the strings of [cmd] into [a], which keeps them while it runs.
+/// GET keys and SET values of several strings are joined, as they're
+/// sent to the participants, so that keys compare as such.
+static void copy_command(arena &a, command_ref &cmd)
+{
+    /// Strings from args[joined] on make a single one.
+    std::size_t joined = cmd.type == CMD_GET ? 0 : cmd.type == CMD_SET ? 1 : cmd.args.size();
+    std::size_t copied = cmd.args.size();
+    if (cmd.args.size() > joined + 1)
+    {
+        std::size_t size = cmd.args.size() - joined - 1;
+        for (std::size_t i = joined; i < cmd.args.size(); i++)
+            size += cmd.args[i].size;
+
+        char *data = static_cast<char*>(a.allocate(size, 1));
+        char *p = data;
+        for (std::size_t i = joined; i < cmd.args.size(); i++)
+        {
+            if (i != joined)
+                *p++ = ' ';
+            if (cmd.args[i].size)
+                std::memcpy(p, cmd.args[i].data, cmd.args[i].size);
+            p += cmd.args[i].size;
+        }
+
+        cmd.args.erase(cmd.args.begin() + joined + 1, cmd.args.end());
+        cmd.args[joined] = string_ref(data, size);
+        copied = joined;
+    }
+
+    for (std::size_t i = 0; i < copied; i++)
+        cmd.args[i] = string_ref(a.copy(cmd.args[i].data, cmd.args[i].size), cmd.args[i].size);
+}
+
+static bool is_write(const command_ref &cmd)
+{
+    return cmd.type == CMD_SET || cmd.type == CMD_DEL;
+}
+
+/// The keys of [cmd] are its first [key_count()] args.
+static std::size_t key_count(const command_ref &cmd)
+{
+    switch (cmd.type)
+    {
+    case CMD_DEL:
+        return cmd.args.size();
+    case CMD_GET:
+    case CMD_SET:
+        return cmd.args.empty() ? 0 : 1;
+    default:
+        return 0;
+    }
+}
+
+static bool share_key(const command_ref &a, const command_ref &b)
+{
+    for (std::size_t i = 0; i < key_count(a); i++)
+        for (std::size_t j = 0; j < key_count(b); j++)
+            if (a.args[i].size == b.args[j].size
+                && std::memcmp(a.args[i].data, b.args[j].data, a.args[i].size) == 0)
+                return true;
+    return false;
+}
+
 void coordinator::handle_db_requests(std::shared_ptr<tcp_client> client, 
-                                     std::shared_ptr<std::vector<char>> prev_data,
-                                     tcp_client::read_result &req)
+                                     std::shared_ptr<client_state> state,
+                                     tcp_client::buffered_read_result &input)
 {
-    if (!req.success)
+    if (!input.success)
     {
         /// Does not throw.
         client->disconnect(false);
         return;
     }
 
-    __CDB_LOG(debug, "handle_db_requests with " + std::to_string(req.data.size()) + std::string{" bytes"});
-    std::vector<char> data;
-    if (prev_data)
-        data = std::move(*prev_data);
-    data.insert(data.end(), req.data.begin(), req.data.end());
+    auto &buffer = input.buffer;
+    __CDB_LOG(debug, "handle_db_requests with " + std::to_string(buffer.size()) + std::string{" bytes"});
+
+    request_batch *batch;
+    std::size_t room;
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+
+        /// Already full: what arrived waits in the buffer until
+        /// flush_responses() releases reading.
+        if (state->in_flight >= conf_.pipeline_depth)
+        {
+            state->held = true;
+            client->hold_reading();
+            return;
+        }
+        room = conf_.pipeline_depth - state->in_flight;
+
+        if (state->free_batches.empty())
+        {
+            state->batches.emplace_back(new request_batch);
+            state->free_batches.push_back(state->batches.back().get());
+        }
+        batch = state->free_batches.back();
+        state->free_batches.pop_back();
+    }
 
-    std::vector<std::unique_ptr<command> > cmds;
-    bool parse_error = false;
-    bool is_incomplete = false;
+    /// Parse client commands in place, and copy them into [batch]: the
+    /// buffer is reused by the next read, while they may still run.
+    /// Those past [room] are left in the buffer.
+    request *first = nullptr;
+    request *last = nullptr;
+    std::size_t count = 0;
     std::size_t bytes_parsed = 0;
+    while (count < room)
+    {
+        request *req = new (batch->memory.allocate(sizeof(request), alignof(request))) request(*this, *state, *batch);
+        std::size_t cmd_size = 0;
+        auto status = state->parser.feed(buffer.data() + bytes_parsed, buffer.size() - bytes_parsed, req->cmd, cmd_size);
+        if (status == command_parser::status::COMMAND)
+        {
+            bytes_parsed += cmd_size;
+            copy_command(batch->memory, req->cmd);
+        }
+        else if (status == command_parser::status::SYNTAX_ERROR)
+        {
+            __CDB_LOG(warn, "parse error: " + std::string{state->parser.error()});
 
-    /// Try parsing a client command.
-    try
+            /// Nothing past it makes sense. It's answered with an error,
+            /// once those before it are.
+            client->stop_reading();
+            req->cmd.type = CMD_UNKNOWN;
+            req->cmd.args.clear();
+        }
+        else
+        {
+            req->~request();
+            break;
+        }
+
+        if (last != nullptr)
+            last->next = req;
+        else
+            first = req;
+        last = req;
+        count++;
+
+        if (status == command_parser::status::SYNTAX_ERROR)
+            break;
+    }
+
+    /// What's left is an incomplete command the next read completes,
+    /// which the parser resumes, or commands past [room].
+    buffer.consume(bytes_parsed);
+
+    std::lock_guard<std::mutex> lock(state->mutex);
+    if (count == 0)
     {
-        std::vector<char> data_copy{data};
-        parse_db_requests(data_copy, cmds, bytes_parsed);
+        batch->memory.reset();
+        state->free_batches.push_back(batch);
+        return;
     }
-    catch (_parse_incomplete_error &e)
+
+    batch->live = count;
+    if (state->tail != nullptr)
+        state->tail->next = first;
+    else
+        state->head = first;
+    state->tail = last;
+    state->in_flight += count;
+    state->waiting += count;
+    requests_in_flight_ += count;
+
+    /// Not waiting here, on a callback worker other clients share: the
+    /// client isn't read from until some of these are sent, which is
+    /// what keeps it from sending more. Those sent since [room] was
+    /// taken have made room already.
+    if (count == room)
     {
-        is_incomplete = true;
-        parse_error = true;
-        __CDB_LOG(warn, "parse error: " + std::string{e.what()});
+        client->hold_reading();
+        if (state->in_flight < conf_.pipeline_depth)
+            client->release_reading();
+        else
+            state->held = true;
     }
-    catch (std::runtime_error &e)
+
+    schedule_requests(*state);
+}
+
+void coordinator::schedule_requests(client_state &state)
+{
+    /// Requests not done yet, up to the one looked at.
+    auto &writes = state.pending_writes;
+    auto &reads = state.pending_reads;
+    writes.clear();
+    reads.clear();
+
+    for (request *req = state.head; req != nullptr && state.waiting != 0; req = req->next)
     {
-        parse_error = true;
-        __CDB_LOG(warn, "parse error: " + std::string{e.what()});
+        if (req->done)
+            continue;
+
+        bool write = is_write(req->cmd);
+        if (!req->started)
+        {
+            bool blocked = false;
+            if (write)
+                blocked = !writes.empty();
+            for (std::size_t i = 0; !blocked && i < writes.size(); i++)
+                blocked = share_key(writes[i]->cmd, req->cmd);
+            for (std::size_t i = 0; write && !blocked && i < reads.size(); i++)
+                blocked = share_key(reads[i]->cmd, req->cmd);
+
+            if (!blocked)
+            {
+                req->started = true;
+                req->keep_alive = state.shared_from_this();
+                state.waiting--;
+                request_pool_.add_task(req);
+            }
+        }
+
+        if (write)
+            writes.push_back(req);
+        else
+            reads.push_back(req);
     }
+}
 
-    /// Dispatch.
-    for (const auto &cmd : cmds)
+void coordinator::run_request(request &req)
+{
+    try
     {
-        switch (cmd->type)
+        switch (req.cmd.type)
         {
-        case CMD_GET: {
-            /// copy constructed
-            get_command get_cmd{ *static_cast<get_command*>(cmd.get()) };
-            handle_db_get_request(client, get_cmd);
+        case CMD_GET:
+            handle_db_get_request(req);
             break;
-        }
 
-        case CMD_SET: {
-            /// copy constructed
-            set_command set_cmd{ *static_cast<set_command*>(cmd.get()) };
-            handle_db_set_request(client, set_cmd);
+        case CMD_SET:
+            handle_db_set_request(req);
             break;
-        }
 
-        case CMD_DEL: {
-            /// copy constructed
-            del_command del_cmd{ *static_cast<del_command*>(cmd.get()) };
-            handle_db_del_request(client, del_cmd);
+        case CMD_DEL:
+            handle_db_del_request(req);
             break;
-        }
 
         default:
-            send_error(client);
+            send_error(req);
             break;
         }
     }
+    catch (std::exception &e)
+    {
+        /// Such as the record log failing. The client still gets a
+        /// response, and is disconnected.
+        __CDB_LOG(error, "request failed: " + std::string{e.what()});
+        if (!req.answered)
+            send_error(req);
+    }
 
-    if (parse_error)
+    finish_request(req);
+}
+
+void coordinator::finish_request(request &req)
+{
+    /// [req] may be gone once sent, and [state] with it.
+    std::shared_ptr<client_state> keep_alive = std::move(req.keep_alive);
+    client_state &state = req.state;
+
+    std::lock_guard<std::mutex> lock(state.mutex);
+    req.done = true;
+    schedule_requests(state);
+    flush_responses(state);
+}
+
+void coordinator::flush_responses(client_state &state)
+{
+    /// Responses after an error aren't sent: the client is disconnected.
+    std::size_t size = 0;
+    bool closed = state.closed;
+    for (request *req = state.head; req != nullptr && req->done && !closed; req = req->next)
     {
-        /// If this is an parse_incomplete_error, handle_command_error
-        /// will re-call handle_db_requests with the previous left bytes.
-        handle_command_error(client, 
-                             /* Left bytes. */
-                             std::shared_ptr<std::vector<char>>{ new std::vector<char>{data.begin() + bytes_parsed, data.end()} },
-                             is_incomplete);
+        size += req->response.size;
+        closed = req->disconnect;
+    }
+
+    /// Write requests own their data: that's the one allocation a
+    /// flush takes.
+    std::vector<char> data;
+    data.reserve(size);
+    bool disconnect = false;
+    std::size_t sent = 0;
+    while (state.head != nullptr && state.head->done)
+    {
+        request *req = state.head;
+        if (!state.closed)
+        {
+            data.insert(data.end(), req->response.data, req->response.data + req->response.size);
+            state.closed = disconnect = req->disconnect;
+        }
+
+        state.head = req->next;
+        if (state.head == nullptr)
+            state.tail = nullptr;
+
+        request_batch &batch = req->batch;
+        req->~request();
+        if (--batch.live == 0)
+        {
+            batch.memory.reset();
+            state.free_batches.push_back(&batch);
+        }
+        sent++;
+    }
+
+    if (sent == 0)
         return;
+    state.in_flight -= sent;
+    if (state.held && state.in_flight < conf_.pipeline_depth)
+    {
+        /// Picks up what handle_db_requests() left in the buffer.
+        state.held = false;
+        state.client->release_reading();
     }
 
-    /// Recurse on itself.
-    try
+    if (!data.empty())
     {
-        client->async_read({
-            1024,
-            std::bind(&coordinator::handle_db_requests, this, client, nullptr, std::placeholders::_1)
-        });
-    } 
-    catch (std::runtime_error &e)
+        auto client = state.client;
+        tcp_client::write_callback_t cb;
+        if (disconnect)
+            cb = [=](tcp_client::write_result &) { client->disconnect(false); };
+
+        try {
+            client->async_write({ std::move(data), std::move(cb) });
+        } catch(std::runtime_error &e) {
+            /// Its other requests are still run, but not answered.
+            __CDB_LOG(error, "client disconnected");
+            state.closed = true;
+            client->disconnect(false);
+        }
+    }
+
+    if (requests_in_flight_.fetch_sub(sent) == sent)
     {
-        __CDB_LOG(error, "client disconnected");
+        std::lock_guard<std::mutex> lock(requests_mutex_);
+        requests_cond_.notify_all();
     }
 }
 
-void coordinator::handle_db_get_request(std::shared_ptr<tcp_client> client, 
-                                        get_command cmd)
+void coordinator::wait_for_requests()
 {
-    bool participant_dead = false;
+    std::unique_lock<std::mutex> lock(requests_mutex_);
+    requests_cond_.wait(lock, [this] { return requests_in_flight_ == 0; });
+}
 
+void coordinator::update_readers()
+{
+    std::shared_ptr<const reader_list> old;
     {
-        /// Acquire lock.
-        std::unique_lock<std::mutex> lock(participants_mutex_);
+        std::lock_guard<std::mutex> lock(readers_mutex_);
+        old = readers_;
+    }
+
+    /// Those of participants gone are dropped. Connecting to the new
+    /// ones is left to connect_readers(), without the lock.
+    auto readers = std::make_shared<reader_list>();
+    for (std::size_t i = 0; old && i < old->size(); i++)
+        if (participants_.count((*old)[i].first))
+            readers->push_back((*old)[i]);
+
+    std::lock_guard<std::mutex> lock(readers_mutex_);
+    readers_ = std::move(readers);
+}
 
-        if (participants_.empty())
+void coordinator::connect_readers()
+{
+    std::vector<std::string> missing;
+    {
+        std::lock_guard<std::mutex> lock(participants_mutex_);
+        std::lock_guard<std::mutex> readers_lock(readers_mutex_);
+        for (auto &p : participants_)
         {
-            /// The system cannot function.
-            send_error(client);
-            return;
+            bool found = false;
+            for (std::size_t i = 0; readers_ && i < readers_->size() && !found; i++)
+                found = (*readers_)[i].first == p.first;
+            if (!found)
+                missing.push_back(p.first);
         }
+    }
+    if (missing.empty())
+        return;
 
-        /// GET will be served directly.
-        while (!participants_.empty())
+    reader_list connected;
+    for (auto &addr : missing)
+    {
+        try
         {
-            try {
-                auto &p = participants_.begin()->second;
-                p->set_timeout(RPC_TIMEOUT);
-
-                auto value = p->call("GET", cmd).as<std::string>();
-                send_result(client, value, nullptr);
-                goto PARTICIPANT_CHECK;
-            } catch (std::exception &) {
-                // Remove this client.
-                participants_.erase(participants_.begin());
+            auto colon = addr.rfind(':');
+            connected.emplace_back(addr, std::make_shared<reader>(addr.substr(0, colon),
+                                                                  static_cast<uint16_t>(std::stoul(addr.substr(colon + 1))),
+                                                                  conf_.request_workers));
+        }
+        catch (std::exception &e)
+        {
+            /// GETs go to the others. Tried again on the next heartbeat.
+            __CDB_LOG(warn, "cannot connect a reader to " + addr + ": " + std::string{e.what()});
+        }
+    }
+
+    /// Those removed meanwhile are left out.
+    std::lock_guard<std::mutex> lock(participants_mutex_);
+    std::lock_guard<std::mutex> readers_lock(readers_mutex_);
+    auto readers = std::make_shared<reader_list>();
+    if (readers_)
+        *readers = *readers_;
+    for (auto &r : connected)
+        if (participants_.count(r.first))
+            readers->push_back(std::move(r));
+    readers_ = std::move(readers);
+}
+
+void coordinator::handle_db_get_request(request &req)
+{
+    std::shared_ptr<const reader_list> readers;
+    {
+        std::lock_guard<std::mutex> lock(readers_mutex_);
+        readers = readers_;
+    }
+
+    /// Every participant has what was committed: GETs are spread over
+    /// them. One that fails is removed, and the next one tried.
+    /// COMMITs are applied on all of them at once, or a GET could find
+    /// a value on one participant, then the one before on another.
+    bool participant_dead = false;
+    std::size_t first = next_reader_.fetch_add(1);
+    for (std::size_t i = 0; readers && i < readers->size() && !req.answered; i++)
+    {
+        auto &r = (*readers)[(first + i) % readers->size()];
+        try {
+            clmdep_msgpack::object_handle value;
+            {
+                shared_lock commit_lock(commit_mutex_);
+                /// A connection takes a GET at a time, see reader.
+                auto &conn = *r.second->connections[r.second->next.fetch_add(1) % r.second->connections.size()];
+                std::lock_guard<std::mutex> lock(conn.mutex);
+                value = conn.client.call("GET", std::cref(req.cmd));
+            }
+            send_result(req, string_of(value.get()));
+        } catch (std::exception &) {
+            std::lock_guard<std::mutex> lock(participants_mutex_);
+            if (participants_.erase(r.first))
+            {
+                update_readers();
                 participant_dead = true;
                 __CDB_LOG(warn, "handle_db_get_request remove participant");
             }
@@ -414,175 +901,194 @@ void coordinator::handle_db_get_request(std::shared_ptr<tcp_client> client,
     }
 
     /// If we've exhausted all dbs. The system is down.
-    send_error(client);
+    if (!req.answered)
+        send_error(req);
 
-PARTICIPANT_CHECK:
     if (participant_dead)
         participants_cond_.notify_all();
 }
 
-void coordinator::handle_db_set_request(std::shared_ptr<tcp_client> client, 
-                                        set_command cmd)
+/// NOTE: lock is acquired before entering this function.
+template <typename Handler, typename... Args>
+void coordinator::call_participants(bool &participant_dead, const std::string &func, Handler handler, Args... args)
+{
+    /// Each participant client is only used with the lock held: calls
+    /// are made from a single thread at a time, as rpclib needs.
+    std::vector<std::future<clmdep_msgpack::object_handle>> calls;
+    calls.reserve(participants_.size());
+    for (auto &p : participants_)
+    {
+        try
+        {
+            /// The timeout bounds connecting.
+            p.second->set_timeout(RPC_TIMEOUT);
+            calls.push_back(p.second->async_call(func, args...));
+        }
+        catch (std::exception &e)
+        {
+            /// Left invalid: it fails below.
+            calls.emplace_back();
+        }
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(RPC_TIMEOUT);
+    std::size_t i = 0;
+    for (auto iter = participants_.begin(); iter != participants_.end(); i++)
+    {
+        try
+        {
+            if (!calls[i].valid() || calls[i].wait_until(deadline) == std::future_status::timeout)
+                throw std::runtime_error("timeout");
+
+            auto result = calls[i].get();
+            handler(result);
+        }
+        catch (std::exception &e)
+        {
+            /// Unreachable db.
+            iter = participants_.erase(iter);
+            participant_dead = true;
+            __CDB_LOG(warn, func + " failed, remove participant");
+            continue;
+        }
+        iter++;
+    }
+}
+
+void coordinator::handle_db_set_request(request &req)
 {
+    command_ref &cmd = req.cmd;
+
     /// Acquire lock.
     std::unique_lock<std::mutex> lock(participants_mutex_);
     if (participants_.empty())
     {
         __CDB_LOG(warn, "participant empty");
         /// The system cannot function.
-        send_error(client);
+        send_error(req);
         return;
     }
 
     /// NOTE: If current participants_ is empty, do not increment next_id_.
-    cmd.set_id(next_id_.fetch_add(1));
+    cmd.id = next_id_.fetch_add(1);
 
     /// Persist the request info.
-    r_manager_.log({ RECORD_UNRESOLVED, cmd.id(), next_id_ });
+    r_manager_.log({ RECORD_UNRESOLVED, cmd.id, next_id_ });
 
     /// PREPARE
     bool prepare_ok = true;
     bool participant_dead = false;
-    __CDB_LOG(info, "participants_.size() == " + std::to_string(participants_.size()));
-    for (auto iter = participants_.begin(); iter != participants_.end(); )
-    {
-        try
-        {
-            __CDB_LOG(info, "prepare_set " + std::to_string(cmd.id()));
-            iter->second->set_timeout(RPC_TIMEOUT);
-            prepare_ok = iter->second->call("PREPARE_SET", cmd).as<bool>();
-            if (!prepare_ok)
-                break;
-            __CDB_LOG(info, "prepare_set ok");
-        } 
-        catch (std::exception &e)
-        {
-            /// Unreachable db
-            iter = participants_.erase(iter);
-            participant_dead = true;
-            __CDB_LOG(warn, "handle_db_set_request remove participant");
-            continue;
-        }
-        iter++;
-    }
+    __CDB_LOG(debug, "participants_.size() == " + std::to_string(participants_.size()));
+    __CDB_LOG(debug, "prepare_set " + std::to_string(cmd.id));
+
+    /// By reference: the payload is the only copy made of the key and
+    /// the value.
+    call_participants(participant_dead, "PREPARE_SET", [&](clmdep_msgpack::object_handle &result) {
+        if (!result.get().as<bool>())
+            prepare_ok = false;
+    }, std::cref(cmd));
 
     if (participants_.empty())
     {
         /// Since all participant is dead, no abort rpc is needed to make.
-        send_error(client);
+        update_readers();
+        send_error(req);
         return;
     }
 
     /// COMMIT
     std::string ret;
     if (prepare_ok)
-        commit_db_request(client, cmd.id(), participant_dead);
+        commit_db_request(&req, cmd.id, participant_dead);
 
     /// ABORT
     else
-        abort_db_request(client, cmd.id(), participant_dead);
+        abort_db_request(&req, cmd.id, participant_dead);
 
     if (participant_dead)
+    {
+        update_readers();
         participants_cond_.notify_all();
+    }
 }
 
-void coordinator::handle_db_del_request(std::shared_ptr<tcp_client> client, 
-                                        del_command cmd)
+void coordinator::handle_db_del_request(request &req)
 {
+    command_ref &cmd = req.cmd;
+
     /// Acquire lock.
     std::unique_lock<std::mutex> lock(participants_mutex_);
     if (participants_.empty())
     {
         __CDB_LOG(warn, "participant empty");
         /// The system cannot function.
-        send_error(client);
+        send_error(req);
         return;
     }
 
-    cmd.set_id(next_id_.fetch_add(1));
-    r_manager_.log({ RECORD_UNRESOLVED, cmd.id(), next_id_ });
+    cmd.id = next_id_.fetch_add(1);
+    r_manager_.log({ RECORD_UNRESOLVED, cmd.id, next_id_ });
 
     /// PREPARE
     bool prepare_ok = true;
     bool participant_dead = false;
-    for (auto iter = participants_.begin(); iter != participants_.end(); )
-    {
-        try
-        {
-            iter->second->set_timeout(RPC_TIMEOUT);
-            prepare_ok = iter->second->call("PREPARE_DEL", cmd).as<bool>();
-            if (!prepare_ok)
-                break;
-        } 
-        catch (std::exception &e)
-        {
-            /// Unreachable db
-            iter = participants_.erase(iter);
-            participant_dead = true;
-            __CDB_LOG(warn, "handle_db_del_request removed participant");
-            continue;
-        }
-        iter++;
-    }
+    call_participants(participant_dead, "PREPARE_DEL", [&](clmdep_msgpack::object_handle &result) {
+        if (!result.get().as<bool>())
+            prepare_ok = false;
+    }, std::cref(cmd));
 
     if (participants_.empty())
     {
-        send_error(client);
+        update_readers();
+        send_error(req);
         return;
     }
 
     /// COMMIT
     if (prepare_ok)
     {
-        commit_db_request(client, cmd.id(), participant_dead);
+        commit_db_request(&req, cmd.id, participant_dead);
         
         /// Record DEL cmd that'll be used to recover dead participants.
         if (participants_.size() < conf_.participant_addrs.size())
         {
-            auto keys = cmd.args();
-            del_keys_.insert(keys.begin(), keys.end());
+            for (auto &key : cmd.args)
+                del_keys_.insert(key.str());
         }
     }
     /// ABORT
     else
-        abort_db_request(client, cmd.id(), participant_dead);
+        abort_db_request(&req, cmd.id, participant_dead);
     
     if (participant_dead)
+    {
+        update_readers();
         participants_cond_.notify_all();
+    }
 }
 
 /// NOTE: lock is acquired before entering this function.
-void coordinator::commit_db_request(std::shared_ptr<tcp_client> client, 
+void coordinator::commit_db_request(request *req, 
                                     std::uint32_t id, 
                                     bool &participant_dead) {
-    std::string ret;
+    /// Response of the first participant, which the client gets.
+    clmdep_msgpack::object_handle ret;
 
     /// Log first.
     r_manager_.log({ RECORD_COMMIT, id, next_id_ });
 
     /// Lock has required by caller.
-    for (auto iter = participants_.begin(); iter != participants_.end(); )
+    __CDB_LOG(debug, "before commit");
     {
-        try
-        {
-            __CDB_LOG(info, "before commit");
-            iter->second->set_timeout(RPC_TIMEOUT);
-            if (ret.empty())
-                ret = iter->second->call("COMMIT", id).as<std::string>();
-            else
-                iter->second->call("COMMIT", id).as<std::string>();
-
-            __CDB_LOG(info, "commit result: " + ret);
-        }
-        catch (std::exception &e)
-        {
-            /// Unreachable db.
-            iter = participants_.erase(iter);
-            participant_dead = true;
-            __CDB_LOG(warn, "commit_db_request remove participants");
-            continue;
-        }
-        iter++;
+        /// No GET runs meanwhile, see handle_db_get_request().
+        std::lock_guard<shared_mutex> commit_lock(commit_mutex_);
+        call_participants(participant_dead, "COMMIT", [&](clmdep_msgpack::object_handle &result) {
+            string_ref value = string_of(result.get());
+            __CDB_LOG(debug, "commit result: " + value.str());
+
+            if (ret.get().is_nil())
+                ret = std::move(result);
+        }, id);
     }
 
     /// Log done info only if at least one participant has it committed.
@@ -591,38 +1097,24 @@ void coordinator::commit_db_request(std::shared_ptr<tcp_client> client,
         r_manager_.log({ RECORD_COMMIT_DONE, id, next_id_ });
     }
     
-    /// Client is nullptr when it is called from recovery().
-    if (client != nullptr)
-        send_result(client, ret, nullptr);
+    /// [req] is nullptr when it is called from recovery().
+    if (req != nullptr)
+        send_result(*req, ret.get().is_nil() ? string_ref() : string_of(ret.get()));
 }
 
 /// NOTE: lock is acquired before entering this function.
-void coordinator::abort_db_request(std::shared_ptr<tcp_client> client, 
+void coordinator::abort_db_request(request *req, 
                                    std::uint32_t id, 
                                    bool &participant_dead) 
 {
     r_manager_.log({ RECORD_ABORT, id, next_id_ });
 
     /// Lock has required by caller.
-    for (auto iter = participants_.begin(); iter != participants_.end(); )
-    {
-        try
-        {
-            iter->second->set_timeout(RPC_TIMEOUT);
-            /// If abort rpc returns false, basically it's malfunctioning.
-            if (!iter->second->call("ABORT", id).as<bool>())
-                throw std::exception();
-        }
-        catch (std::exception &e)
-        {
-            /// Unreachable db.
-            iter = participants_.erase(iter);
-            participant_dead = true;
-            __CDB_LOG(warn, "abort_db_request removed participant");
-            continue;
-        }
-        iter++;
-    }
+    call_participants(participant_dead, "ABORT", [](clmdep_msgpack::object_handle &result) {
+        /// If abort rpc returns false, basically it's malfunctioning.
+        if (!result.get().as<bool>())
+            throw std::exception();
+    }, id);
 
     /// Log this info only if at least one participant has this message.
     if (!participants_.empty())
@@ -630,71 +1122,28 @@ void coordinator::abort_db_request(std::shared_ptr<tcp_client> client,
         r_manager_.log({ RECORD_ABORT_DONE, id, next_id_ });
     }
 
-    /// client might be null when it comes from recovery.
-    if (client != nullptr)
-        send_error(client);
+    /// [req] might be null when it comes from recovery.
+    if (req != nullptr)
+        send_error(*req);
 }
 
-void
-coordinator::parse_db_requests(std::vector<char> &data, 
-                               std::vector<std::unique_ptr<command> > &ret, 
-                               std::size_t &bytes_parsed)
-{
-    command_parser parser{std::move(data)};
-
-    while (!parser.is_done())
-    {
-        auto cmd = parser.read_command();
-        bytes_parsed = parser.bytes_parsed();
-        ret.push_back(std::move(cmd));
-    }
-}
-
-void coordinator::handle_command_error(std::shared_ptr<tcp_client> client,
-                                       std::shared_ptr<std::vector<char>> data,
-                                       bool is_incomplete)
-{
-    if (!is_incomplete)
-    {
-        send_error(client);
-        return;
-    }
-    __CDB_LOG(info, "handle incomplete error");
-
-    /// Error caused by an incomplete command.
-    try
-    {
-        /// Try again.
-        client->async_read({
-            1024,
-            std::bind(&coordinator::handle_db_requests, this, client, data, std::placeholders::_1)
-        });
-    } 
-    catch(std::runtime_error &e)
-    {
-        __CDB_LOG(error, "client disconnected");
-    }
-}
-
-void coordinator::send_error(std::shared_ptr<tcp_client> client)
+void coordinator::send_error(request &req)
 {
     __CDB_LOG(info, "send_error");
-    send_result(client, participant::error_string, [=](tcp_client::write_result &) {
-        client->disconnect(false);
-    });
+
+    /// Static, unlike results: no need for a copy.
+    req.response = string_ref(participant::error_string.data(), participant::error_string.size());
+    req.disconnect = true;
+    req.answered = true;
 }
 
-void coordinator::send_result(std::shared_ptr<tcp_client> client, std::string const &msg, tcp_client::write_callback_t cb)
+void coordinator::send_result(request &req, string_ref ret)
 {
-    try {
-        client->async_write({
-            std::vector<char>{msg.begin(), msg.end()},
-            cb
-        });
-    } catch(std::runtime_error &e) {
-        __CDB_LOG(error, "client disconnected");
-        client->disconnect(false);
-    }
+    /// [ret] may be part of an RPC response, gone by the time it's sent.
+    /// Other requests of the batch may be copying theirs meanwhile.
+    std::lock_guard<std::mutex> lock(req.state.mutex);
+    req.response = string_ref(req.batch.memory.copy(ret.data, ret.size), ret.size);
+    req.answered = true;
 }
 
 } // namespace cdb
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "command_parser.hpp"
+#include "resp_scan.hpp"
+
+using cdb::command_parser;
+using cdb::command_ref;
+
+/// Parse throughput of command_parser, in MB/s, over corpora of
+/// pipelined commands: GETs, SETs of small values, DELs of a few keys
+/// and SETs of large values. Each corpus is parsed as a whole, as when a
+/// read brings a batch of requests in, then as if it arrived [chunk]
+/// bytes at a time, the parser resuming incomplete commands. Each
+/// scanning kernel the CPU supports is run in turn.
+///
+/// Usage: parser_bench [megabytes] [chunk]
+
+/// Keeps the parsed commands from being optimized away.
+static std::size_t checksum = 0;
+
+static std::string corpus(const std::string &command, std::size_t megabytes)
+{
+    std::string data;
+    data.reserve(megabytes << 20);
+    while (data.size() < (megabytes << 20))
+        data += command;
+    return data;
+}
+
+/// Parse [data] as bytes arrive [chunk] at a time, consuming commands
+/// as the coordinator does. Return the number of commands.
+static std::size_t parse(const std::string &data, std::size_t chunk)
+{
+    command_parser parser;
+    command_ref cmd;
+    std::size_t commands = 0;
+    std::size_t consumed = 0;
+    std::size_t arrived = 0;
+
+    while (arrived < data.size())
+    {
+        arrived = std::min(arrived + chunk, data.size());
+        for (;;)
+        {
+            std::size_t cmd_size = 0;
+            auto status = parser.feed(data.data() + consumed, arrived - consumed, cmd, cmd_size);
+            if (status == command_parser::status::NEED_MORE)
+                break;
+            if (status == command_parser::status::SYNTAX_ERROR)
+            {
+                std::fprintf(stderr, "syntax error: %s\n", parser.error());
+                std::exit(2);
+            }
+
+            consumed += cmd_size;
+            checksum += cmd.args.back().size;
+            commands++;
+        }
+    }
+
+    return commands;
+}
+
+static void run(const char *name, const std::string &data, std::size_t chunk)
+{
+    // Warm up.
+    parse(data, chunk);
+
+    const int rounds = 5;
+    std::size_t commands = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++)
+        commands = parse(data, chunk);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+    double seconds = elapsed.count() / rounds;
+    std::printf("%-12s chunk %-9zu %10.1f MB/s  %12.0f commands/s\n",
+                name, chunk, data.size() / seconds / (1 << 20), commands / seconds);
+}
+
+int main(int argc, char **argv)
+{
+    std::size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+    std::size_t chunk = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1024;
+    if (megabytes == 0 || chunk == 0)
+    {
+        std::fprintf(stderr, "usage: parser_bench [megabytes] [chunk]\n");
+        return 2;
+    }
+
+    struct {
+        const char *name;
+        std::string data;
+    } corpora[] = {
+        { "get", corpus(command_parser::encode_get("key:000000000000"), megabytes) },
+        { "set 16B", corpus(command_parser::encode_set("key:000000000000", std::string(16, 'v')), megabytes) },
+        { "set 64KiB", corpus(command_parser::encode_set("key:000000000000", std::string(64 << 10, 'v')), megabytes) },
+        { "del 8 keys", corpus(command_parser::encode_del(std::vector<std::string>(8, "key:000000000000")), megabytes) },
+        { "set 4MiB", corpus(command_parser::encode_set("key:000000000000", std::string(4 << 20, 'v')), megabytes) },
+    };
+
+    for (auto kernel : { cdb::scan_kernel::SCALAR, cdb::scan_kernel::SSE2, cdb::scan_kernel::AVX2 })
+    {
+        if (!cdb::set_scan_kernel(kernel))
+            continue;
+
+        std::printf("%s\n", cdb::scan_kernel_name(kernel));
+        for (auto &c : corpora)
+            run(c.name, c.data, c.data.size());
+        for (auto &c : corpora)
+            run(c.name, c.data, chunk);
+    }
+
+    return checksum == 0;
+}
@@ -1,7 +1,6 @@
 #include <iostream>
 #include <sstream>
 #include <chrono>
-#include <unordered_map>
 #include "command_parser.hpp"
 #include "errors.hpp"
 #include "logger.hpp"
@@ -20,7 +19,7 @@ struct participant::get_handler_t {
     /// Simply return the results.
     std::string operator()(get_command get_cmd)
     {
-        std::string key = get_cmd.key();
+        const std::string &key = get_cmd.key;
         std::string value;
         leveldb::Status status = p_.db_->Get(leveldb::ReadOptions(), key, &value);
 
@@ -67,16 +66,15 @@ struct participant::prepare_set_t {
     {
         try {
             std::lock_guard<std::mutex> lock(p_.db_request_mutex_);
-            __CDB_LOG(info, "PREPARE SET " + std::to_string(set_cmd.id()));
+            __CDB_LOG(info, "PREPARE SET " + std::to_string(set_cmd.id));
 
             /// Log record and cache it.
             /// NOTE: always log the command itself first. This can ensure that if we have a
             /// record, we can find the corresponding command. Not vice versa.
-            p_.r_manager_.log(&set_cmd);
-
-            std::unique_ptr<command> cmd{ new set_command{std::move(set_cmd)} };
-            p_.r_manager_.log({ RECORD_PREPARED, cmd->id(), p_.next_id_.fetch_add(0) });
-            p_.db_requests_.insert(std::move(cmd));
+            command cmd{ std::move(set_cmd) };
+            p_.r_manager_.log(cmd);
+            p_.r_manager_.log({ RECORD_PREPARED, cmd.id(), p_.next_id_.fetch_add(0) });
+            p_.db_requests_.emplace(cmd.id(), std::move(cmd));
             return true;
         } catch (std::exception &e) {
             __CDB_LOG(error, std::string{e.what()});
@@ -98,15 +96,15 @@ struct participant::prepare_del_t {
     {
         try {
             std::lock_guard<std::mutex> lock(p_.db_request_mutex_);
-            __CDB_LOG(info, "PREPARE DEL " + std::to_string(del_cmd.id()));
+            __CDB_LOG(info, "PREPARE DEL " + std::to_string(del_cmd.id));
 
             /// Log record and cache it.
             /// NOTE: always log the command itself first. This can ensure that if we have a
             /// record, we can find the corresponding command. Not vice versa.
-            p_.r_manager_.log(&del_cmd);
-            std::unique_ptr<command> cmd{ new del_command(std::move(del_cmd)) };
-            p_.r_manager_.log({ RECORD_PREPARED, cmd->id(), p_.next_id_.fetch_add(0) });
-            p_.db_requests_.insert(std::move(cmd));
+            command cmd{ std::move(del_cmd) };
+            p_.r_manager_.log(cmd);
+            p_.r_manager_.log({ RECORD_PREPARED, cmd.id(), p_.next_id_.fetch_add(0) });
+            p_.db_requests_.emplace(cmd.id(), std::move(cmd));
 
             return true;
         } catch (std::exception &e) {
@@ -121,12 +119,7 @@ struct participant::prepare_del_t {
 /// Commit update request.
 struct participant::commit_handler_t {
     commit_handler_t(participant &p)
-        : p_(p)
-    {
-        /// Bind to handlers.
-        dispatchers[CMD_SET] = std::bind(&commit_handler_t::handle_set, this, std::placeholders::_1);
-        dispatchers[CMD_DEL] = std::bind(&commit_handler_t::handle_del, this, std::placeholders::_1);
-    }
+        : p_(p) {}
 
     /// Commits a request with [id] as req_id.
     std::string operator()(std::uint32_t id)
@@ -146,22 +139,17 @@ struct participant::commit_handler_t {
 
         // Handle normal cases.
         auto iter = p_.db_requests_.begin();
-        if (iter->get()->id() != p_.next_id_)
+        if (iter == p_.db_requests_.end() || iter->first != p_.next_id_)
             /// If this happens, then there's a bug in coordinator class.
             __SERVER_THROW("the coordinator has sent multiple PREPARE!");
 
-        // Dispatching.
-        auto handler = dispatchers[iter->get()->type];
-        if (!handler)
-            __SERVER_THROW("unrecognizable command");
-
         /// Log the COMMIT record.
         /// This is means the participant can recover itself after it dies before
         /// actually applying the command to the DB. As a result, this can prevent a
         /// RECOVERY RPC from the coordinator if this participant is up-to-date.
         p_.r_manager_.log({ RECORD_COMMIT, id, p_.next_id_.fetch_add(1) });
         /// Apply the command.
-        std::string ret = handler(iter->get());
+        std::string ret = iter->second.visit(apply_t{ p_ });
         /// Log the COMMIT_DONE record.
         p_.r_manager_.log({ RECORD_COMMIT_DONE, id, p_.next_id_.fetch_add(0) });
 
@@ -171,61 +159,56 @@ struct participant::commit_handler_t {
         return ret;
     }
 
-    /// Handle SET key value command.
-    std::string handle_set(command *cmd)
-    {
-        /// Lock is already acquired.
-
-        // Internal server error.
-        if (!cmd)
-            __SERVER_THROW("cmd is nullptr");
+    /// Applies the command committed.
+    struct apply_t {
+        /// Handle SET key value command.
+        std::string operator()(const set_command &cmd) const
+        {
+            /// Lock is already acquired.
+
+            /// Deliver to leveldb.
+            auto status = p_.db_->Put(leveldb::WriteOptions(), cmd.key, cmd.value);
+            if (status.ok())
+                return participant::update_ok_string;
+            else
+                return participant::error_string;
+        }
 
-        std::vector<std::string> args = cmd->args();
-        std::string &key = args[0];
-        std::string &value = args[1];
+        /// Handle DEL key1 key2 key3 key4 ... cmd.
+        std::string operator()(const del_command &cmd) const
+        {
+            /// Lock is already acquired.
 
-        /// Deliver to leveldb.
-        auto status = p_.db_->Put(leveldb::WriteOptions(), key, value);
-        if (status.ok())
-            return participant::update_ok_string;
-        else
-            return participant::error_string;
-    }
+            std::size_t count = 0;
+            for (const std::string &key : cmd.keys)
+            {
+                leveldb::Status status;
+                std::string value;
+                bool exists = false;
+                status = p_.db_->Get(leveldb::ReadOptions(), key, &value);
+                exists = status.ok();
+
+                status = p_.db_->Delete(leveldb::WriteOptions(), key);
+                if (status.ok() && exists)    count++;
+            }
 
-    /// Handle DEL key1 key2 key3 key4 ... cmd.
-    std::string handle_del(command *cmd)
-    {
-        /// Lock is already acquired.
+            if (count == 0)
+                return participant::error_string;
 
-        if (!cmd)
-            __SERVER_THROW("cmd is nullptr");
+            // RESP integer, representing the number of elems deleted.
+            std::string ret = ":" + std::to_string(count) + "\r\n";
+            return ret;
+        }
 
-        std::size_t count = 0;
-        std::vector<std::string> keys = cmd->args();
-        for (std::string &key : keys)
+        /// GETs aren't prepared.
+        std::string operator()(const get_command &) const
         {
-            leveldb::Status status;
-            std::string value;
-            bool exists = false;
-            status = p_.db_->Get(leveldb::ReadOptions(), key, &value);
-            exists = status.ok();
-
-            status = p_.db_->Delete(leveldb::WriteOptions(), key);
-            if (status.ok() && exists)    count++;
+            __SERVER_THROW("unrecognizable command");
         }
 
-        if (count == 0)
-            return participant::error_string;
-
-        // RESP integer, representing the number of elems deleted.
-        std::string ret = ":" + std::to_string(count) + "\r\n";
-        return ret;
-    }
+        participant &p_;
+    };
 
-    /// Dispatcher
-    std::unordered_map<
-        uint8_t/* command_type */, 
-        std::function<std::string(command*)>/* handler */> dispatchers;
     participant &p_;
 };
 
@@ -490,7 +473,8 @@ void participant::async_start()
 void participant::recovery()
 {
     auto &cmds = r_manager_.cmds();
-    auto &records = r_manager_.records();
+    /// A copy: committing updates the records.
+    auto records = r_manager_.records();
 
     std::unique_lock<std::mutex> lock(db_request_mutex_);
     for (auto &p : records)
@@ -498,17 +482,28 @@ void participant::recovery()
         switch (p.second.status)
         {
         case RECORD_COMMIT: {
-            db_requests_.insert(std::move(cmds[p.second.id]));
+            auto cmd = cmds.find(p.second.id);
+            if (cmd == cmds.end())
+                __SERVER_THROW("participant recovery failed");
+            db_requests_.emplace(p.second.id, std::move(cmd->second));
             next_id_ = p.second.id;
             /// NOTE: duplicate records is idempotent.
+            /// The handler takes the lock itself.
+            lock.unlock();
             (*commit_handler_)(next_id_);
+            lock.lock();
             break;
         }
         case RECORD_PREPARED: {
             /// NOTE: this can only happen either:
             ///     1. The participant died right before receiving COMMIT/ABORT
             ///     2. The coordinator died right before sending COMMIT/ABORT or resolving the request.
-            db_requests_.insert(std::move(cmds[p.second.id]));
+            /// Without the command, only an ABORT can resolve it.
+            auto cmd = cmds.find(p.second.id);
+            if (cmd != cmds.end())
+                db_requests_.emplace(p.second.id, std::move(cmd->second));
+            else
+                __CDB_LOG(warn, "no command logged for " + std::to_string(p.second.id));
             next_id_ = p.second.id;
             /// Wait for coordinator.
             break;
@@ -523,7 +518,7 @@ void participant::recovery()
         next_id_ = r_manager_.next_id();
 
     cmds.clear();
-    records.clear();
+    r_manager_.records().clear();
 }
 
 }    // namespace cdb
\ No newline at end of file
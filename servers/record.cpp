@@ -1,4 +1,5 @@
 #include <iostream>
+#include <unistd.h>
 #include "errors.hpp"
 #include "logger.hpp"
 #include "record.hpp"
@@ -7,14 +8,19 @@ namespace cdb {
 /*
 record.
 */
-std::vector<unsigned char> record::to_binary() const
+std::array<unsigned char, record::record_size> record::to_binary() const
 {
-    std::vector<unsigned char> binary;
+    std::array<unsigned char, record_size> binary;
 
     /// NOTE: we're using a really ad-hoc format.
-    encode_uint8_t(binary, status);
-    encode_uint32_t(binary, id);
-    encode_uint32_t(binary, next_id);
+    /// Same as encode_uint8_t() then encode_uint32_t() twice, without
+    /// going through a vector.
+    binary[0] = status;
+    for (std::size_t i = 0; i < 4; i++)
+    {
+        binary[1 + i] = (id >> (8 * i)) & 0xFF;
+        binary[5 + i] = (next_id >> (8 * i)) & 0xFF;
+    }
     return binary;
 }
 
@@ -74,14 +80,26 @@ std::uint32_t record::decode_uint32_t(const std::vector<unsigned char> &binary,
     return ret;
 }
 
+/// [size] bytes of [binary] from [idx] on.
+static std::string decode_string(const std::vector<unsigned char> &binary, std::size_t &idx, std::size_t size)
+{
+    if (idx + size > binary.size())
+        __RECORD_THROW("not enough bytes");
+
+    std::string ret{ binary.begin() + idx, binary.begin() + idx + size };
+    idx += size;
+    return ret;
+}
+
 /*
 record_manager
 */
 
 record_manager::record_manager(std::string const &file_name)
     : file_name_(file_name)
+    , cmd_file_name_("cmd_" + file_name)
     , file_(file_name, std::fstream::app | std::fstream::binary | std::fstream::in | std::fstream::out)
-    , cmd_file_("cmd_" + file_name, std::fstream::app | std::fstream::binary | std::fstream::in | std::fstream::out)
+    , cmd_file_(cmd_file_name_, std::fstream::app | std::fstream::binary | std::fstream::in | std::fstream::out)
 {
     if (!file_.is_open())
         __RECORD_THROW("cannot open log '" + file_name + "'");
@@ -95,6 +113,28 @@ record_manager::record_manager(std::string const &file_name)
     init_records();
 }
 
+void record_manager::reload()
+{
+    file_.close();
+    cmd_file_.close();
+    records_.clear();
+    cmds_.clear();
+    next_id_ = 0;
+
+    file_.open(file_name_, std::fstream::app | std::fstream::binary | std::fstream::in | std::fstream::out);
+    cmd_file_.open(cmd_file_name_, std::fstream::app | std::fstream::binary | std::fstream::in | std::fstream::out);
+    if (!file_.is_open())
+        __RECORD_THROW("cannot open log '" + file_name_ + "'");
+
+    if (!cmd_file_.is_open())
+        __RECORD_THROW("cannot open command log file");
+
+    file_.seekg(std::ios::beg);
+    cmd_file_.seekg(std::ios::beg);
+
+    init_records();
+}
+
 void record_manager::log(const record &r)
 {
     auto binary = r.to_binary();
@@ -104,7 +144,7 @@ void record_manager::log(const record &r)
         /// Persist to disk.
         file_.write(reinterpret_cast<const char*>(binary.data()), binary.size());
         file_.flush();
-        __CDB_LOG(info, "persist record " + std::to_string((int)r.status) + " " + std::to_string(r.id) + " " + std::to_string(r.next_id));
+        __CDB_LOG(debug, "persist record " + std::to_string((int)r.status) + " " + std::to_string(r.id) + " " + std::to_string(r.next_id));
 
         if (r.status == RECORD_ABORT_DONE || r.status == RECORD_COMMIT_DONE)
         {
@@ -113,19 +153,10 @@ void record_manager::log(const record &r)
             /// Clear the contents of the log.
             if (records_.empty())
             {
-                file_.close();
-                cmd_file_.close();
-
-                /// Haha! I don't know a more canonical way to delete the file_content.
-                {
-                    std::ofstream tmp{ file_name_, std::ios::out | std::ios::trunc };
-                    std::ofstream tmp2{ "cmd_" + file_name_, std::ios::out | std::ios::trunc };
-                }
-
-                file_.open(file_name_, std::fstream::app | std::fstream::binary | std::fstream::in | std::fstream::out);
-                cmd_file_.open("cmd_" + file_name_, std::fstream::app | std::fstream::binary | std::fstream::in | std::fstream::out);
-                file_.seekg(std::ios::beg);
-                cmd_file_.seekg(std::ios::beg);
+                /// Both are flushed, and opened to append: what's
+                /// written next goes to the start of the files.
+                if (::truncate(file_name_.c_str(), 0) < 0 || ::truncate(cmd_file_name_.c_str(), 0) < 0)
+                    __RECORD_THROW("cannot truncate log '" + file_name_ + "'");
 
                 // Preserve at least one record to help finding next_id
                 file_.write(reinterpret_cast<const char*>(binary.data()), binary.size());
@@ -141,47 +172,55 @@ void record_manager::log(const record &r)
     }
 }
 
-/// Used by the 
-void record_manager::log(const command *cmd)
-{
-    if (!cmd)
-        __RECORD_THROW("cmd is nullptr");
-
-    std::vector<unsigned char> binary;
-    /// FIXME: yea, this encoding should be here.
-    if (cmd->type == CMD_SET)
+/// Encodes SET and DEL commands for the command log.
+struct command_encoder {
+    void operator()(const set_command &cmd) const
     {
-        /// Type tag.
-        const auto set_cmd = static_cast<const set_command*>(cmd);
         record::encode_uint8_t(binary, CMD_SET);
+        record::encode_uint32_t(binary, cmd.id);
 
         /// Key.
-        record::encode_uint32_t(binary, set_cmd->key().size());
-        binary.insert(binary.end(), set_cmd->key().begin(), set_cmd->key().end());
+        record::encode_uint32_t(binary, cmd.key.size());
+        binary.insert(binary.end(), cmd.key.begin(), cmd.key.end());
 
         /// Value.
-        record::encode_uint32_t(binary, set_cmd->value().size());
-        binary.insert(binary.end(), set_cmd->value().begin(), set_cmd->value().end());
+        record::encode_uint32_t(binary, cmd.value.size());
+        binary.insert(binary.end(), cmd.value.begin(), cmd.value.end());
     }
-    else if (cmd->type == CMD_DEL)
+
+    void operator()(const del_command &cmd) const
     {
-        const auto del_cmd = static_cast<const del_command*>(cmd);
         record::encode_uint8_t(binary, CMD_DEL);
+        record::encode_uint32_t(binary, cmd.id);
 
-        for (const auto &arg : del_cmd->args())
+        record::encode_uint32_t(binary, cmd.keys.size());
+        for (const auto &key : cmd.keys)
         {
-            record::encode_uint32_t(binary, arg.size());
-            binary.insert(binary.end(), arg.begin(), arg.end());
+            record::encode_uint32_t(binary, key.size());
+            binary.insert(binary.end(), key.begin(), key.end());
         }
     }
-    else
+
+    void operator()(const get_command &) const
+    {
         __RECORD_THROW("encoding non SET/DEL command");
+    }
+
+    std::vector<unsigned char> &binary;
+};
+
+/// Used by the participant.
+void record_manager::log(const command &cmd)
+{
+    std::vector<unsigned char> binary;
+    /// FIXME: yea, this encoding should be here.
+    cmd.visit(command_encoder{ binary });
 
     try 
     {
         cmd_file_.write(reinterpret_cast<const char*>(binary.data()), binary.size());
         cmd_file_.flush();
-        __CDB_LOG(info, "persist command " + std::to_string(cmd->id()));
+        __CDB_LOG(info, "persist command " + std::to_string(cmd.id()));
 
         /// No need to keep it in memory since the participant already has one.
     }
@@ -215,55 +254,58 @@ void record_manager::init_records()
     }
 
     /// NOTE: Always init records before commands!
-    std::vector<unsigned char> cmd_data(std::istreambuf_iterator<char>(file_), {});
+    std::vector<unsigned char> cmd_data(std::istreambuf_iterator<char>(cmd_file_), {});
     start = 0;
     /// FIXME: Yea, pretty messy. We could've used the msgpack for this purpose.
     /// However, this does not seem to be an option.
     while (start < cmd_data.size())
     {
         auto type = record::decode_uint8_t(cmd_data, start);
-        std::unique_ptr<command> cmd_obj = nullptr;
+        if (type != CMD_SET && type != CMD_DEL)
+            __RECORD_THROW("unexpected command type");
 
-        /// Decode a set_command.
-        if (type == CMD_SET)
+        try
         {
             auto id = record::decode_uint32_t(cmd_data, start);
 
-            auto key_size = record::decode_uint32_t(cmd_data, start);
-            std::string key{cmd_data.begin() + start, cmd_data.begin() + start + key_size};
-            start += key_size;
+            /// We're only interested in those that are not DONE.
+            if (type == CMD_SET)
+            {
+                set_command cmd;
+                cmd.id = id;
 
-            auto val_size = record::decode_uint32_t(cmd_data, start);
-            std::string value{cmd_data.begin() + start, cmd_data.begin() + start + val_size};
-            start += val_size;
+                auto key_size = record::decode_uint32_t(cmd_data, start);
+                cmd.key = decode_string(cmd_data, start, key_size);
 
-            cmd_obj.reset(new set_command{std::move(key), std::move(value)});
-            cmd_obj->set_id(id);
-        }
-        else if (type == CMD_DEL)
-        {
-            auto id = record::decode_uint32_t(cmd_data, start);
-            auto num_args = record::decode_uint32_t(cmd_data, start);
-            std::vector<std::string> args(num_args);
+                auto val_size = record::decode_uint32_t(cmd_data, start);
+                cmd.value = decode_string(cmd_data, start, val_size);
 
-            while (num_args--)
+                if (records_.count(id))
+                    cmds_.emplace(id, std::move(cmd));
+            }
+            else
             {
-                auto arg_size = record::decode_uint32_t(cmd_data, start);
-                std::string arg{ cmd_data.begin() + start, cmd_data.begin() + start + arg_size };
-                start += arg_size;
+                del_command cmd;
+                cmd.id = id;
 
-                args.push_back(arg);
-            }
+                auto num_keys = record::decode_uint32_t(cmd_data, start);
+                while (num_keys--)
+                {
+                    auto key_size = record::decode_uint32_t(cmd_data, start);
+                    cmd.keys.push_back(decode_string(cmd_data, start, key_size));
+                }
 
-            cmd_obj.reset(new del_command{std::move(args)});
-            cmd_obj->set_id(id);
+                if (records_.count(id))
+                    cmds_.emplace(id, std::move(cmd));
+            }
+        }
+        catch (_log_error &e)
+        {
+            /// Cut short by a crash while it was logged. It has no record
+            /// either: commands are logged first.
+            __CDB_LOG(warn, "ignoring the partial command ending the command log");
+            break;
         }
-        else
-            __RECORD_THROW("unexpected command type");
-
-        /// We're only interested in those that are not DONE.
-        if (records_.count(cmd_obj->id()))
-            cmds_[cmd_obj->id()] = std::move(cmd_obj);
     }
 }
 
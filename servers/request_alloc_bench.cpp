@@ -0,0 +1,262 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include "command_parser.hpp"
+#include "configuration.hpp"
+#include "coordinator.hpp"
+#include "participant.hpp"
+
+using cdb::command_parser;
+
+/// Counts the heap allocations the coordinator makes per request: the
+/// parsing, the 2PC bookkeeping, the RPCs to the participant and the
+/// response. The participant runs in a child process, so that only the
+/// coordinator's allocations are counted, and a blocking client drives
+/// it from the main thread with raw syscalls.
+/// GETs and SETs are sent one at a time, then pipelined [batch] at a
+/// time, as a single read brings them in. The servers log to stdout,
+/// which is discarded: results go to stderr.
+///
+/// Usage: request_alloc_bench [requests] [batch]
+
+static std::atomic<std::size_t> allocations = ATOMIC_VAR_INIT(0);
+
+void *operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+static const std::uint16_t coordinator_port = 3010;
+static const std::uint16_t participant_port = 3011;
+
+static void fail(const char *what)
+{
+    std::perror(what);
+    std::exit(2);
+}
+
+static int connect_to(std::uint16_t port)
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        fail("socket");
+
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0)
+    {
+        ::close(fd);
+        return -1;
+    }
+
+    int one = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static void send_all(int fd, const std::string &data)
+{
+    std::size_t sent = 0;
+    while (sent < data.size())
+    {
+        ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, 0);
+        if (n <= 0)
+            fail("send");
+        sent += n;
+    }
+}
+
+/// Read [size] bytes.
+static void recv_all(int fd, char *data, std::size_t size)
+{
+    std::size_t received = 0;
+    while (received < size)
+    {
+        ssize_t n = ::recv(fd, data + received, size - received, 0);
+        if (n <= 0)
+            fail("recv");
+        received += n;
+    }
+}
+
+/// Send [requests] one [batch] at a time and return the allocations
+/// made per request. Each response is [response_size] bytes.
+static double run(int fd, const std::string &request, std::size_t response_size,
+                  std::size_t requests, std::size_t batch)
+{
+    std::string data;
+    for (std::size_t i = 0; i < batch; i++)
+        data += request;
+    std::string responses(response_size * batch, '\0');
+
+    std::size_t before = allocations.load();
+    for (std::size_t i = 0; i < requests; i += batch)
+    {
+        send_all(fd, data);
+        recv_all(fd, &responses[0], responses.size());
+    }
+    std::size_t after = allocations.load();
+
+    return double(after - before) / requests;
+}
+
+/// Size of the response to [request], which must fit a single read.
+static std::size_t response_size(int fd, const std::string &request)
+{
+    send_all(fd, request);
+
+    char response[4096];
+    ssize_t n = ::recv(fd, response, sizeof(response), 0);
+    if (n <= 0)
+        fail("recv");
+    return n;
+}
+
+static void run_participant(const std::string &storage)
+{
+    cdb::participant_configuration conf;
+    conf.mode = cdb::configuration::PARTICIPANT;
+    conf.addr = "127.0.0.1";
+    conf.port = participant_port;
+    conf.coordinator_addr = "127.0.0.1";
+    conf.coordinator_port = coordinator_port;
+    conf.storage_path = storage;
+
+    cdb::participant p(std::move(conf));
+    p.start();
+}
+
+int main(int argc, char **argv)
+{
+    std::size_t requests = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+    std::size_t batch = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 16;
+    if (requests == 0 || batch == 0)
+    {
+        std::fprintf(stderr, "usage: request_alloc_bench [requests] [batch]\n");
+        return 2;
+    }
+    requests = (requests + batch - 1) / batch * batch;
+
+    /// Both servers keep their logs in the current directory.
+    char dir[] = "/tmp/request_alloc_bench.XXXXXX";
+    if (!::mkdtemp(dir) || ::chdir(dir) < 0)
+        fail("mkdtemp");
+
+    /// Their logging isn't what's measured.
+    int null_fd = ::open("/dev/null", O_WRONLY);
+    if (null_fd < 0 || ::dup2(null_fd, STDOUT_FILENO) < 0)
+        fail("/dev/null");
+
+    pid_t child = ::fork();
+    if (child < 0)
+        fail("fork");
+    if (child == 0)
+    {
+        run_participant(std::string{dir} + "/db");
+        std::_Exit(0);
+    }
+
+    /// The coordinator connects to the participant once, when built.
+    for (int i = 0; ; i++)
+    {
+        int fd = connect_to(participant_port);
+        if (fd >= 0)
+        {
+            ::close(fd);
+            break;
+        }
+        if (i == 100)
+        {
+            ::kill(child, SIGKILL);
+            fail("participant");
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    cdb::coordinator_configuration conf;
+    conf.mode = cdb::configuration::COORDINATOR;
+    conf.addr = "127.0.0.1";
+    conf.port = coordinator_port;
+    conf.num_workers = 1;
+    conf.participant_addrs = { "127.0.0.1" };
+    conf.participant_ports = { participant_port };
+
+    cdb::coordinator c(std::move(conf));
+    c.async_start();
+
+    int fd = -1;
+    for (int i = 0; fd < 0 && i < 100; i++)
+    {
+        fd = connect_to(coordinator_port);
+        if (fd < 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    if (fd < 0)
+    {
+        ::kill(child, SIGKILL);
+        fail("coordinator");
+    }
+
+    std::string set = command_parser::encode_set("key:000000000000", std::string(16, 'v'));
+    std::string get = command_parser::encode_get("key:000000000000");
+    std::size_t set_response = response_size(fd, set);
+    std::size_t get_response = response_size(fd, get);
+
+    struct {
+        const char *name;
+        const std::string &request;
+        std::size_t response_size;
+        std::size_t batch;
+    } cases[] = {
+        { "get", get, get_response, 1 },
+        { "set 16B", set, set_response, 1 },
+        { "get", get, get_response, batch },
+        { "set 16B", set, set_response, batch },
+    };
+
+    for (auto &c : cases)
+    {
+        // Warm up.
+        run(fd, c.request, c.response_size, c.batch * 16, c.batch);
+
+        double per_request = run(fd, c.request, c.response_size, requests, c.batch);
+        std::fprintf(stderr, "%-8s batch %-4zu %8.1f allocations/request\n", c.name, c.batch, per_request);
+    }
+
+    ::close(fd);
+    ::kill(child, SIGKILL);
+    ::waitpid(child, nullptr, 0);
+    std::system((std::string{"rm -rf "} + dir).c_str());
+
+    /// The coordinator has no way to stop.
+    std::_Exit(0);
+}
@@ -0,0 +1,153 @@
+#include "resp_scan.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define RESP_SCAN_SSE2
+#endif
+
+/// Built for the plain target, and only run if the CPU has AVX2.
+#if defined(RESP_SCAN_SSE2) && defined(__GNUC__)
+#include <immintrin.h>
+#define RESP_SCAN_AVX2
+#endif
+
+namespace cdb {
+
+static std::size_t scan_digits_scalar(const char *data, std::size_t size)
+{
+    std::size_t i = 0;
+    while (i < size && static_cast<unsigned char>(data[i] - '0') < 10)
+        i++;
+    return i;
+}
+
+#ifdef RESP_SCAN_SSE2
+static std::size_t scan_digits_sse2(const char *data, std::size_t size)
+{
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i nine = _mm_set1_epi8(9);
+
+    std::size_t i = 0;
+    for (; i + 16 <= size; i += 16)
+    {
+        /// Digits are the bytes at most 9 above '0', unsigned.
+        __m128i d = _mm_sub_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i)), zero);
+        unsigned digits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(d, nine), d));
+        if (digits != 0xffff)
+            return i + __builtin_ctz(~digits);
+    }
+    return i + scan_digits_scalar(data + i, size - i);
+}
+#endif
+
+#ifdef RESP_SCAN_AVX2
+__attribute__((target("avx2")))
+static std::size_t scan_digits_avx2(const char *data, std::size_t size)
+{
+    const __m256i zero = _mm256_set1_epi8('0');
+    const __m256i nine = _mm256_set1_epi8(9);
+
+    std::size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i d = _mm256_sub_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i)), zero);
+        unsigned digits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(d, nine), d));
+        if (digits != 0xffffffffu)
+            return i + __builtin_ctz(~digits);
+    }
+    return i + scan_digits_sse2(data + i, size - i);
+}
+#endif
+
+typedef std::size_t (*scan_digits_fn)(const char*, std::size_t);
+
+static scan_kernel best_scan_kernel()
+{
+#ifdef RESP_SCAN_AVX2
+    if (__builtin_cpu_supports("avx2"))
+        return scan_kernel::AVX2;
+#endif
+#ifdef RESP_SCAN_SSE2
+    return scan_kernel::SSE2;
+#else
+    return scan_kernel::SCALAR;
+#endif
+}
+
+static scan_digits_fn scan_digits_impl(scan_kernel kernel)
+{
+    switch (kernel)
+    {
+#ifdef RESP_SCAN_AVX2
+    case scan_kernel::AVX2:
+        return scan_digits_avx2;
+#endif
+#ifdef RESP_SCAN_SSE2
+    case scan_kernel::SSE2:
+        return scan_digits_sse2;
+#endif
+    default:
+        return scan_digits_scalar;
+    }
+}
+
+static scan_kernel active_kernel = best_scan_kernel();
+static scan_digits_fn active_scan_digits = scan_digits_impl(active_kernel);
+
+std::size_t scan_digits(const char *data, std::size_t size)
+{
+    return active_scan_digits(data, size);
+}
+
+std::uint64_t parse_digits(const char *data, std::size_t size)
+{
+    std::uint64_t value = 0;
+    for (std::size_t i = 0; i < size; i++)
+        value = value * 10 + (data[i] - '0');
+    return value;
+}
+
+scan_kernel active_scan_kernel()
+{
+    return active_kernel;
+}
+
+bool set_scan_kernel(scan_kernel kernel)
+{
+    switch (kernel)
+    {
+    case scan_kernel::SCALAR:
+        break;
+    case scan_kernel::SSE2:
+#ifdef RESP_SCAN_SSE2
+        break;
+#else
+        return false;
+#endif
+    case scan_kernel::AVX2:
+#ifdef RESP_SCAN_AVX2
+        if (__builtin_cpu_supports("avx2"))
+            break;
+#endif
+        return false;
+    }
+
+    active_kernel = kernel;
+    active_scan_digits = scan_digits_impl(kernel);
+    return true;
+}
+
+const char *scan_kernel_name(scan_kernel kernel)
+{
+    switch (kernel)
+    {
+    case scan_kernel::SSE2:
+        return "sse2";
+    case scan_kernel::AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+}    // namespace cdb
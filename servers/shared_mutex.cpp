@@ -0,0 +1,35 @@
+#include "shared_mutex.hpp"
+
+namespace cdb {
+
+void shared_mutex::lock()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    writers_++;
+    cond_.wait(lock, [this] { return shared_ == 0 && !exclusive_; });
+    exclusive_ = true;
+}
+
+void shared_mutex::unlock()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    exclusive_ = false;
+    writers_--;
+    cond_.notify_all();
+}
+
+void shared_mutex::lock_shared()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this] { return writers_ == 0; });
+    shared_++;
+}
+
+void shared_mutex::unlock_shared()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--shared_ == 0)
+        cond_.notify_all();
+}
+
+} // namespace cdb
@@ -0,0 +1,130 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "tcp_server.hpp"
+
+using cdb_tcp_server::tcp_server;
+using cdb_tcp_server::tcp_client;
+
+/// Counts the heap allocations made by the server for each request of
+/// a streaming echo connection: the read event, the dispatch to the
+/// callback workers, the callback and the response write. A blocking
+/// client drives it from the main thread with raw syscalls, so that
+/// every allocation counted is the server's.
+///
+/// The response is handed over as a std::vector, which is the one
+/// allocation write_request can't avoid.
+///
+/// Usage: alloc_bench [requests] [max allocations per request]
+///
+/// Exits with 1 if the allocations per request exceed the given max.
+
+static std::atomic<std::size_t> allocations = ATOMIC_VAR_INIT(0);
+
+void *operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+static const std::uint32_t bench_port = 3002;
+static const char request[] = "ping\n";
+static const std::size_t request_size = sizeof(request) - 1;
+
+/// Echo every complete line back.
+static void echo(tcp_client *client, tcp_client::buffered_read_result &result)
+{
+    if (!result.success)
+        return;
+
+    auto &buffer = result.buffer;
+    while (const void *eol = std::memchr(buffer.data(), '\n', buffer.size()))
+    {
+        std::size_t n = static_cast<const char*>(eol) - buffer.data() + 1;
+        client->async_write({ std::vector<char>(buffer.data(), buffer.data() + n), nullptr });
+        buffer.consume(n);
+    }
+}
+
+static void round_trip(int fd)
+{
+    if (::send(fd, request, request_size, 0) != static_cast<ssize_t>(request_size))
+    {
+        std::perror("send");
+        std::exit(2);
+    }
+
+    char response[request_size];
+    std::size_t received = 0;
+    while (received < request_size)
+    {
+        ssize_t n = ::recv(fd, response + received, request_size - received, 0);
+        if (n <= 0)
+        {
+            std::perror("recv");
+            std::exit(2);
+        }
+        received += n;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::size_t requests = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    double max_per_request = argc > 2 ? std::strtod(argv[2], nullptr) : -1;
+
+    tcp_server server{1, 1};
+    server.start("127.0.0.1", bench_port, [](std::shared_ptr<tcp_client> client) {
+        // Raw pointer: the server keeps the client alive.
+        tcp_client *c = client.get();
+        client->start_reading([c](tcp_client::buffered_read_result &result) { echo(c, result); });
+    });
+
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(bench_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0)
+    {
+        std::perror("connect");
+        return 2;
+    }
+
+    // Warm up pools and buffers.
+    for (int i = 0; i < 1000; i++)
+        round_trip(fd);
+
+    std::size_t before = allocations.load();
+    for (std::size_t i = 0; i < requests; i++)
+        round_trip(fd);
+    std::size_t after = allocations.load();
+
+    ::close(fd);
+    server.stop();
+
+    double per_request = static_cast<double>(after - before) / requests;
+    std::printf("%zu requests  %zu allocations  %.3f allocations/request\n",
+                requests, after - before, per_request);
+
+    return max_per_request >= 0 && per_request > max_per_request ? 1 : 0;
+}
@@ -0,0 +1,87 @@
+#include "buffer_pool.hpp"
+
+namespace cdb_tcp_server
+{
+
+const std::size_t buffer_pool::min_block;
+const std::size_t buffer_pool::max_block;
+const std::size_t buffer_pool::num_classes;
+
+buffer_pool::buffer_pool(std::size_t max_free)
+    : max_free_(max_free) {}
+
+buffer_pool::~buffer_pool()
+{
+    for (auto &c : classes_)
+        for (char *block : c.free)
+            delete[] block;
+}
+
+std::size_t buffer_pool::class_of(std::size_t size)
+{
+    std::size_t idx = 0;
+    std::size_t block = min_block;
+    while (block < size)
+    {
+        block <<= 1;
+        idx++;
+    }
+
+    return idx;
+}
+
+char *buffer_pool::acquire(std::size_t size, std::size_t &capacity)
+{
+    if (size > max_block)
+    {
+        capacity = size;
+        return new char[size];
+    }
+
+    std::size_t idx = class_of(size);
+    capacity = min_block << idx;
+
+    auto &c = classes_[idx];
+    {
+        std::lock_guard<std::mutex> lock(c.mutex);
+        if (!c.free.empty())
+        {
+            char *block = c.free.back();
+            c.free.pop_back();
+            return block;
+        }
+    }
+
+    return new char[capacity];
+}
+
+void buffer_pool::release(char *block, std::size_t capacity)
+{
+    if (block == nullptr)
+        return;
+
+    if (capacity <= max_block)
+    {
+        auto &c = classes_[class_of(capacity)];
+        std::lock_guard<std::mutex> lock(c.mutex);
+        if (c.free.size() < max_free_)
+        {
+            if (c.free.capacity() == 0)
+                c.free.reserve(max_free_);
+            c.free.push_back(block);
+            return;
+        }
+    }
+
+    delete[] block;
+}
+
+buffer_pool *get_default_buffer_pool()
+{
+    // Never destroyed: clients may still give their blocks back
+    // during static destruction.
+    static buffer_pool *pool = new buffer_pool;
+    return pool;
+}
+
+} // namespace cdb_tcp_server
@@ -0,0 +1,57 @@
+#ifndef TCP_SERVER_BUFFER_POOL_HPP
+#define TCP_SERVER_BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace cdb_tcp_server
+{
+
+/// Pool of memory blocks in power-of-2 size classes, from [min_block]
+/// to [max_block] bytes. Released blocks are kept on a free list per
+/// class and handed out again, so that buffers of long-lived
+/// connections don't hit the allocator on every read. Larger requests
+/// bypass the pool.
+class buffer_pool {
+public:
+    /// At most [max_free] blocks are kept per size class.
+    buffer_pool(std::size_t max_free = 64);
+    ~buffer_pool();
+
+    buffer_pool(const buffer_pool&) = delete;
+    buffer_pool& operator=(const buffer_pool&) = delete;
+
+public:
+    static const std::size_t min_block = 1024;
+    static const std::size_t max_block = 1 << 20;
+
+    /// A block of at least [size] bytes. Its actual size is stored in
+    /// [capacity] and must be passed back to release().
+    char *acquire(std::size_t size, std::size_t &capacity);
+    void release(char *block, std::size_t capacity);
+
+private:
+    static const std::size_t num_classes = 11;
+    static_assert((min_block << (num_classes - 1)) == max_block,
+                  "size classes must span [min_block, max_block]");
+
+    /// Index of the smallest class holding [size] bytes.
+    static std::size_t class_of(std::size_t size);
+
+    struct size_class {
+        std::mutex mutex;
+        std::vector<char*> free;
+    };
+
+    size_class classes_[num_classes];
+    std::size_t max_free_;
+};
+
+/// Pool shared by every tcp_client.
+buffer_pool *get_default_buffer_pool();
+
+} // namespace cdb_tcp_server
+
+
+#endif
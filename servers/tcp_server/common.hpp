@@ -5,4 +5,16 @@
     #define TCP_SERVER_BACK_LOG   1024
 #endif
 
+#ifndef TCP_SERVER_ACCEPT_BATCH
+    #define TCP_SERVER_ACCEPT_BATCH   64
+#endif
+
+#ifndef TCP_SERVER_SHM_RING_SIZE
+    #define TCP_SERVER_SHM_RING_SIZE   (1 << 20)
+#endif
+
+#ifndef TCP_SERVER_HANDOFF_DRAIN_TIMEOUT
+    #define TCP_SERVER_HANDOFF_DRAIN_TIMEOUT   5000
+#endif
+
 #endif
\ No newline at end of file
@@ -0,0 +1,124 @@
+#include <new>
+#include "connection_table.hpp"
+#include "tcp_client.hpp"
+
+namespace cdb_tcp_server
+{
+
+slab_pool::slab_pool(std::size_t max_free)
+    : block_size_(0)
+    , max_free_(max_free) {}
+
+slab_pool::~slab_pool()
+{
+    for (void *block : free_)
+        ::operator delete(block);
+}
+
+void *slab_pool::acquire(std::size_t size)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (block_size_ == 0)
+            block_size_ = size;
+
+        if (size == block_size_ && !free_.empty())
+        {
+            void *block = free_.back();
+            free_.pop_back();
+            return block;
+        }
+    }
+
+    return ::operator new(size);
+}
+
+void slab_pool::release(void *block, std::size_t size)
+{
+    if (block == nullptr)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (size == block_size_ && free_.size() < max_free_)
+        {
+            free_.push_back(block);
+            return;
+        }
+    }
+
+    ::operator delete(block);
+}
+
+const std::uint32_t connection_table::no_slot;
+
+connection_table::connection_table()
+    : free_head_(no_slot)
+    , size_(0) {}
+
+connection_table::connection_id
+connection_table::insert(const std::shared_ptr<tcp_client> &client)
+{
+    std::uint32_t idx;
+    if (free_head_ != no_slot)
+    {
+        idx = free_head_;
+        free_head_ = slots_[idx].next_free;
+    }
+    else
+    {
+        idx = static_cast<std::uint32_t>(slots_.size());
+        slots_.push_back({ nullptr, 0, no_slot });
+    }
+
+    auto &s = slots_[idx];
+    s.client = client;
+    size_++;
+
+    return (static_cast<connection_id>(s.generation) << 32) | idx;
+}
+
+std::shared_ptr<tcp_client> connection_table::remove(connection_id id)
+{
+    std::uint32_t idx = static_cast<std::uint32_t>(id);
+    std::uint32_t generation = static_cast<std::uint32_t>(id >> 32);
+    if (idx >= slots_.size())
+        return nullptr;
+
+    auto &s = slots_[idx];
+    if (s.generation != generation || !s.client)
+        return nullptr;
+
+    std::shared_ptr<tcp_client> client = std::move(s.client);
+    s.client = nullptr;
+    s.generation++;
+    s.next_free = free_head_;
+    free_head_ = idx;
+    size_--;
+
+    return client;
+}
+
+void connection_table::take_all(std::vector<std::shared_ptr<tcp_client>> &out)
+{
+    out.reserve(out.size() + size_);
+    for (auto &s : slots_)
+        if (s.client)
+        {
+            out.push_back(std::move(s.client));
+            s.client = nullptr;
+        }
+
+    // Every slot is free again; bump the generations so that ids
+    // handed out so far go stale.
+    free_head_ = no_slot;
+    for (std::size_t i = slots_.size(); i-- > 0; )
+    {
+        slots_[i].generation++;
+        slots_[i].next_free = free_head_;
+        free_head_ = static_cast<std::uint32_t>(i);
+    }
+    size_ = 0;
+}
+
+} // namespace cdb_tcp_server
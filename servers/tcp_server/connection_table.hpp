@@ -0,0 +1,118 @@
+#ifndef TCP_SERVER_CONNECTION_TABLE_HPP
+#define TCP_SERVER_CONNECTION_TABLE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace cdb_tcp_server
+{
+
+/// Forward declaration.
+class tcp_client;
+
+/// Free list of fixed-size memory blocks. The size is that of the first
+/// block acquired; other sizes bypass the pool. Lets a server reuse the
+/// memory of closed connections instead of allocating on every accept.
+class slab_pool {
+public:
+    /// At most [max_free] blocks are kept.
+    slab_pool(std::size_t max_free = 1024);
+    ~slab_pool();
+
+    slab_pool(const slab_pool&) = delete;
+    slab_pool& operator=(const slab_pool&) = delete;
+
+public:
+    void *acquire(std::size_t size);
+    void release(void *block, std::size_t size);
+
+private:
+    std::mutex mutex_;
+    std::vector<void*> free_;
+    std::size_t block_size_;
+    std::size_t max_free_;
+};
+
+/// Allocator drawing from a slab_pool, for std::allocate_shared: the
+/// object and its control block then take a single pooled block. The
+/// pool is shared, so that objects may outlive whoever created them.
+template <typename T>
+class slab_allocator {
+public:
+    typedef T value_type;
+
+    slab_allocator(const std::shared_ptr<slab_pool> &pool) : pool_(pool) {}
+
+    template <typename U>
+    slab_allocator(const slab_allocator<U> &other) : pool_(other.pool()) {}
+
+    T *allocate(std::size_t n)
+    {
+        return static_cast<T*>(pool_->acquire(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, std::size_t n)
+    {
+        pool_->release(p, n * sizeof(T));
+    }
+
+    const std::shared_ptr<slab_pool> &pool() const { return pool_; }
+
+    template <typename U>
+    bool operator==(const slab_allocator<U> &rhs) const { return pool_ == rhs.pool(); }
+    template <typename U>
+    bool operator!=(const slab_allocator<U> &rhs) const { return pool_ != rhs.pool(); }
+
+private:
+    std::shared_ptr<slab_pool> pool_;
+};
+
+/// Clients of a tcp_server, keyed by connection id. Slots are kept in a
+/// flat array with a free list, so that insertion and removal are O(1).
+/// An id carries the generation of its slot: once the slot is reused,
+/// the old id no longer matches it.
+/// NOTE: not thread safe.
+class connection_table {
+public:
+    typedef std::uint64_t connection_id;
+
+    connection_table();
+
+    connection_table(const connection_table&) = delete;
+    connection_table& operator=(const connection_table&) = delete;
+
+public:
+    connection_id insert(const std::shared_ptr<tcp_client> &client);
+
+    /// Take the client of [id] out of the table. nullptr if [id] is
+    /// stale.
+    std::shared_ptr<tcp_client> remove(connection_id id);
+
+    /// Move every client to [out] and empty the table.
+    void take_all(std::vector<std::shared_ptr<tcp_client>> &out);
+
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+private:
+    struct slot {
+        std::shared_ptr<tcp_client> client;
+        std::uint32_t generation;
+        /// Next free slot, only meaningful while this one is free.
+        std::uint32_t next_free;
+    };
+
+    static const std::uint32_t no_slot = UINT32_MAX;
+
+    std::vector<slot> slots_;
+    std::uint32_t free_head_;
+    std::size_t size_;
+};
+
+} // namespace cdb_tcp_server
+
+
+#endif
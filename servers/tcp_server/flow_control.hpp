@@ -0,0 +1,48 @@
+#ifndef TCP_SERVER_FLOW_CONTROL_HPP
+#define TCP_SERVER_FLOW_CONTROL_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace cdb_tcp_server
+{
+
+/// Limits on what streaming tcp_clients may buffer, and how often they
+/// were hit. A tcp_server shares one with all of its clients. Zero
+/// disables a limit.
+struct flow_control {
+    /// Stop reading from a client once its unsent output reaches
+    /// [high_watermark] bytes or [high_pending_writes] write requests,
+    /// i.e. responses it hasn't taken yet. Reading resumes once both
+    /// are back at or below their low marks.
+    std::size_t high_watermark = 0;
+    std::size_t low_watermark = 0;
+    std::size_t high_pending_writes = 0;
+    std::size_t low_pending_writes = 0;
+
+    /// Stop reading from every client while all of them together have
+    /// this many bytes buffered, input and output.
+    std::size_t max_buffered_bytes = 0;
+
+    /// Bytes currently buffered by all clients.
+    std::atomic<std::size_t> buffered_bytes = ATOMIC_VAR_INIT(0);
+
+    /// Times a client stopped reading because of the watermarks, and
+    /// because of [max_buffered_bytes].
+    std::atomic<std::uint64_t> watermark_pauses = ATOMIC_VAR_INIT(0);
+    std::atomic<std::uint64_t> buffered_bytes_pauses = ATOMIC_VAR_INIT(0);
+
+    /// Connections tcp_server closed right away because it was at
+    /// its max_connections.
+    std::atomic<std::uint64_t> rejected_connections = ATOMIC_VAR_INIT(0);
+
+    /// Times tcp_server stopped accepting for a while because it was
+    /// out of fds.
+    std::atomic<std::uint64_t> accept_pauses = ATOMIC_VAR_INIT(0);
+};
+
+} // namespace cdb_tcp_server
+
+
+#endif
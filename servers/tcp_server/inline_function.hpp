@@ -0,0 +1,218 @@
+#ifndef TCP_SERVER_INLINE_FUNCTION_HPP
+#define TCP_SERVER_INLINE_FUNCTION_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace cdb_tcp_server
+{
+
+template <typename Signature, std::size_t Capacity = 48>
+class inline_function;
+
+/// Drop-in for std::function that keeps callables of up to [Capacity]
+/// bytes in place rather than on the heap. A std::bind of a member
+/// function with a few arguments, or a lambda capturing a handful of
+/// pointers and a shared_ptr, fits; larger callables still go to the
+/// heap. Copying copies the callable, so an inline one is copied
+/// without allocating.
+template <typename R, typename... Args, std::size_t Capacity>
+class inline_function<R(Args...), Capacity> {
+public:
+    inline_function() noexcept : ops_(nullptr) {}
+    inline_function(std::nullptr_t) noexcept : ops_(nullptr) {}
+
+    template <typename F,
+              typename = typename std::enable_if<
+                  !std::is_same<typename std::decay<F>::type, inline_function>::value>::type>
+    inline_function(F &&f) : ops_(nullptr)
+    {
+        assign(std::forward<F>(f));
+    }
+
+    inline_function(const inline_function &other) : ops_(nullptr)
+    {
+        if (other.ops_)
+        {
+            other.ops_->copy(&other.storage_, &storage_);
+            ops_ = other.ops_;
+        }
+    }
+
+    inline_function(inline_function &&other) noexcept : ops_(nullptr)
+    {
+        if (other.ops_)
+        {
+            other.ops_->move(&other.storage_, &storage_);
+            ops_ = other.ops_;
+            other.reset();
+        }
+    }
+
+    ~inline_function() { reset(); }
+
+    inline_function &operator=(const inline_function &other)
+    {
+        if (this != &other)
+        {
+            inline_function tmp(other);
+            *this = std::move(tmp);
+        }
+        return *this;
+    }
+
+    inline_function &operator=(inline_function &&other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            if (other.ops_)
+            {
+                other.ops_->move(&other.storage_, &storage_);
+                ops_ = other.ops_;
+                other.reset();
+            }
+        }
+        return *this;
+    }
+
+    inline_function &operator=(std::nullptr_t) noexcept
+    {
+        reset();
+        return *this;
+    }
+
+    template <typename F,
+              typename = typename std::enable_if<
+                  !std::is_same<typename std::decay<F>::type, inline_function>::value>::type>
+    inline_function &operator=(F &&f)
+    {
+        inline_function tmp(std::forward<F>(f));
+        *this = std::move(tmp);
+        return *this;
+    }
+
+    R operator()(Args... args) const
+    {
+        return ops_->invoke(const_cast<storage_t*>(&storage_), std::forward<Args>(args)...);
+    }
+
+    explicit operator bool() const noexcept { return ops_ != nullptr; }
+
+    friend bool operator==(const inline_function &f, std::nullptr_t) noexcept { return !f; }
+    friend bool operator!=(const inline_function &f, std::nullptr_t) noexcept { return static_cast<bool>(f); }
+
+private:
+    typedef typename std::aligned_storage<Capacity, alignof(std::max_align_t)>::type storage_t;
+
+    /// Operations on the stored callable, one static table per type.
+    struct ops_t {
+        R (*invoke)(storage_t *self, Args&&... args);
+        void (*copy)(const storage_t *from, storage_t *to);
+        /// Leaves [from] to be destroyed.
+        void (*move)(storage_t *from, storage_t *to);
+        void (*destroy)(storage_t *self);
+    };
+
+    template <typename F>
+    struct inline_ops {
+        static F *get(storage_t *s) { return reinterpret_cast<F*>(s); }
+        static const F *get(const storage_t *s) { return reinterpret_cast<const F*>(s); }
+
+        static R invoke(storage_t *s, Args&&... args) { return (*get(s))(std::forward<Args>(args)...); }
+        static void copy(const storage_t *from, storage_t *to) { new (to) F(*get(from)); }
+        static void move(storage_t *from, storage_t *to) { new (to) F(std::move(*get(from))); }
+        static void destroy(storage_t *s) { get(s)->~F(); }
+
+        static const ops_t table;
+    };
+
+    /// Too big or not nothrow-movable: a pointer to it is stored instead.
+    template <typename F>
+    struct heap_ops {
+        static F *&get(storage_t *s) { return *reinterpret_cast<F**>(s); }
+        static F *get(const storage_t *s) { return *reinterpret_cast<F* const*>(s); }
+
+        static R invoke(storage_t *s, Args&&... args) { return (*get(s))(std::forward<Args>(args)...); }
+        static void copy(const storage_t *from, storage_t *to) { new (to) F*(new F(*get(from))); }
+        static void move(storage_t *from, storage_t *to) { new (to) F*(get(from)); get(from) = nullptr; }
+        static void destroy(storage_t *s) { delete get(s); }
+
+        static const ops_t table;
+    };
+
+    template <typename F>
+    struct fits_inline {
+        static const bool value = sizeof(F) <= Capacity
+                               && alignof(std::max_align_t) % alignof(F) == 0
+                               && std::is_nothrow_move_constructible<F>::value;
+    };
+
+    template <typename F>
+    void assign(F &&f)
+    {
+        typedef typename std::decay<F>::type fn_t;
+        if (is_null(f))
+            return;
+        emplace<fn_t>(std::forward<F>(f), std::integral_constant<bool, fits_inline<fn_t>::value>());
+    }
+
+    template <typename F, typename G>
+    void emplace(G &&f, std::true_type)
+    {
+        new (&storage_) F(std::forward<G>(f));
+        ops_ = &inline_ops<F>::table;
+    }
+
+    template <typename F, typename G>
+    void emplace(G &&f, std::false_type)
+    {
+        new (&storage_) F*(new F(std::forward<G>(f)));
+        ops_ = &heap_ops<F>::table;
+    }
+
+    /// Null function pointers and empty std::functions make an empty
+    /// inline_function, as they would a std::function.
+    template <typename F>
+    static bool is_null(const F &f) { return is_null_impl(f, 0); }
+
+    template <typename F>
+    static auto is_null_impl(const F &f, int) -> decltype(static_cast<bool>(f == nullptr)) { return f == nullptr; }
+
+    template <typename F>
+    static bool is_null_impl(const F &, long) { return false; }
+
+    void reset() noexcept
+    {
+        if (ops_)
+        {
+            ops_->destroy(&storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    storage_t storage_;
+    const ops_t *ops_;
+};
+
+template <typename R, typename... Args, std::size_t Capacity>
+template <typename F>
+const typename inline_function<R(Args...), Capacity>::ops_t
+inline_function<R(Args...), Capacity>::inline_ops<F>::table = {
+    &inline_ops<F>::invoke, &inline_ops<F>::copy, &inline_ops<F>::move, &inline_ops<F>::destroy
+};
+
+template <typename R, typename... Args, std::size_t Capacity>
+template <typename F>
+const typename inline_function<R(Args...), Capacity>::ops_t
+inline_function<R(Args...), Capacity>::heap_ops<F>::table = {
+    &heap_ops<F>::invoke, &heap_ops<F>::copy, &heap_ops<F>::move, &heap_ops<F>::destroy
+};
+
+} // namespace cdb_tcp_server
+
+
+#endif
@@ -0,0 +1,74 @@
+#include <cstring>
+#include "io_buffer.hpp"
+
+namespace cdb_tcp_server
+{
+
+io_buffer::io_buffer(buffer_pool *pool)
+    : pool_(pool == nullptr ? get_default_buffer_pool() : pool)
+    , block_(nullptr)
+    , capacity_(0)
+    , head_(0)
+    , tail_(0) {}
+
+io_buffer::~io_buffer()
+{
+    clear();
+}
+
+void io_buffer::reserve(std::size_t n)
+{
+    if (writable() >= n)
+        return;
+
+    std::size_t unread = size();
+
+    // Reuse the space consumed at the front.
+    if (block_ != nullptr && capacity_ - unread >= n)
+    {
+        std::memmove(block_, block_ + head_, unread);
+        head_ = 0;
+        tail_ = unread;
+        return;
+    }
+
+    std::size_t capacity;
+    char *block = pool_->acquire(unread + n, capacity);
+    if (unread)
+        std::memcpy(block, block_ + head_, unread);
+
+    pool_->release(block_, capacity_);
+    block_ = block;
+    capacity_ = capacity;
+    head_ = 0;
+    tail_ = unread;
+}
+
+void io_buffer::commit(std::size_t n)
+{
+    tail_ += n;
+}
+
+void io_buffer::consume(std::size_t n)
+{
+    head_ += n;
+
+    if (head_ == tail_)
+    {
+        head_ = tail_ = 0;
+
+        // Don't keep a block grown for one large request around.
+        if (capacity_ > buffer_pool::min_block)
+            clear();
+    }
+}
+
+void io_buffer::clear()
+{
+    pool_->release(block_, capacity_);
+    block_ = nullptr;
+    capacity_ = 0;
+    head_ = tail_ = 0;
+}
+
+} // namespace cdb_tcp_server
@@ -0,0 +1,60 @@
+#ifndef TCP_SERVER_IO_BUFFER_HPP
+#define TCP_SERVER_IO_BUFFER_HPP
+
+#include <cstddef>
+#include "buffer_pool.hpp"
+
+namespace cdb_tcp_server
+{
+
+/// Growable byte buffer backed by a buffer_pool block. Bytes are
+/// appended at the tail (write_ptr/commit) and consumed from the head
+/// (data/consume). Instead of wrapping around, unread bytes are moved
+/// back to the front when room is needed, so that they can always be
+/// parsed in place as one contiguous range.
+class io_buffer {
+public:
+    io_buffer(buffer_pool *pool = nullptr);
+    ~io_buffer();
+
+    io_buffer(const io_buffer&) = delete;
+    io_buffer& operator=(const io_buffer&) = delete;
+
+public:
+    /// Unread bytes.
+    const char *data() const { return block_ + head_; }
+    std::size_t size() const { return tail_ - head_; }
+    bool empty() const { return head_ == tail_; }
+
+    /// Room after the unread bytes.
+    char *write_ptr() { return block_ + tail_; }
+    std::size_t writable() const { return capacity_ - tail_; }
+
+    /// Make room for at least [n] more bytes, compacting first and
+    /// moving to a larger block only if that isn't enough.
+    void reserve(std::size_t n);
+
+    /// [n] bytes were written at write_ptr().
+    void commit(std::size_t n);
+
+    /// Drop the first [n] unread bytes.
+    void consume(std::size_t n);
+
+    /// Drop everything and give the block back to the pool.
+    void clear();
+
+private:
+    buffer_pool *pool_;
+
+    char *block_;
+    std::size_t capacity_;
+
+    /// Unread bytes are [head_, tail_).
+    std::size_t head_;
+    std::size_t tail_;
+};
+
+} // namespace cdb_tcp_server
+
+
+#endif
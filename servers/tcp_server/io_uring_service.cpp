@@ -0,0 +1,756 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+#include "exceptions.hpp"
+#include "io_uring_service.hpp"
+
+namespace cdb_tcp_server
+{
+
+/// Connection whose callback the current thread is running, if any.
+static thread_local const void *running_connection = nullptr;
+
+/*
+connection.
+*/
+
+io_uring_service::connection::connection(io_uring_service *service,
+                                         int fd,
+                                         const std::function<void()> &on_recv,
+                                         const std::function<void(int)> &on_send)
+    : service_(service)
+    , fd_(fd)
+    , on_recv_(on_recv)
+    , on_send_(on_send)
+    , rx_head_(0)
+    , rx_size_(0)
+    , rx_closed_(false)
+    , rx_released_(false)
+    , rx_paused_(false)
+    , recv_signals_(0)
+    , recv_op_(nullptr)
+    , send_op_(nullptr)
+    , cancelled_(false)
+    , recv_restart_(false)
+    , detached_(false)
+    , running_(0) {}
+
+const std::size_t io_uring_service::max_rx_buffered;
+
+bool io_uring_service::connection::consume(std::size_t max, std::vector<char> &out)
+{
+    bool resume;
+    {
+        std::lock_guard<std::mutex> lock(rx_mutex_);
+
+        if (rx_size_ == 0)
+            return false;
+
+        out.resize(std::min(max, rx_size_));
+        take_rx(out.size(), out.data(), resume);
+    }
+
+    if (resume)
+        service_->start_recv(shared_from_this());
+    return true;
+}
+
+std::size_t io_uring_service::connection::consume(std::size_t max, char *out)
+{
+    std::size_t n;
+    bool resume;
+    {
+        std::lock_guard<std::mutex> lock(rx_mutex_);
+
+        if (rx_size_ == 0)
+            return 0;
+
+        n = take_rx(max, out, resume);
+    }
+
+    if (resume)
+        service_->start_recv(shared_from_this());
+    return n;
+}
+
+std::size_t io_uring_service::connection::take_rx(std::size_t max, char *out, bool &resume)
+{
+    std::size_t n = 0;
+
+    // Older than anything in [rx_].
+    while (n < max && !rx_chunks_.empty())
+    {
+        rx_chunk &chunk = rx_chunks_.front();
+        std::size_t k = std::min(max - n, chunk.size);
+        std::memcpy(out + n, chunk.data, k);
+        n += k;
+        chunk.data += k;
+        chunk.size -= k;
+        if (chunk.size == 0)
+        {
+            service_->recycle_buffer(chunk.bid);
+            rx_chunks_.pop_front();
+        }
+    }
+
+    std::size_t k = std::min(max - n, rx_.size() - rx_head_);
+    std::memcpy(out + n, rx_.data() + rx_head_, k);
+    n += k;
+    rx_head_ += k;
+    rx_size_ -= n;
+
+    // Compact once the consumed prefix dominates.
+    if (rx_head_ == rx_.size())
+    {
+        rx_.clear();
+        rx_head_ = 0;
+    }
+    else if (rx_head_ > rx_.size() / 2)
+    {
+        rx_.erase(rx_.begin(), rx_.begin() + rx_head_);
+        rx_head_ = 0;
+    }
+
+    resume = rx_paused_ && rx_size_ <= max_rx_buffered / 2;
+    if (resume)
+        rx_paused_ = false;
+    return n;
+}
+
+void io_uring_service::connection::release_rx()
+{
+    std::lock_guard<std::mutex> lock(rx_mutex_);
+
+    rx_released_ = true;
+    for (const rx_chunk &chunk : rx_chunks_)
+        service_->recycle_buffer(chunk.bid);
+    rx_chunks_.clear();
+    rx_.clear();
+    rx_head_ = rx_size_ = 0;
+}
+
+bool io_uring_service::connection::is_closed()
+{
+    std::lock_guard<std::mutex> lock(rx_mutex_);
+    return rx_closed_;
+}
+
+bool io_uring_service::connection::is_readable()
+{
+    std::lock_guard<std::mutex> lock(rx_mutex_);
+    return rx_closed_ || rx_size_ > 0;
+}
+
+void io_uring_service::connection::run_guarded(const std::function<void()> &cb)
+{
+    {
+        std::lock_guard<std::mutex> lock(guard_mutex_);
+        if (detached_)
+            return;
+        running_++;
+    }
+
+    const void *prev = running_connection;
+    running_connection = this;
+    try {
+        cb();
+    } catch (const std::exception &) {
+        // TODO: add log.
+    }
+    running_connection = prev;
+
+    std::lock_guard<std::mutex> lock(guard_mutex_);
+    running_--;
+    guard_cond_.notify_all();
+}
+
+void io_uring_service::connection::detach(bool wait)
+{
+    std::unique_lock<std::mutex> lock(guard_mutex_);
+
+    detached_ = true;
+    if (wait)
+    {
+        int self = running_connection == this ? 1 : 0;
+        guard_cond_.wait(lock, [&] { return running_ <= self; });
+    }
+}
+
+#ifdef __linux__
+
+/// Ring sizes. [buf_count] must be a power of 2.
+static const unsigned ring_entries = 256;
+static const unsigned buf_count = 256;
+static const std::size_t buf_size = 4096;
+
+/// Receive buffers a connection may hold until its bytes are consumed,
+/// and all of them together: the others keep the kernel supplied.
+static const std::size_t max_conn_held_bufs = 16;
+static const unsigned max_held_bufs = buf_count / 2;
+static const std::uint16_t buf_group = 0;
+
+/// user_data of the notifier's poll, and of SQEs whose completion is
+/// ignored. Never valid op addresses.
+static const std::uint64_t notifier_user_data = 0;
+static const std::uint64_t ignored_user_data = 1;
+
+struct io_uring_service::op
+{
+    enum class type { RECV, SEND };
+
+    type t;
+    std::shared_ptr<connection> conn;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+    return static_cast<int>(::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+io_uring_service::io_uring_service(reactor::callback_pool_t &workers)
+    : workers_(workers)
+    , ring_fd_(-1)
+    , sq_ring_(MAP_FAILED)
+    , cq_ring_(MAP_FAILED)
+    , sq_ring_size_(0)
+    , cq_ring_size_(0)
+    , sqes_(nullptr)
+    , sqes_size_(0)
+    , bufs_(nullptr)
+    , held_bufs_(0)
+    , multishot_(true)
+    , sq_pending_(0)
+    , stop_(false)
+{
+    try {
+        setup();
+    } catch (const std::runtime_error &) {
+        teardown();
+        throw;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(sq_mutex_);
+        rearm_notifier();
+    }
+    worker_ = std::thread(std::bind(&io_uring_service::run, this));
+}
+
+io_uring_service::~io_uring_service()
+{
+    stop_ = true;
+    notifier_.notify();
+    if (worker_.joinable())
+        worker_.join();
+
+    // The kernel may still write into [bufs_] until receives are gone.
+    cancel_all();
+    teardown();
+}
+
+void io_uring_service::setup()
+{
+    struct io_uring_params p;
+    std::memset(&p, 0, sizeof(p));
+
+    ring_fd_ = sys_io_uring_setup(ring_entries, &p);
+    if (ring_fd_ < 0)
+        __TCP_THROW("error io_uring_setup()");
+
+    sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+
+    sq_ring_ = ::mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ring_ == MAP_FAILED)
+        __TCP_THROW("error mmap() io_uring sq ring");
+
+    if (single_mmap)
+        cq_ring_ = sq_ring_;
+    else
+    {
+        cq_ring_ = ::mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+        if (cq_ring_ == MAP_FAILED)
+            __TCP_THROW("error mmap() io_uring cq ring");
+    }
+
+    sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    void *sqes = ::mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        __TCP_THROW("error mmap() io_uring sqes");
+    sqes_ = static_cast<struct io_uring_sqe*>(sqes);
+
+    char *sq = static_cast<char*>(sq_ring_);
+    char *cq = static_cast<char*>(cq_ring_);
+    sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    sq_entries_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_entries);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+
+    // Every opcode we issue must be supported.
+    std::vector<char> probe_mem(sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op), 0);
+    auto *probe = reinterpret_cast<struct io_uring_probe*>(probe_mem.data());
+    if (sys_io_uring_register(ring_fd_, IORING_REGISTER_PROBE, probe, 256) < 0)
+        __TCP_THROW("error io_uring_register() probe");
+
+    const int required_ops[] = {
+        IORING_OP_RECV, IORING_OP_SEND, IORING_OP_POLL_ADD,
+        IORING_OP_ASYNC_CANCEL, IORING_OP_PROVIDE_BUFFERS
+    };
+    for (int required : required_ops)
+        if (required > probe->last_op || !(probe->ops[required].flags & IO_URING_OP_SUPPORTED))
+            __TCP_THROW("io_uring lacks a required opcode");
+
+    // Hand every receive buffer to the kernel and wait until it took
+    // them, so that a kernel unable to select buffers fails here rather
+    // than on the first receive.
+    bufs_ = new char[buf_count * buf_size];
+    provide_buffers(0, buf_count);
+
+    int submitted = sys_io_uring_enter(ring_fd_, sq_pending_, 1, IORING_ENTER_GETEVENTS);
+    if (submitted != 1)
+        __TCP_THROW("error io_uring_enter()");
+    sq_pending_ = 0;
+
+    unsigned head = *cq_head_;
+    if (head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE) || cqes_[head & cq_mask_].res < 0)
+        __TCP_THROW("io_uring rejected receive buffers");
+    __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+}
+
+void io_uring_service::teardown()
+{
+    // Closing the ring drops whatever is still in flight.
+    if (ring_fd_ >= 0)
+        ::close(ring_fd_);
+    ring_fd_ = -1;
+
+    if (sqes_)
+        ::munmap(sqes_, sqes_size_);
+    if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+        ::munmap(cq_ring_, cq_ring_size_);
+    if (sq_ring_ != MAP_FAILED)
+        ::munmap(sq_ring_, sq_ring_size_);
+    delete[] bufs_;
+
+    sqes_ = nullptr;
+    sq_ring_ = cq_ring_ = MAP_FAILED;
+    bufs_ = nullptr;
+
+    for (op *o : ops_)
+        delete o;
+    ops_.clear();
+}
+
+void io_uring_service::recycle_buffer(std::uint16_t bid)
+{
+    std::lock_guard<std::mutex> lock(sq_mutex_);
+    provide_buffers(bid, 1);
+    held_bufs_--;
+}
+
+void io_uring_service::provide_buffers(std::uint16_t bid, unsigned num)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = static_cast<std::int32_t>(num);
+    sqe->addr = reinterpret_cast<std::uint64_t>(bufs_ + bid * buf_size);
+    sqe->len = buf_size;
+    sqe->off = bid;
+    sqe->buf_group = buf_group;
+    sqe->user_data = ignored_user_data;
+}
+
+struct io_uring_sqe *io_uring_service::get_sqe()
+{
+    unsigned tail = *sq_tail_;
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+
+    if (tail - head == sq_entries_)
+    {
+        // Full: submit from here rather than waiting for [worker_].
+        int submitted = sys_io_uring_enter(ring_fd_, sq_pending_, 0, 0);
+        if (submitted > 0)
+            sq_pending_ -= submitted;
+
+        head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+        if (tail - head == sq_entries_)
+            __TCP_THROW("io_uring submission queue is full");
+    }
+
+    unsigned idx = tail & sq_mask_;
+    struct io_uring_sqe *sqe = &sqes_[idx];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sq_array_[idx] = idx;
+
+    // [worker_] only submits [sq_pending_] entries, counted under
+    // [sq_mutex_], so publishing the tail before the SQE is filled in
+    // is fine.
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    sq_pending_++;
+    return sqe;
+}
+
+void io_uring_service::rearm_notifier()
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = notifier_.get_read_fd();
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = notifier_user_data;
+}
+
+void io_uring_service::submit_recv(op *o)
+{
+    struct io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = o->conn->fd_;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = buf_group;
+    if (multishot_)
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = reinterpret_cast<std::uint64_t>(o);
+}
+
+std::shared_ptr<io_uring_service::connection>
+io_uring_service::attach(int fd,
+                         const std::function<void()> &on_recv,
+                         const std::function<void(int)> &on_send)
+{
+    return std::make_shared<connection>(this, fd, on_recv, on_send);
+}
+
+void io_uring_service::start_recv(const std::shared_ptr<connection> &c)
+{
+    {
+        std::lock_guard<std::mutex> lock(sq_mutex_);
+
+        if (c->cancelled_)
+            return;
+
+        // Still winding down after a pause, handle_recv() re-arms it.
+        if (c->recv_op_ != nullptr)
+        {
+            c->recv_restart_ = true;
+            return;
+        }
+
+        op *o = new op{op::type::RECV, c};
+        ops_.insert(o);
+        c->recv_op_ = o;
+        submit_recv(o);
+    }
+    notifier_.notify();
+}
+
+void io_uring_service::schedule_recv(const std::shared_ptr<connection> &c)
+{
+    if (c->recv_signals_.fetch_add(1) != 0)
+        return;
+
+    std::shared_ptr<connection> conn = c;
+    workers_.add_task([conn] {
+        for (;;)
+        {
+            int signals = conn->recv_signals_.load();
+            conn->run_guarded(conn->on_recv_);
+            if (conn->recv_signals_.fetch_sub(signals) == signals)
+                break;
+        }
+    });
+}
+
+void io_uring_service::send(const std::shared_ptr<connection> &c, const char *data, std::size_t size)
+{
+    {
+        std::lock_guard<std::mutex> lock(sq_mutex_);
+
+        op *o = new op{op::type::SEND, c};
+        ops_.insert(o);
+        c->send_op_ = o;
+
+        struct io_uring_sqe *sqe = get_sqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = c->fd_;
+        sqe->addr = reinterpret_cast<std::uint64_t>(data);
+        sqe->len = static_cast<std::uint32_t>(size);
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = reinterpret_cast<std::uint64_t>(o);
+    }
+    notifier_.notify();
+}
+
+void io_uring_service::detach(const std::shared_ptr<connection> &c, bool wait)
+{
+    {
+        std::lock_guard<std::mutex> lock(sq_mutex_);
+
+        c->cancelled_ = true;
+        for (void *o : { c->recv_op_, c->send_op_ })
+        {
+            if (o == nullptr)
+                continue;
+
+            struct io_uring_sqe *sqe = get_sqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = reinterpret_cast<std::uint64_t>(o);
+            sqe->user_data = ignored_user_data;
+        }
+    }
+    notifier_.notify();
+
+    c->release_rx();
+    c->detach(wait);
+}
+
+void io_uring_service::run()
+{
+    while (!stop_)
+        if (!submit_and_reap())
+            // TODO: add log.
+            break;
+}
+
+bool io_uring_service::submit_and_reap()
+{
+    unsigned to_submit;
+    {
+        std::lock_guard<std::mutex> lock(sq_mutex_);
+        to_submit = sq_pending_;
+        sq_pending_ = 0;
+    }
+
+    int submitted = sys_io_uring_enter(ring_fd_, to_submit, 1, IORING_ENTER_GETEVENTS);
+    int unsubmitted = submitted < 0 ? to_submit : to_submit - submitted;
+    if (unsubmitted > 0)
+    {
+        std::lock_guard<std::mutex> lock(sq_mutex_);
+        sq_pending_ += unsubmitted;
+    }
+    if (submitted < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        return false;
+
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    while (head != tail)
+    {
+        struct io_uring_cqe *cqe = &cqes_[head & cq_mask_];
+        std::uint64_t user_data = cqe->user_data;
+        int res = cqe->res;
+        std::uint32_t flags = cqe->flags;
+
+        // Free the slot before handling, which may submit.
+        head++;
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+        handle_cqe(user_data, res, flags);
+    }
+    return true;
+}
+
+void io_uring_service::cancel_all()
+{
+    {
+        std::lock_guard<std::mutex> lock(sq_mutex_);
+        if (ops_.empty())
+            return;
+
+        struct io_uring_sqe *sqe = get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY | IORING_ASYNC_CANCEL_ALL;
+        sqe->user_data = ignored_user_data;
+    }
+
+    for (;;)
+    {
+        {
+            std::lock_guard<std::mutex> lock(sq_mutex_);
+            if (ops_.empty())
+                return;
+        }
+        if (!submit_and_reap())
+            return;
+    }
+}
+
+void io_uring_service::handle_cqe(std::uint64_t user_data, int res, std::uint32_t flags)
+{
+    if (user_data == notifier_user_data)
+    {
+        notifier_.clear();
+        std::lock_guard<std::mutex> lock(sq_mutex_);
+        rearm_notifier();
+        return;
+    }
+
+    if (user_data == ignored_user_data)
+        return;
+
+    op *o = reinterpret_cast<op*>(user_data);
+    if (o->t == op::type::RECV)
+    {
+        handle_recv(o, res, flags);
+        return;
+    }
+
+    std::shared_ptr<connection> conn = o->conn;
+    {
+        std::lock_guard<std::mutex> lock(sq_mutex_);
+        release_op(o);
+    }
+
+    workers_.add_task([conn, res] {
+        conn->run_guarded(std::bind(conn->on_send_, res));
+    });
+}
+
+void io_uring_service::handle_recv(op *o, int res, std::uint32_t flags)
+{
+    std::shared_ptr<connection> conn = o->conn;
+    bool more = flags & IORING_CQE_F_MORE;
+    bool rearm = false;
+
+    if (res > 0)
+    {
+        auto bid = static_cast<std::uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+        const char *data = bufs_ + bid * buf_size;
+        bool pause = false;
+        bool hold = false;
+        {
+            std::lock_guard<std::mutex> lock(conn->rx_mutex_);
+
+            // Consumed from where it landed, unless that pins too many
+            // buffers: those go back right away.
+            if (!conn->rx_released_)
+            {
+                if (conn->rx_.empty() && conn->rx_chunks_.size() < max_conn_held_bufs
+                    && held_bufs_ < max_held_bufs)
+                {
+                    conn->rx_chunks_.push_back({ data, static_cast<std::size_t>(res), bid });
+                    held_bufs_++;
+                    hold = true;
+                }
+                else
+                    conn->rx_.insert(conn->rx_.end(), data, data + res);
+                conn->rx_size_ += res;
+            }
+
+            // The owner doesn't keep up, stop until it catches up.
+            if (!conn->rx_paused_ && conn->rx_size_ > max_rx_buffered)
+                conn->rx_paused_ = pause = true;
+        }
+        {
+            // Goes out with the next io_uring_enter, ahead of any
+            // receive re-armed after ENOBUFS.
+            std::lock_guard<std::mutex> lock(sq_mutex_);
+            if (!hold)
+                provide_buffers(bid, 1);
+
+            if (pause && more && !conn->cancelled_)
+            {
+                struct io_uring_sqe *sqe = get_sqe();
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->addr = reinterpret_cast<std::uint64_t>(o);
+                sqe->user_data = ignored_user_data;
+            }
+        }
+        schedule_recv(conn);
+        rearm = true;
+    }
+    else if (res == -ENOBUFS)
+        // Ran out of buffers: they're being handed back, try again.
+        rearm = true;
+    else if (res == -EINVAL && multishot_.exchange(false))
+        // Kernel without multishot receive. Re-arm after each one.
+        rearm = true;
+    else if (res != -ECANCELED)
+    {
+        // EOF or error.
+        {
+            std::lock_guard<std::mutex> lock(conn->rx_mutex_);
+            conn->rx_closed_ = true;
+        }
+        schedule_recv(conn);
+    }
+
+    if (more)
+        return;
+
+    bool paused;
+    {
+        std::lock_guard<std::mutex> lock(conn->rx_mutex_);
+        paused = conn->rx_paused_;
+    }
+
+    std::lock_guard<std::mutex> lock(sq_mutex_);
+    if (((rearm && !paused) || conn->recv_restart_) && !conn->cancelled_)
+    {
+        conn->recv_restart_ = false;
+        submit_recv(o);
+    }
+    else
+        release_op(o);
+}
+
+void io_uring_service::release_op(op *o)
+{
+    if (o->conn->recv_op_ == o)
+        o->conn->recv_op_ = nullptr;
+    if (o->conn->send_op_ == o)
+        o->conn->send_op_ = nullptr;
+
+    ops_.erase(o);
+    delete o;
+}
+
+#else
+
+struct io_uring_service::op {};
+
+io_uring_service::io_uring_service(reactor::callback_pool_t &workers)
+    : workers_(workers)
+{
+    __TCP_THROW("io_uring is not supported on this platform");
+}
+
+io_uring_service::~io_uring_service() {}
+
+std::shared_ptr<io_uring_service::connection>
+io_uring_service::attach(int, const std::function<void()>&, const std::function<void(int)>&) { return nullptr; }
+void io_uring_service::start_recv(const std::shared_ptr<connection>&) {}
+void io_uring_service::schedule_recv(const std::shared_ptr<connection>&) {}
+void io_uring_service::send(const std::shared_ptr<connection>&, const char*, std::size_t) {}
+void io_uring_service::detach(const std::shared_ptr<connection>&, bool) {}
+void io_uring_service::recycle_buffer(std::uint16_t) {}
+
+#endif
+
+} // namespace cdb_tcp_server
@@ -0,0 +1,253 @@
+#ifndef TCP_SERVER_IO_URING_SERVICE_HPP
+#define TCP_SERVER_IO_URING_SERVICE_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "notifier.hpp"
+#include "reactor.hpp"
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace cdb_tcp_server
+{
+
+/// Completion-based I/O for tcp_client, built on io_uring.
+///
+/// One thread owns the ring: it submits whatever SQEs were queued
+/// since its last wakeup, across all connections, in a single
+/// [io_uring_enter] and waits for completions in the same call.
+/// Receives are multishot and pick their buffers from a pool handed
+/// to the kernel up front (IORING_OP_PROVIDE_BUFFERS). A buffer that
+/// received bytes is held until they're consumed, which copies them
+/// straight to the owner, then handed back; past a few per connection,
+/// or half the pool overall, bytes are copied out and the buffer handed
+/// back right away, so that no connection starves the others. Callbacks
+/// run on the reactor's callback workers.
+///
+/// The constructor throws if the kernel doesn't support what's needed
+/// (io_uring itself, provided buffers, RECV/SEND opcodes).
+class io_uring_service
+{
+public:
+    io_uring_service(reactor::callback_pool_t &workers);
+    ~io_uring_service();
+
+    io_uring_service(const io_uring_service&) = delete;
+    io_uring_service& operator=(const io_uring_service&) = delete;
+
+public:
+    /// State of one socket, shared between its owner and the
+    /// operations in flight on it, so that a late completion never
+    /// touches freed memory.
+    class connection : public std::enable_shared_from_this<connection>
+    {
+    public:
+        connection(io_uring_service *service,
+                   int fd,
+                   const std::function<void()> &on_recv,
+                   const std::function<void(int)> &on_send);
+
+        int fd() const { return fd_; }
+
+        /// Move up to [max] received bytes to [out]. Return false if
+        /// nothing is buffered.
+        bool consume(std::size_t max, std::vector<char> &out);
+
+        /// Same as above, into caller-provided memory. Return the number
+        /// of bytes moved, 0 if nothing is buffered.
+        std::size_t consume(std::size_t max, char *out);
+
+        /// True once the peer closed or receiving failed. Bytes that
+        /// arrived before stay available to [consume].
+        bool is_closed();
+
+        /// Whether [consume] or [is_closed] has something to report.
+        bool is_readable();
+
+    private:
+        friend class io_uring_service;
+
+        /// Run [cb] unless the owner has detached. Callbacks of a
+        /// connection never outlive its detach(true).
+        void run_guarded(const std::function<void()> &cb);
+
+        /// Stop callbacks. If [wait] is set, also wait for running
+        /// ones, except the calling thread's own.
+        void detach(bool wait);
+
+        /// Move up to [max] received bytes to [out], handing emptied
+        /// buffers back. Return the number of bytes moved; [resume] is
+        /// set if receiving, paused because too much was buffered,
+        /// should resume.
+        /// NOTE: [rx_mutex_] must be held.
+        std::size_t take_rx(std::size_t max, char *out, bool &resume);
+
+        /// Hand every held buffer back, and those received from now on.
+        void release_rx();
+
+        io_uring_service *service_;
+        int fd_;
+        std::function<void()> on_recv_;
+        std::function<void(int)> on_send_;
+
+        /// A provided buffer held with received bytes.
+        struct rx_chunk {
+            const char *data;
+            std::size_t size;
+            std::uint16_t bid;
+        };
+
+        /// Received bytes not consumed yet, [rx_size_] in all: those in
+        /// held buffers first, then those copied to [rx_], starting at
+        /// [rx_head_]. Buffers are only held while [rx_] is empty.
+        std::mutex rx_mutex_;
+        std::deque<rx_chunk> rx_chunks_;
+        std::vector<char> rx_;
+        std::size_t rx_head_;
+        std::size_t rx_size_;
+        bool rx_closed_;
+
+        /// Set by detach(): nothing is kept from then on.
+        bool rx_released_;
+
+        /// Receiving stopped because the owner doesn't keep up.
+        bool rx_paused_;
+
+        /// Pending on_recv runs. Only the first one schedules a task,
+        /// which loops until it has caught up: on_recv calls of one
+        /// connection never overlap.
+        std::atomic<int> recv_signals_;
+
+        /// Operations to cancel on detach, and whether that happened.
+        /// Guarded by the service's [sq_mutex_].
+        void *recv_op_;
+        void *send_op_;
+        bool cancelled_;
+
+        /// Receiving resumed while the previous receive was still
+        /// winding down: re-arm it instead of releasing it.
+        bool recv_restart_;
+
+        /// Guard state.
+        std::mutex guard_mutex_;
+        std::condition_variable guard_cond_;
+        bool detached_;
+        int running_;
+    };
+
+    /// Track [fd]. [on_recv] runs after bytes arrive or receiving ends,
+    /// [on_send] with the result of each send().
+    std::shared_ptr<connection> attach(int fd,
+                                       const std::function<void()> &on_recv,
+                                       const std::function<void(int)> &on_send);
+
+    /// Start receiving on [c]. A connection with more than
+    /// [max_rx_buffered] bytes unconsumed stops receiving until half of
+    /// them are consumed.
+    void start_recv(const std::shared_ptr<connection> &c);
+
+    /// Run [c]'s on_recv soon, e.g. because a read request was queued
+    /// while bytes were already buffered.
+    void schedule_recv(const std::shared_ptr<connection> &c);
+
+    /// Send [size] bytes at [data], which must stay valid until on_send
+    /// runs. At most one send per connection may be in flight.
+    void send(const std::shared_ptr<connection> &c, const char *data, std::size_t size);
+
+    /// Cancel [c]'s operations and stop its callbacks. See
+    /// connection::detach for [wait].
+    void detach(const std::shared_ptr<connection> &c, bool wait);
+
+    static const std::size_t max_rx_buffered = 1 << 20;
+
+private:
+    struct op;
+
+    /// Map the rings and provide the receive buffers.
+    void setup();
+    void teardown();
+
+    /// Queue an SQE. [sq_mutex_] must be held.
+    struct io_uring_sqe *get_sqe();
+    void submit_recv(op *o);
+
+    /// Completion thread.
+    void run();
+
+    /// One [io_uring_enter]: submit what's pending, wait for at least
+    /// one completion and handle all of them. False on a fatal error.
+    bool submit_and_reap();
+
+    /// Cancel every operation in flight and wait until they're gone.
+    /// Only once [worker_] has exited.
+    void cancel_all();
+    void handle_cqe(std::uint64_t user_data, int res, std::uint32_t flags);
+    void handle_recv(op *o, int res, std::uint32_t flags);
+    void rearm_notifier();
+
+    /// Hand [num] buffers from [bid] on to the kernel.
+    /// NOTE: [sq_mutex_] must be held.
+    void provide_buffers(std::uint16_t bid, unsigned num);
+
+    /// Hand back buffer [bid], held by a connection. It goes out with
+    /// the next io_uring_enter, as those handed back by handle_recv().
+    void recycle_buffer(std::uint16_t bid);
+
+    void release_op(op *o);
+
+private:
+    reactor::callback_pool_t &workers_;
+
+    int ring_fd_;
+
+    /// Mapped rings.
+    void *sq_ring_;
+    void *cq_ring_;
+    std::size_t sq_ring_size_;
+    std::size_t cq_ring_size_;
+    struct io_uring_sqe *sqes_;
+    std::size_t sqes_size_;
+
+    unsigned *sq_head_;
+    unsigned *sq_tail_;
+    unsigned sq_mask_;
+    unsigned sq_entries_;
+    unsigned *sq_array_;
+    unsigned *cq_head_;
+    unsigned *cq_tail_;
+    unsigned cq_mask_;
+    struct io_uring_cqe *cqes_;
+
+    /// Receive buffers, and how many connections hold.
+    char *bufs_;
+    std::atomic<unsigned> held_bufs_;
+
+    /// Whether the kernel accepts multishot receive. Cleared the first
+    /// time it rejects one, receives are then re-armed one by one.
+    std::atomic<bool> multishot_;
+
+    /// SQ producer side, and ops in flight.
+    std::mutex sq_mutex_;
+    unsigned sq_pending_;
+    std::unordered_set<op*> ops_;
+
+    /// Wakes [worker_] up when SQEs are queued.
+    notifier notifier_;
+
+    std::atomic<bool> stop_;
+    std::thread worker_;
+};
+
+} // namespace cdb_tcp_server
+
+
+#endif
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#include "tcp_server.hpp"
+
+using cdb_tcp_server::tcp_server;
+using cdb_tcp_server::tcp_client;
+
+/// Round-trip latency of a streaming echo connection, with the reactor
+/// blocking in the poll syscall and with busy polling. A single blocking
+/// client sends one request at a time, so that every request finds the
+/// server idle: blocking mode pays for the wakeups each time, busy-poll
+/// mode only while it has been idle for longer than the spin.
+///
+/// The polling thread, the callback worker and the client are pinned to
+/// cores 0, 1 and 2 when there are enough of them. With fewer cores the
+/// spinning threads compete with the client and busy polling loses.
+///
+/// Usage: latency_bench [requests] [spin microseconds]
+
+static const std::uint32_t bench_port = 3003;
+static const char request[] = "ping\n";
+static const std::size_t request_size = sizeof(request) - 1;
+
+/// Echo every complete line back.
+static void echo(tcp_client *client, tcp_client::buffered_read_result &result)
+{
+    if (!result.success)
+        return;
+
+    auto &buffer = result.buffer;
+    while (const void *eol = std::memchr(buffer.data(), '\n', buffer.size()))
+    {
+        std::size_t n = static_cast<const char*>(eol) - buffer.data() + 1;
+        client->async_write({ std::vector<char>(buffer.data(), buffer.data() + n), nullptr });
+        buffer.consume(n);
+    }
+}
+
+static void round_trip(int fd)
+{
+    if (::send(fd, request, request_size, 0) != static_cast<ssize_t>(request_size))
+    {
+        std::perror("send");
+        std::exit(2);
+    }
+
+    char response[request_size];
+    std::size_t received = 0;
+    while (received < request_size)
+    {
+        ssize_t n = ::recv(fd, response + received, request_size - received, 0);
+        if (n <= 0)
+        {
+            std::perror("recv");
+            std::exit(2);
+        }
+        received += n;
+    }
+}
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    std::size_t idx = static_cast<std::size_t>(p * (sorted.size() - 1));
+    return sorted[idx];
+}
+
+static void run(const char *name, std::size_t requests, std::chrono::microseconds spin, bool pin)
+{
+    tcp_server server{1, 1};
+    if (pin)
+        server.set_cpu_affinity({0}, {1});
+    server.set_busy_poll(spin);
+    server.start("127.0.0.1", bench_port, [](std::shared_ptr<tcp_client> client) {
+        // Raw pointer: the server keeps the client alive.
+        tcp_client *c = client.get();
+        client->start_reading([c](tcp_client::buffered_read_result &result) { echo(c, result); });
+    });
+
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int nodelay = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(bench_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0)
+    {
+        std::perror("connect");
+        std::exit(2);
+    }
+
+    for (int i = 0; i < 1000; i++)
+        round_trip(fd);
+
+    std::vector<double> latencies;
+    latencies.reserve(requests);
+    for (std::size_t i = 0; i < requests; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        round_trip(fd);
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        latencies.push_back(elapsed.count());
+    }
+
+    ::close(fd);
+    server.stop();
+
+    std::sort(latencies.begin(), latencies.end());
+    std::printf("%-10s  p50 %8.2f us  p99 %8.2f us  p99.9 %8.2f us\n", name,
+                percentile(latencies, 0.50), percentile(latencies, 0.99), percentile(latencies, 0.999));
+}
+
+int main(int argc, char **argv)
+{
+    std::size_t requests = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    std::chrono::microseconds spin{argc > 2 ? std::strtol(argv[2], nullptr, 10) : 50};
+
+    bool pin = std::thread::hardware_concurrency() >= 3;
+#ifdef __linux__
+    if (pin)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(2, &set);
+        ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+    }
+#endif
+    if (!pin)
+        std::printf("fewer than 3 cores: threads are not pinned\n");
+
+    run("blocking", requests, std::chrono::microseconds{0}, pin);
+    run("busy-poll", requests, spin, pin);
+    return 0;
+}
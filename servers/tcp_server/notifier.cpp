@@ -0,0 +1,65 @@
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+#include <cstdint>
+#include "exceptions.hpp"
+#include "notifier.hpp"
+
+namespace cdb_tcp_server {
+
+notifier::notifier()
+    : pending_(false)
+{
+#ifdef __linux__
+    event_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (event_fd_ == -1)
+        __TCP_THROW("error eventfd()");
+#endif
+}
+
+notifier::~notifier()
+{
+#ifdef __linux__
+    ::close(event_fd_);
+#endif
+}
+
+int notifier::get_read_fd() const
+{
+#ifdef __linux__
+    return event_fd_;
+#else
+    return pipe_.get_read_fd();
+#endif
+}
+
+void notifier::notify()
+{
+    // Someone already notified and the woken thread hasn't looked yet.
+    if (pending_.exchange(true))
+        return;
+
+#ifdef __linux__
+    std::uint64_t one = 1;
+    (void)::write(event_fd_, &one, sizeof(one));
+#else
+    pipe_.notify();
+#endif
+}
+
+void notifier::clear()
+{
+    // Reset the flag first: a notify() racing with us then writes
+    // again rather than being lost.
+    pending_ = false;
+
+#ifdef __linux__
+    std::uint64_t count;
+    (void)::read(event_fd_, &count, sizeof(count));
+#else
+    pipe_.clear_pipe();
+#endif
+}
+
+}   // namespace cdb_tcp_server
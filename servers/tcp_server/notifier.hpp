@@ -0,0 +1,43 @@
+#ifndef TCP_SERVER_NOTIFIER_HPP
+#define TCP_SERVER_NOTIFIER_HPP
+
+#include <atomic>
+#include "pipe.hpp"
+
+namespace cdb_tcp_server {
+
+/// Wakes up a thread blocked in a multiplexing I/O syscall. Backed by
+/// an eventfd on Linux and by a pipe elsewhere. Notifications sent
+/// before the previous one has been cleared are merged into it, so a
+/// burst of notify() costs a single syscall.
+class notifier {
+public:
+    notifier();
+    ~notifier();
+
+    notifier(const notifier &) = delete;
+    notifier& operator=(const notifier&) = delete;
+
+    /// fd to poll for readability.
+    int get_read_fd() const;
+
+    void notify();
+
+    /// Called by the woken thread before it looks at the state it was
+    /// notified about.
+    void clear();
+
+private:
+    /// True between notify() and clear().
+    std::atomic<bool> pending_;
+
+#ifdef __linux__
+    int event_fd_;
+#else
+    pipe pipe_;
+#endif
+};
+
+}   // namespace cdb_tcp_server
+
+#endif
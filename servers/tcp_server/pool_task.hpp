@@ -0,0 +1,56 @@
+#ifndef TCP_SERVER_POOL_TASK_HPP
+#define TCP_SERVER_POOL_TASK_HPP
+
+#include <atomic>
+#include "inline_function.hpp"
+
+namespace cdb_tcp_server
+{
+
+/// Intrusive unit of work for the callback pools and strands. Whoever
+/// posts one owns it and keeps it alive until it has run, so posting
+/// doesn't allocate: the reactor, for instance, embeds one per fd and
+/// direction, and never has two of them in flight.
+class pool_task {
+public:
+    pool_task() : next(nullptr) {}
+    virtual ~pool_task() {}
+
+    /// Run by a worker. May delete the task.
+    virtual void run() = 0;
+
+    /// Called instead of run() when the pool stops first.
+    virtual void discard() {}
+
+    /// Link used by the strand's queue.
+    std::atomic<pool_task*> next;
+};
+
+/// Task wrapping a callable, for work that has no task of its own to
+/// post. Deletes itself once run or discarded.
+class function_task : public pool_task {
+public:
+    typedef inline_function<void()> fn_t;
+
+    function_task(const fn_t &fn) : fn_(fn) {}
+
+    void run() override
+    {
+        // Deleted even if [fn_] throws.
+        struct deleter {
+            function_task *task;
+            ~deleter() { delete task; }
+        } d{this};
+        fn_();
+    }
+
+    void discard() override { delete this; }
+
+private:
+    fn_t fn_;
+};
+
+} // namespace cdb_tcp_server
+
+
+#endif
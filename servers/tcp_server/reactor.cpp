@@ -1,4 +1,10 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <exception>
 #include <sys/select.h>
+#include "exceptions.hpp"
+#include "io_uring_service.hpp"
 #include "reactor.hpp"
 
 namespace cdb_tcp_server
@@ -13,10 +19,57 @@ reactor *get_default_reactor()
     return default_reactor.get();
 }
 
-reactor::reactor(std::size_t thread_num)
-    : callback_workers_(thread_num)
+const std::chrono::milliseconds reactor::timer_tick{1};
+
+/// Initial size of the buffer handed to [epoll_wait]. It doubles each
+/// time a wakeup fills it up.
+static const std::size_t initial_epoll_events = 64;
+
+reactor::backend reactor::default_backend()
+{
+#ifdef __linux__
+    return backend::EPOLL;
+#else
+    return backend::SELECT;
+#endif
+}
+
+reactor::reactor(std::size_t thread_num, backend b)
+    : backend_(b)
+    , tracked_num_(0)
+    , max_fd_(-1)
+    , callback_workers_(thread_num)
+    , start_time_(std::chrono::steady_clock::now())
+    , poll_deadline_(UINT64_MAX)
     , poll_stop_(false)
+    , busy_poll_(0)
 {
+    for (auto &chunk : tracked_fds_)
+        chunk = nullptr;
+
+    if (backend_ == backend::EPOLL)
+    {
+#ifdef __linux__
+        epoll_fd_ = ::epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd_ == -1)
+            __TCP_THROW("error epoll_create1()");
+
+        // The notifier stays armed for the reactor's whole lifetime.
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.fd = notifier_.get_read_fd();
+        if (::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, notifier_.get_read_fd(), &ev) == -1)
+        {
+            ::close(epoll_fd_);
+            __TCP_THROW("error epoll_ctl()");
+        }
+
+        epoll_events_.resize(initial_epoll_events);
+#else
+        __TCP_THROW("epoll is not supported on this platform");
+#endif
+    }
+
     poll_worker_ = std::thread(std::bind(&reactor::poll, this));
 }
 
@@ -24,8 +77,23 @@ reactor::~reactor()
 {
     poll_stop_ = true;
 
+    // Force [poll_worker_] to wakeup.
+    notifier_.notify();
     if (poll_worker_.joinable())
         poll_worker_.join();
+
+    // Its completions are handed to [callback_workers_].
+    io_uring_.reset();
+
+    // Callbacks hold pointers into [tracked_fds_].
+    callback_workers_.stop();
+    for (auto &chunk : tracked_fds_)
+        delete[] chunk.load();
+
+#ifdef __linux__
+    if (backend_ == backend::EPOLL)
+        ::close(epoll_fd_);
+#endif
 }
 
 void reactor::stop()
@@ -41,23 +109,178 @@ void reactor::stop()
     callback_workers_.stop();
 }
 
-void reactor::register_fd(int fd,
-                          const event_handler_t &rd_callback,
-                          const event_handler_t &wr_callback)
+std::uint64_t reactor::current_tick() const
+{
+    return (std::chrono::steady_clock::now() - start_time_) / timer_tick;
+}
+
+reactor::timer_id reactor::schedule_timer(std::chrono::milliseconds delay, const timer_callback_t &cb)
+{
+    timer_id id;
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(timer_mutex_);
+
+        // The wheel only moves forward when [poll_worker_] wakes up,
+        // count from the actual time.
+        std::uint64_t now = current_tick();
+        std::uint64_t ticks = delay.count() <= 0 ? 1 : (delay + timer_tick - std::chrono::milliseconds{1}) / timer_tick;
+        std::uint64_t behind = now > timers_.now() ? now - timers_.now() : 0;
+        id = timers_.schedule(behind + ticks, cb);
+
+        // [poll_worker_] would sleep past it.
+        if (now + ticks < poll_deadline_)
+        {
+            poll_deadline_ = now + ticks;
+            wake = true;
+        }
+    }
+
+    if (wake)
+        notifier_.notify();
+    return id;
+}
+
+bool reactor::cancel_timer(timer_id id)
+{
+    std::lock_guard<std::mutex> lock(timer_mutex_);
+    return timers_.cancel(id);
+}
+
+int reactor::run_timers(bool spinning)
+{
+    std::int64_t timeout;
+    {
+        std::lock_guard<std::mutex> lock(timer_mutex_);
+
+        timers_.advance(current_tick(), expired_timers_);
+        timeout = timers_.next_timeout();
+        // A spinning [poll_worker_] comes back here right away; new
+        // timers don't need to wake it.
+        if (spinning)
+            poll_deadline_ = 0;
+        else
+            poll_deadline_ = timeout < 0 ? UINT64_MAX : timers_.now() + timeout;
+    }
+
+    for (auto &cb : expired_timers_)
+        callback_workers_.add_task(cb);
+    expired_timers_.clear();
+
+    if (timeout < 0)
+        return -1;
+    return static_cast<int>(std::min<std::int64_t>(timeout * timer_tick.count(), INT32_MAX));
+}
+
+bool reactor::enable_io_uring()
+{
+    if (io_uring_)
+        return true;
+
+    try {
+        io_uring_.reset(new io_uring_service(callback_workers_));
+    } catch (const std::runtime_error &) {
+        // Kernel too old, or io_uring disabled.
+        return false;
+    }
+    return true;
+}
+
+reactor::fd_info *reactor::find_fd_info(int fd, bool create)
+{
+    if (fd < 0 || static_cast<std::size_t>(fd) >= fd_chunk_size * fd_chunk_num)
+        return nullptr;
+
+    auto &slot = tracked_fds_[fd / fd_chunk_size];
+    fd_info *chunk = slot.load(std::memory_order_acquire);
+    if (chunk == nullptr)
+    {
+        if (!create)
+            return nullptr;
+
+        // Another thread may be allocating the same chunk. Whoever
+        // loses the race frees its copy and uses the winner's.
+        fd_info *fresh = new fd_info[fd_chunk_size];
+        if (slot.compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel))
+            chunk = fresh;
+        else
+            delete[] fresh;
+    }
+
+    return &chunk[fd % fd_chunk_size];
+}
+
+void reactor::track_fd(int fd, fd_info &info)
 {
-    std::lock_guard<std::mutex> lock(tracked_fds_mutex_);
+    if (info.is_tracked.exchange(true))
+        return;
+
+    tracked_num_.fetch_add(1);
 
-    auto &info = tracked_fds_[fd];
-    info.rd_callback = rd_callback;
-    info.wr_callback = wr_callback;
+    int max_fd = max_fd_.load();
+    while (fd > max_fd && !max_fd_.compare_exchange_weak(max_fd, fd))
+        ;
+}
+
+void reactor::untrack_fd(int fd, fd_info &info)
+{
+#ifdef __linux__
+    // [fd] may already be closed, in which case the kernel has
+    // dropped it from the set by itself.
+    if (info.in_epoll_set)
+        (void)::epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, fd, NULL);
+#else
+    (void)fd;
+#endif
+    info.in_epoll_set = false;
+    info.armed_events = 0;
+
+    info.rd_callback = nullptr;
+    info.wr_callback = nullptr;
+    info.strand = nullptr;
     info.marked_untrack = false;
+    info.is_tracked = false;
+    tracked_num_.fetch_sub(1);
 
-    notifier_.notify();
+    // Taking the lock orders us with a waiter that has just checked
+    // [is_tracked] and is about to sleep.
+    {
+        std::lock_guard<std::mutex> lock(removal_mutex_);
+    }
+    removal_cond.notify_all();
+}
+
+void reactor::register_fd(int fd,
+                          const event_handler_t &rd_callback,
+                          const event_handler_t &wr_callback)
+{
+    fd_info *info = find_fd_info(fd, true);
+    if (info == nullptr)
+        __TCP_THROW("fd out of the reactor's range");
+
+    std::lock_guard<std::mutex> lock(info->mutex);
+
+    info->rd_callback = rd_callback;
+    info->wr_callback = wr_callback;
+    info->marked_untrack = false;
+    // If [fd] was closed while its slot waited to be untracked, the
+    // kernel has dropped it from the set: what's recorded is about the
+    // file the number stood for before.
+    info->in_epoll_set = false;
+    info->armed_events = 0;
+    track_fd(fd, *info);
+
+    if (!update_interest(fd, *info))
+    {
+        untrack_fd(fd, *info);
+        __TCP_THROW("failed to poll fd");
+    }
+    wake_up();
 }
 
 std::size_t reactor::register_num()
 {
-    return tracked_fds_.size();
+    return tracked_num_;
 }
 
 void reactor::set_thread_num(std::size_t thread_num)
@@ -65,73 +288,168 @@ void reactor::set_thread_num(std::size_t thread_num)
     callback_workers_.set_thread_num(thread_num);
 }
 
+void reactor::set_cpu_affinity(int cpu)
+{
+    set_cpu_affinity(cpu, cpu);
+}
+
+void reactor::set_cpu_affinity(int poll_cpu, int worker_cpu)
+{
+    if (poll_cpu >= 0)
+        set_thread_affinity(poll_worker_, poll_cpu);
+    if (worker_cpu >= 0)
+        callback_workers_.set_cpu_affinity(worker_cpu);
+}
+
+void reactor::set_busy_poll(std::chrono::microseconds spin)
+{
+    busy_poll_ = spin.count() > 0 ? spin.count() : 0;
+    callback_workers_.set_spin(spin);
+}
+
+bool reactor::busy_polling(std::chrono::steady_clock::time_point last_event) const
+{
+    std::int64_t spin = busy_poll_.load(std::memory_order_relaxed);
+    return spin > 0
+        && std::chrono::steady_clock::now() - last_event < std::chrono::microseconds(spin);
+}
+
+void reactor::set_strand(int fd, const std::shared_ptr<strand> &s)
+{
+    fd_info *info = find_fd_info(fd, true);
+    if (info == nullptr)
+        __TCP_THROW("fd out of the reactor's range");
+
+    std::lock_guard<std::mutex> lock(info->mutex);
+    info->strand = s;
+}
+
+void reactor::post(const callback_pool_t::task_t &task)
+{
+    callback_workers_.add_task(task);
+}
+
+void reactor::post(pool_task *task)
+{
+    callback_workers_.add_task(task);
+}
+
 void reactor::set_rd_callback(int fd, const event_handler_t &cb)
 {
-    std::lock_guard<std::mutex> lock(tracked_fds_mutex_);
+    // The socket has been closed already. Nothing to update.
+    if (fd < 0)
+        return;
+
+    fd_info *info = find_fd_info(fd, true);
+    if (info == nullptr)
+        __TCP_THROW("fd out of the reactor's range");
+
+    std::lock_guard<std::mutex> lock(info->mutex);
 
-    auto &info = tracked_fds_[fd];
-    info.rd_callback = cb;
+    info->rd_callback = cb;
+    track_fd(fd, *info);
 
+    rearm(fd, *info);
     // Force poll_worker_ to wake up.
-    notifier_.notify();
+    wake_up();
 }
 
 void reactor::set_wr_callback(int fd, const event_handler_t &cb)
 {
-    std::lock_guard<std::mutex> lock(tracked_fds_mutex_);
+    // The socket has been closed already. Nothing to update.
+    if (fd < 0)
+        return;
 
-    auto &info = tracked_fds_[fd];
-    info.wr_callback = cb;
+    fd_info *info = find_fd_info(fd, true);
+    if (info == nullptr)
+        __TCP_THROW("fd out of the reactor's range");
 
-    notifier_.notify();
+    std::lock_guard<std::mutex> lock(info->mutex);
+
+    info->wr_callback = cb;
+    track_fd(fd, *info);
+
+    rearm(fd, *info);
+    wake_up();
 }
 
 void reactor::unregister(int fd)
 {
-    std::lock_guard<std::mutex> lock(tracked_fds_mutex_);
+    fd_info *info = find_fd_info(fd, false);
+    if (info == nullptr)
+        return;
+
+    std::lock_guard<std::mutex> lock(info->mutex);
 
     // In case this is called multiple times.
-    if (!tracked_fds_.count(fd))
+    if (!info->is_tracked)
         return;
 
-    auto &info = tracked_fds_[fd];
-    if (info.is_executing_rd_cb || info.is_executing_wr_cb)
+    if (info->is_executing_rd_cb || info->is_executing_wr_cb)
     {
-        // Let the callback worker erase it.
-        info.marked_untrack = true;
+        // Let the callback worker erase it. Stop polling [fd]
+        // right away since it's about to be closed.
+        info->marked_untrack = true;
+        update_interest(fd, *info);
     }
     else
     {
         // Remove it immediately.
-        auto it = tracked_fds_.find(fd);
-        tracked_fds_.erase(it);
-        removal_cond.notify_all();
+        untrack_fd(fd, *info);
     }
 
-    notifier_.notify();
+    wake_up();
 }
 
 void reactor::wait_on_removal_cond(int fd)
 {
-    std::unique_lock<std::mutex> lock(tracked_fds_mutex_);
+    fd_info *info = find_fd_info(fd, false);
+    if (info == nullptr)
+        return;
+
+    std::unique_lock<std::mutex> lock(removal_mutex_);
 
     // Wait until [fd] and its associative info is erased.
     removal_cond.wait(lock, [&] {
-        return this->tracked_fds_.find(fd) == this->tracked_fds_.end();
+        return !info->is_tracked;
     });
 }
 
-/// TODO: Add epoll for linux.
 void reactor::poll()
 {
+    if (backend_ == backend::EPOLL)
+        poll_epoll();
+    else
+        poll_select();
+}
+
+void reactor::poll_select()
+{
+    auto last_event = std::chrono::steady_clock::now();
     while (!poll_stop_)
     {
+        bool spinning = busy_polling(last_event);
+        int timeout = run_timers(spinning);
+        if (spinning)
+            timeout = 0;
         int nfds = init_select_fds();
-        int ret = ::select(nfds, &rd_set_, &wr_set_, NULL, NULL);
+
+        struct timeval tv;
+        tv.tv_sec = timeout / 1000;
+        tv.tv_usec = (timeout % 1000) * 1000;
+        int ret = ::select(nfds, &rd_set_, &wr_set_, NULL, timeout < 0 ? NULL : &tv);
         if (ret > 0)
+        {
             dispatch();
-        else if (errno == EINTR)
+            if (busy_poll_.load(std::memory_order_relaxed))
+                last_event = std::chrono::steady_clock::now();
+        }
+        else if (ret == 0 || errno == EINTR)
+        {
+            if (spinning)
+                cpu_relax();
             continue;
+        }
         else
         {
             // TODO: add log.
@@ -139,10 +457,116 @@ void reactor::poll()
     }
 }
 
-int reactor::init_select_fds()
+void reactor::poll_epoll()
+{
+#ifdef __linux__
+    auto last_event = std::chrono::steady_clock::now();
+    while (!poll_stop_)
+    {
+        bool spinning = busy_polling(last_event);
+        int timeout = run_timers(spinning);
+        int ret = ::epoll_wait(epoll_fd_, epoll_events_.data(), epoll_events_.size(), spinning ? 0 : timeout);
+        if (ret > 0)
+        {
+            dispatch_epoll(ret);
+            if (busy_poll_.load(std::memory_order_relaxed))
+                last_event = std::chrono::steady_clock::now();
+        }
+        else if (ret == 0 || errno == EINTR)
+        {
+            if (spinning)
+                cpu_relax();
+            continue;
+        }
+        else
+        {
+            // TODO: add log.
+        }
+    }
+#endif
+}
+
+void reactor::wake_up()
+{
+    // epoll_ctl() takes effect even while [poll_worker_] is
+    // blocked in epoll_wait(), so only select needs the nudge.
+    if (backend_ == backend::SELECT)
+        notifier_.notify();
+}
+
+bool reactor::update_interest(int fd, fd_info &info)
+{
+#ifdef __linux__
+    if (backend_ != backend::EPOLL)
+        return true;
+
+    std::uint32_t events = 0;
+    if (!info.marked_untrack)
+    {
+        if (info.rd_callback && !info.is_executing_rd_cb)
+            events |= EPOLLIN;
+        if (info.wr_callback && !info.is_executing_wr_cb)
+            events |= EPOLLOUT;
+    }
+
+    if (info.in_epoll_set && events == info.armed_events)
+        return true;
+
+    // Events are armed one-shot: the kernel disarms [fd] once it
+    // reports it, which is what we want while its callback runs.
+    struct epoll_event ev;
+    ev.events = events | EPOLLONESHOT;
+    ev.data.fd = fd;
+    int op = info.in_epoll_set ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    int ret = ::epoll_ctl(epoll_fd_, op, fd, &ev);
+    // Closed and dropped from the set since, or still in it.
+    if (ret == -1 && op == EPOLL_CTL_MOD && errno == ENOENT)
+        ret = ::epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &ev);
+    else if (ret == -1 && op == EPOLL_CTL_ADD && errno == EEXIST)
+        ret = ::epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, fd, &ev);
+
+    if (ret == -1)
+    {
+        info.in_epoll_set = false;
+        info.armed_events = 0;
+        return false;
+    }
+
+    info.in_epoll_set = true;
+    info.armed_events = events;
+#else
+    (void)fd;
+    (void)info;
+#endif
+    return true;
+}
+
+void reactor::rearm(int fd, fd_info &info)
 {
-    std::lock_guard<std::mutex> lock(tracked_fds_mutex_);
+    if (update_interest(fd, info))
+        return;
+
+    // TODO: add log.
+    if (info.marked_untrack)
+        return;
 
+    // Never reported from now on. Like select would mark a bad fd
+    // ready, run its callbacks a last time: reading or writing it
+    // fails, and disconnects its owner. It's untracked once they're
+    // done, even if they didn't, rather than run again.
+    info.marked_untrack = true;
+    bool run_rd = info.rd_callback && !info.is_executing_rd_cb;
+    bool run_wr = info.wr_callback && !info.is_executing_wr_cb;
+    if (run_rd)
+        dispatch_read(fd, info);
+    if (run_wr)
+        dispatch_write(fd, info);
+    if (!info.is_executing_rd_cb && !info.is_executing_wr_cb)
+        untrack_fd(fd, info);
+}
+
+int reactor::init_select_fds()
+{
     // Clear previous status.
     polled_fds_.clear();
     FD_ZERO(&rd_set_);
@@ -154,20 +578,24 @@ int reactor::init_select_fds()
     polled_fds_.push_back(notifier_.get_read_fd());
 
     // process all tracked fds.
-    for (const auto &p : tracked_fds_)
+    int max_fd = max_fd_;
+    for (int fd = 0; fd <= max_fd; fd++)
     {
-        const auto &fd = p.first;
-        const auto &info = p.second;
+        fd_info *info = find_fd_info(fd, false);
+        if (info == nullptr || !info->is_tracked)
+            continue;
+
+        std::lock_guard<std::mutex> lock(info->mutex);
 
-        bool exec_rd = info.rd_callback && !info.is_executing_rd_cb;
+        bool exec_rd = info->rd_callback && !info->is_executing_rd_cb;
         if (exec_rd)
             FD_SET(fd, &rd_set_);
 
-        bool exec_wr = info.wr_callback && !info.is_executing_wr_cb;
+        bool exec_wr = info->wr_callback && !info->is_executing_wr_cb;
         if (exec_wr)
             FD_SET(fd, &wr_set_);
 
-        if (exec_rd || exec_wr || info.marked_untrack)
+        if (exec_rd || exec_wr || info->marked_untrack)
             polled_fds_.push_back(fd);
 
         nfds = (exec_rd || exec_wr) ? std::max(nfds, fd) : nfds;
@@ -183,105 +611,164 @@ void reactor::dispatch()
 
 void reactor::dispatch_select()
 {
-    std::lock_guard<std::mutex> lock(tracked_fds_mutex_);
-
     for (int fd : polled_fds_)
     {
         // Ignore notifier.
         if (fd == notifier_.get_read_fd() && FD_ISSET(fd, &rd_set_))
         {
-            notifier_.clear_pipe();
+            notifier_.clear();
             continue;
         }
 
-        auto it = tracked_fds_.find(fd);
-        if (it == tracked_fds_.end())
+        fd_info *info = find_fd_info(fd, false);
+        if (info == nullptr)
             continue;
 
-        auto &info = it->second;
-        if (FD_ISSET(fd, &rd_set_) && info.rd_callback && !info.is_executing_rd_cb)
-            dispatch_read(fd);
-        
-        if (FD_ISSET(fd, &wr_set_) && info.wr_callback && !info.is_executing_wr_cb)
-            dispatch_write(fd);
+        std::lock_guard<std::mutex> lock(info->mutex);
+        if (!info->is_tracked)
+            continue;
 
-        if (info.marked_untrack && !info.is_executing_rd_cb && !info.is_executing_wr_cb)
-        {
-            tracked_fds_.erase(it);
-            removal_cond.notify_all();
-        }
+        if (FD_ISSET(fd, &rd_set_) && info->rd_callback && !info->is_executing_rd_cb)
+            dispatch_read(fd, *info);
+
+        if (FD_ISSET(fd, &wr_set_) && info->wr_callback && !info->is_executing_wr_cb)
+            dispatch_write(fd, *info);
+
+        if (info->marked_untrack && !info->is_executing_rd_cb && !info->is_executing_wr_cb)
+            untrack_fd(fd, *info);
     }
 }
 
-void reactor::dispatch_read(int fd)
+void reactor::dispatch_epoll(int nevents)
 {
-    if (!tracked_fds_.count(fd))
-        return;
+#ifdef __linux__
+    for (int i = 0; i < nevents; i++)
+    {
+        const auto &ev = epoll_events_[i];
+        int fd = ev.data.fd;
+
+        if (fd == notifier_.get_read_fd())
+        {
+            notifier_.clear();
+            continue;
+        }
+
+        fd_info *info = find_fd_info(fd, false);
+        if (info == nullptr)
+            continue;
+
+        std::lock_guard<std::mutex> lock(info->mutex);
+        if (!info->is_tracked)
+            continue;
+
+        // The one-shot event has disarmed [fd].
+        info->armed_events = 0;
 
-    auto &info = tracked_fds_[fd];
+        // Errors and hangups are reported to whichever side is
+        // polling, just like select would mark them ready.
+        bool rd_ready = ev.events & (EPOLLIN | EPOLLHUP | EPOLLERR);
+        bool wr_ready = ev.events & (EPOLLOUT | EPOLLHUP | EPOLLERR);
 
+        if (rd_ready && info->rd_callback && !info->is_executing_rd_cb)
+            dispatch_read(fd, *info);
+
+        if (wr_ready && info->wr_callback && !info->is_executing_wr_cb)
+            dispatch_write(fd, *info);
+
+        // Re-arm whatever is still wanted.
+        rearm(fd, *info);
+    }
+
+    // Make room for more events next time if we were cut short.
+    if (static_cast<std::size_t>(nevents) == epoll_events_.size())
+        epoll_events_.resize(epoll_events_.size() * 2);
+#else
+    (void)nevents;
+#endif
+}
+
+void reactor::dispatch_read(int fd, fd_info &info)
+{
     // Update info.
-    auto rd_callback = info.rd_callback;
+    info.rd_task.handler = info.rd_callback;
     info.is_executing_rd_cb = true;
+    dispatch_task(info.rd_task, fd, info, true);
+}
+
+void reactor::dispatch_write(int fd, fd_info &info)
+{
+    info.wr_task.handler = info.wr_callback;
+    info.is_executing_wr_cb = true;
+    dispatch_task(info.wr_task, fd, info, false);
+}
+
+void reactor::dispatch_task(callback_task &task, int fd, fd_info &info, bool is_read)
+{
+    task.owner = this;
+    task.info = &info;
+    task.fd = fd;
+    task.is_read = is_read;
 
     // Call the user provided callback.
-    callback_workers_.add_task([=] {
-        rd_callback(fd);
-
-        // Update info associated with this fd.
-        std::lock_guard<std::mutex> lock(this->tracked_fds_mutex_);
-        auto it = this->tracked_fds_.find(fd);
-        if (it == this->tracked_fds_.end())
-            // Nothing to do.
-            return;
-
-        auto &info = it->second;
-        info.is_executing_rd_cb = false;
-        // Clear it if [fd] is called with [unregister_fd].
-        if (info.marked_untrack && !info.is_executing_wr_cb)
-        {
-            // Erase the info with this fd.
-            this->tracked_fds_.erase(it);
-            // Wake the thread that blocks on [wait_on_removal_cond].
-            this->removal_cond.notify_all();
-        }
+    if (info.strand)
+        info.strand->post(&task);
+    else
+        callback_workers_.add_task(&task);
+}
 
-        // Wake poll_worker_
-        this->notifier_.notify();
-    });
+void reactor::callback_task::run()
+{
+    // Whatever the handler does, [fd] must be re-armed below, or it is
+    // never polled again.
+    try {
+        handler(fd);
+    } catch (const std::exception& e) {
+        // TODO: add log.
+    }
+    // Not needed anymore. The next dispatch can't happen before the
+    // report below.
+    handler = nullptr;
+
+    if (is_read)
+        owner->on_rd_callback_done(fd, *info);
+    else
+        owner->on_wr_callback_done(fd, *info);
 }
 
-void reactor::dispatch_write(int fd)
+void reactor::on_rd_callback_done(int fd, fd_info &info)
 {
-    if (!tracked_fds_.count(fd))
+    // Update info associated with this fd.
+    std::lock_guard<std::mutex> lock(info.mutex);
+    info.is_executing_rd_cb = false;
+    if (!info.is_tracked)
+        // Nothing to do.
         return;
 
-    auto &info = tracked_fds_[fd];
+    // Clear it if [fd] is called with [unregister_fd].
+    if (info.marked_untrack && !info.is_executing_wr_cb)
+        // Wakes the thread that blocks on [wait_on_removal_cond].
+        untrack_fd(fd, info);
+    else
+        rearm(fd, info);
 
-    auto wr_callback = info.wr_callback;
-    info.is_executing_wr_cb = true;
+    // Wake poll_worker_
+    wake_up();
+}
 
-    // Call the user provided callback.
-    callback_workers_.add_task([=] {
-        wr_callback(fd);
-
-        // Update info associated with this fd.
-        std::lock_guard<std::mutex> lock(this->tracked_fds_mutex_);
-        auto it = this->tracked_fds_.find(fd);
-        if (it == this->tracked_fds_.end())
-            return;
-
-        auto &info = it->second;
-        info.is_executing_wr_cb = false;
-        if (info.marked_untrack && !info.is_executing_rd_cb)
-        {
-            this->tracked_fds_.erase(it);
-            this->removal_cond.notify_all();
-        }
+void reactor::on_wr_callback_done(int fd, fd_info &info)
+{
+    std::lock_guard<std::mutex> lock(info.mutex);
+    info.is_executing_wr_cb = false;
+    if (!info.is_tracked)
+        return;
 
-        // Wake poll_worker_
-        this->notifier_.notify();
-    });
+    if (info.marked_untrack && !info.is_executing_rd_cb)
+        untrack_fd(fd, info);
+    else
+        rearm(fd, info);
+
+    // Wake poll_worker_
+    wake_up();
 }
 
 } // namespace cdb_tcp_server
@@ -1,17 +1,27 @@
 #ifndef TCP_SERVER_REACTOR_HPP
 #define TCP_SERVER_REACTOR_HPP
 
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <functional>
-#include <unordered_map>
+#include <memory>
 #include <vector>
+#include <sys/select.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 #include "thread_pool.hpp"
-#include "pipe.hpp"
+#include "work_stealing_pool.hpp"
+#include "notifier.hpp"
+#include "strand.hpp"
+#include "timer_wheel.hpp"
 
 namespace cdb_tcp_server {
 
 /// Forward declaration.
 class reactor;
+class io_uring_service;
 
 /// Singleton.
 reactor *get_default_reactor();
@@ -23,8 +33,21 @@ reactor *get_default_reactor();
 class reactor
 {
 public:
+    /// Multiplexing I/O syscall used by the polling thread.
+    enum class backend
+    {
+        /// Portable, but limited to FD_SETSIZE fds and O(tracked) per loop.
+        SELECT,
+        /// Linux only. Interest is kept in the kernel between loops, so
+        /// each wakeup costs O(ready).
+        EPOLL,
+    };
+
+    /// epoll on Linux, select elsewhere.
+    static backend default_backend();
+
     /// Constructors.
-    reactor(std::size_t thread_num);
+    reactor(std::size_t thread_num, backend b = default_backend());
     ~reactor();
 
     reactor(const reactor &) = delete;
@@ -35,14 +58,37 @@ public:
     PUBLIC interface.
     */
 
+    /// Pool running the callbacks. Both pools share one interface;
+    /// TCP_SERVER_WORK_STEALING picks the work-stealing one.
+#ifdef TCP_SERVER_WORK_STEALING
+    typedef work_stealing_pool callback_pool_t;
+#else
+    typedef thread_pool callback_pool_t;
+#endif
+
     /// Event handler func type. The parameter is an fd that can be
     /// read/write without blocking the thread.
-    typedef std::function<void(int)> event_handler_t;
+    typedef inline_function<void(int)> event_handler_t;
 
     /// Change the number of underlying thread workers.
     void set_thread_num(std::size_t thread_num);
 
-    /// Register [fd] to the reactor. 
+    /// Pin the polling thread and the thread workers to [cpu].
+    void set_cpu_affinity(int cpu);
+
+    /// Same as above, with separate cores. -1 leaves those threads
+    /// unpinned.
+    void set_cpu_affinity(int poll_cpu, int worker_cpu);
+
+    /// Busy-poll mode. Once events were dispatched, the polling thread
+    /// keeps polling without blocking for [spin] before it blocks in
+    /// the syscall again, and idle callback workers look for tasks for
+    /// as long before they sleep. Each such thread burns a core while
+    /// the reactor is busy, so pin them apart. 0, the default, always
+    /// blocks.
+    void set_busy_poll(std::chrono::microseconds spin);
+
+    /// Register [fd] to the reactor. Throw if it can't be polled.
     void register_fd(int fd,
                      const event_handler_t &rd_callback = nullptr,
                      const event_handler_t &wr_callback = nullptr);
@@ -50,6 +96,15 @@ public:
     /// Return the number of register fds.
     std::size_t register_num();
 
+    /// Run the callbacks of [fd] on [s] rather than straight on the
+    /// callback workers, so that they run one at a time and in order
+    /// with whatever else [s] runs. Dropped when [fd] is unregistered.
+    void set_strand(int fd, const std::shared_ptr<strand> &s);
+
+    /// Run [task] on a callback worker.
+    void post(const callback_pool_t::task_t &task);
+    void post(pool_task *task);
+
     /// Update callback on read available.
     void set_rd_callback(int fd, const event_handler_t &cb);
 
@@ -65,64 +120,213 @@ public:
     /// Shutdown the whole reactor.
     void stop();
 
+    /// Timers, kept in a timer wheel driven by the poll timeout. Their
+    /// callbacks run on the callback workers.
+    typedef timer_wheel::timer_id timer_id;
+    typedef timer_wheel::callback_t timer_callback_t;
+
+    /// Run [cb] once [delay] has passed, give or take [timer_tick].
+    timer_id schedule_timer(std::chrono::milliseconds delay, const timer_callback_t &cb);
+
+    /// Return false if [id] already fired or was cancelled. A timer that
+    /// fired may still be about to run its callback.
+    bool cancel_timer(timer_id id);
+
+    /// Resolution of the timers.
+    static const std::chrono::milliseconds timer_tick;
+
+    /// Serve tcp_clients created from now on through io_uring rather
+    /// than readiness callbacks. Return false, keeping the callback
+    /// path, if the running kernel can't do it.
+    bool enable_io_uring();
+
+    /// GETTER.
+    backend get_backend() const { return backend_; }
+    /// nullptr unless enable_io_uring() succeeded.
+    io_uring_service *get_io_uring() const { return io_uring_.get(); }
+
     /*
     PRIVATE implementation is below.
     */
 private:
+    struct fd_info;
+
+    /// Runs a callback of an fd, then reports back to the reactor. Each
+    /// fd_info embeds one per direction: at most one callback per
+    /// direction is in flight, so dispatching never allocates.
+    struct callback_task : public pool_task {
+        reactor *owner;
+        fd_info *info;
+        int fd;
+        bool is_read;
+
+        /// Copy of the callback taken at dispatch time, so that it may
+        /// be replaced while it runs.
+        event_handler_t handler;
+
+        void run() override;
+    };
+
     /// All info needed to track a registered fd.
     struct fd_info {
+        /// Guards the callbacks and the epoll bookkeeping below. Only
+        /// ever contended by threads working on this very fd.
+        std::mutex mutex;
+
+        std::atomic<bool> is_tracked = ATOMIC_VAR_INIT(false);
         std::atomic<bool> marked_untrack = ATOMIC_VAR_INIT(false);
         std::atomic<bool> is_executing_rd_cb = ATOMIC_VAR_INIT(false);
         std::atomic<bool> is_executing_wr_cb = ATOMIC_VAR_INIT(false);
         event_handler_t rd_callback;
         event_handler_t wr_callback;
 
+        /// Runs the callbacks, nullptr to run them on any worker.
+        std::shared_ptr<cdb_tcp_server::strand> strand;
+
+        /// Posted by dispatch_read() and dispatch_write().
+        callback_task rd_task;
+        callback_task wr_task;
+
+        /// epoll only. Whether [fd] is in the epoll set and which
+        /// events are currently armed for it.
+        bool in_epoll_set;
+        std::uint32_t armed_events;
+
         fd_info()
             : rd_callback(nullptr)
-            , wr_callback(nullptr) {}
+            , wr_callback(nullptr)
+            , in_epoll_set(false)
+            , armed_events(0) {}
     };
 
+    /// [tracked_fds_] is a flat table indexed by fd, split into chunks
+    /// that are allocated on first use and live as long as the reactor.
+    /// An fd_info therefore never moves and is found without locking.
+    static const std::size_t fd_chunk_size = 1024;
+    static const std::size_t fd_chunk_num = 1024;
+
+    /// Return the info slot of [fd], allocating its chunk if [create]
+    /// is set. nullptr if [fd] is out of range or was never seen.
+    fd_info *find_fd_info(int fd, bool create);
+
+    /// Mark [fd] as tracked. [info.mutex] must be held.
+    void track_fd(int fd, fd_info &info);
+
+    /// Drop [fd] and wake whoever waits on its removal.
+    /// NOTE: [info.mutex] must be held.
+    void untrack_fd(int fd, fd_info &info);
+
     /// Uniform multiplexing I/O syscall.
     void poll();
+    void poll_select();
+    void poll_epoll();
 
     /// Initialize fds used by [select]. Return the correct
     /// nfds.
     int init_select_fds();
 
+    /// Bring the events armed in the kernel in line with [info].
+    /// Return false if [fd] can't be polled. No-op for select, which
+    /// rebuilds its sets every loop.
+    /// NOTE: [info.mutex] must be held.
+    bool update_interest(int fd, fd_info &info);
+
+    /// Same as above. If [fd] can't be polled, its callbacks are run
+    /// once more as if it had failed, so that its owner finds out, and
+    /// it's untracked after them.
+    /// NOTE: [info.mutex] must be held.
+    void rearm(int fd, fd_info &info);
+
+    /// Wake [poll_worker_] if the backend needs it to notice an
+    /// interest change.
+    void wake_up();
+
+    /// Hand expired timers to [callback_workers_]. Return how long the
+    /// next poll may block, in milliseconds, -1 for no limit. The next
+    /// poll won't block at all if [spinning].
+    int run_timers(bool spinning);
+
+    /// Whether the next poll should spin rather than block, given the
+    /// time events were last dispatched.
+    bool busy_polling(std::chrono::steady_clock::time_point last_event) const;
+
+    /// Ticks of [timers_] since the reactor was created.
+    std::uint64_t current_tick() const;
+
     /// Dispatch handlers.
     void dispatch();
     void dispatch_select();
-    void dispatch_read(int fd);
-    void dispatch_write(int fd);
+    void dispatch_epoll(int nevents);
+
+    /// Hand the callback over to [callback_workers_], through the
+    /// strand of [fd] if it has one. [info.mutex] must be held.
+    void dispatch_read(int fd, fd_info &info);
+    void dispatch_write(int fd, fd_info &info);
+    void dispatch_task(callback_task &task, int fd, fd_info &info, bool is_read);
+
+    /// Run by a callback worker once a callback has returned.
+    void on_rd_callback_done(int fd, fd_info &info);
+    void on_wr_callback_done(int fd, fd_info &info);
 
 private:
-    /// fd and callback info map.
-    std::unordered_map<int, fd_info> tracked_fds_;
-    std::mutex tracked_fds_mutex_;
+    /// Selected at construction, never changes.
+    backend backend_;
+
+    /// fd and callback info table.
+    std::array<std::atomic<fd_info*>, fd_chunk_num> tracked_fds_;
+
+    /// Number of tracked fds, and the largest fd ever tracked. The
+    /// latter bounds the scan done for [select].
+    std::atomic<std::size_t> tracked_num_;
+    std::atomic<int> max_fd_;
 
     /// Workers.
     std::thread poll_worker_;
-    thread_pool callback_workers_;
+    callback_pool_t callback_workers_;
+
+    /// Completion-based I/O. Shares [callback_workers_].
+    std::unique_ptr<io_uring_service> io_uring_;
 
     /// fds that are polled.
     std::vector<int> polled_fds_;
-    
+
     /// Read/write fd sets used by [select].
     fd_set rd_set_;
     fd_set wr_set_;
 
+#ifdef __linux__
+    /// epoll instance and the buffer [epoll_wait] fills in.
+    int epoll_fd_;
+    std::vector<struct epoll_event> epoll_events_;
+#endif
+
+    /// Timers. [poll_deadline_] is the tick [poll_worker_] wakes up at
+    /// on its own, UINT64_MAX if it doesn't.
+    std::mutex timer_mutex_;
+    timer_wheel timers_;
+    std::chrono::steady_clock::time_point start_time_;
+    std::atomic<std::uint64_t> poll_deadline_;
+
+    /// Expired timer callbacks, only used by [poll_worker_].
+    std::vector<timer_callback_t> expired_timers_;
+
     /// Flag to force instructs [poll_worker_] to stop.
     std::atomic<bool> poll_stop_;
 
+    /// Microseconds [poll_worker_] spins for after events, 0 if it
+    /// doesn't.
+    std::atomic<std::int64_t> busy_poll_;
+
     /// Used to wake up [poll_worker_].
-    pipe notifier_;
+    notifier notifier_;
 
-    /// Sleep on this cond var until waken up by
-    /// the poll_worker_.
+    /// Sleep on this cond var until an fd is removed. Only taken on
+    /// the removal path.
+    std::mutex removal_mutex_;
     std::condition_variable removal_cond;
 };
 
 } // namespace cdb_tcp_server
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,358 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#endif
+#include "exceptions.hpp"
+#include "shm_channel.hpp"
+#include "tcp_socket.hpp"
+
+namespace cdb_tcp_server
+{
+
+/// Each ring starts with a page of its own holding its header, so that
+/// the data is page-aligned.
+static const std::size_t header_size = 4096;
+
+/// Smallest ring; ring sizes are powers of two from there.
+static const std::size_t min_ring_size = 4096;
+
+/// What send_to() sends along with the fds.
+struct handshake {
+    char magic[8];
+    std::uint64_t ring_size;
+};
+
+static const char handshake_magic[8] = { 'c', 'd', 'b', 's', 'h', 'm', '0', '1' };
+
+/// Handed over: the memfd, then the doorbells of the creator's inbound
+/// ring and of its outbound one.
+static const std::size_t handshake_fds = 5;
+
+/// Positions count bytes since the start and don't wrap: the ring holds
+/// [tail - head] bytes. Each side writes to a cache line of its own.
+struct shm_channel::ring_header {
+    /// Producer side. It sets [producer_waiting] when the ring is full;
+    /// the consumer takes it back and rings.
+    alignas(64) std::atomic<std::uint64_t> tail;
+    std::atomic<std::uint32_t> producer_waiting;
+
+    /// Consumer side, the same way round when the ring is empty.
+    alignas(64) std::atomic<std::uint64_t> head;
+    std::atomic<std::uint32_t> consumer_waiting;
+};
+
+/// Both processes work on the same atomics.
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2,
+              "shm_channel needs address-free atomics");
+
+/// Wake up the side polling [fd].
+static void ring_doorbell(int fd)
+{
+    std::uint64_t one = 1;
+    // Only fails if the counter would overflow, and it's readable then.
+    while (::write(fd, &one, sizeof(one)) < 0 && errno == EINTR)
+        ;
+}
+
+/// Make [fd] not readable.
+static void clear_doorbell(int fd)
+{
+    std::uint64_t value;
+    while (::read(fd, &value, sizeof(value)) < 0 && errno == EINTR)
+        ;
+}
+
+/// Going idle: have the other side ring [fd] once it moved, through
+/// [waiting]. The caller looks at the ring again afterwards, as the other
+/// side may have moved before seeing [waiting].
+static void request_doorbell(std::atomic<std::uint32_t> &waiting, int fd)
+{
+    waiting.store(1, std::memory_order_seq_cst);
+    // Earlier rings were for what the caller has seen already.
+    clear_doorbell(fd);
+}
+
+/// Just moved: ring [fd] if the other side asked for it through [waiting].
+static void answer_doorbell(std::atomic<std::uint32_t> &waiting, int fd)
+{
+    if (waiting.load(std::memory_order_seq_cst) && waiting.exchange(0, std::memory_order_seq_cst))
+        ring_doorbell(fd);
+}
+
+shm_channel::shm_channel()
+    : memfd_(-1)
+    , map_(MAP_FAILED)
+    , map_size_(0)
+    , rx_{ nullptr, nullptr, 0, -1, -1 }
+    , tx_{ nullptr, nullptr, 0, -1, -1 }
+    , fds_{ -1, -1, -1, -1 }
+    , peer_closed_(false) {}
+
+shm_channel::~shm_channel()
+{
+    if (map_ != MAP_FAILED)
+        ::munmap(map_, map_size_);
+    if (memfd_ != -1)
+        ::close(memfd_);
+    for (int fd : fds_)
+        if (fd != -1)
+            ::close(fd);
+}
+
+std::unique_ptr<shm_channel> shm_channel::create(std::size_t ring_size)
+{
+#ifdef __linux__
+    static_assert(sizeof(ring_header) <= header_size, "ring_header doesn't fit");
+
+    std::size_t size = min_ring_size;
+    while (size < ring_size)
+        size <<= 1;
+
+    std::unique_ptr<shm_channel> channel(new shm_channel);
+    for (int &fd : channel->fds_)
+        if ((fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+            __TCP_THROW("error eventfd()");
+
+    // Through syscall(): glibc only has memfd_create() since 2.27.
+    channel->memfd_ = static_cast<int>(::syscall(SYS_memfd_create, "cdb_shm_channel", 1u /* MFD_CLOEXEC */));
+    if (channel->memfd_ < 0)
+        __TCP_THROW("error memfd_create()");
+
+    std::size_t map_size = 2 * (header_size + size);
+    if (::ftruncate(channel->memfd_, map_size) < 0)
+        __TCP_THROW("error ftruncate()");
+    channel->attach(map_size, size, true);
+
+    // Consumers start out idle, so that the first bytes ring.
+    for (ring *r : { &channel->rx_, &channel->tx_ })
+    {
+        ring_header *h = new (r->header) ring_header;
+        h->tail.store(0);
+        h->producer_waiting.store(0);
+        h->head.store(0);
+        h->consumer_waiting.store(1);
+    }
+    return channel;
+#else
+    (void)ring_size;
+    __TCP_THROW("shm_channel needs memfd and eventfd");
+#endif
+}
+
+void shm_channel::attach(std::size_t map_size, std::size_t ring_size, bool creator)
+{
+    map_ = ::mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd_, 0);
+    if (map_ == MAP_FAILED)
+        __TCP_THROW("error mmap()");
+    map_size_ = map_size;
+
+    char *first = static_cast<char*>(map_);
+    char *second = first + header_size + ring_size;
+    ring inbound{ reinterpret_cast<ring_header*>(first), first + header_size, ring_size - 1,
+                  fds_[0], fds_[1] };
+    ring outbound{ reinterpret_cast<ring_header*>(second), second + header_size, ring_size - 1,
+                   fds_[2], fds_[3] };
+
+    rx_ = creator ? inbound : outbound;
+    tx_ = creator ? outbound : inbound;
+}
+
+void shm_channel::send_to(tcp_socket &sock)
+{
+    handshake hs;
+    std::memcpy(hs.magic, handshake_magic, sizeof(hs.magic));
+    hs.ring_size = rx_.mask + 1;
+
+    int fds[handshake_fds] = { memfd_, fds_[0], fds_[1], fds_[2], fds_[3] };
+    sock.send_fds(&hs, sizeof(hs), fds, handshake_fds);
+
+    // The peer has a handle of its own now.
+    ::close(memfd_);
+    memfd_ = -1;
+}
+
+std::unique_ptr<shm_channel> shm_channel::receive_from(tcp_socket &sock)
+{
+    handshake hs;
+    int fds[handshake_fds];
+    std::size_t received = 0;
+    std::size_t n = sock.recv_fds(&hs, sizeof(hs), fds, handshake_fds, received);
+
+    // Owned by [channel] from here on, whatever happens next.
+    std::unique_ptr<shm_channel> channel(new shm_channel);
+    for (std::size_t i = 0; i < received; i++)
+    {
+        if (i == 0)
+            channel->memfd_ = fds[i];
+        else
+            channel->fds_[i - 1] = fds[i];
+    }
+
+    std::size_t ring_size = hs.ring_size;
+    if (n != sizeof(hs)
+        || std::memcmp(hs.magic, handshake_magic, sizeof(hs.magic)) != 0
+        || received != handshake_fds
+        || ring_size < min_ring_size
+        || (ring_size & (ring_size - 1)) != 0)
+        __TCP_THROW("invalid shm_channel handshake");
+
+    // Don't map past what the peer actually backs.
+    std::size_t map_size = 2 * (header_size + ring_size);
+    struct stat st;
+    if (::fstat(channel->memfd_, &st) < 0 || static_cast<std::size_t>(st.st_size) != map_size)
+        __TCP_THROW("invalid shm_channel handshake");
+
+    channel->attach(map_size, ring_size, false);
+    ::close(channel->memfd_);
+    channel->memfd_ = -1;
+    return channel;
+}
+
+bool shm_channel::rx_empty() const
+{
+    return rx_.header->tail.load(std::memory_order_acquire)
+        == rx_.header->head.load(std::memory_order_relaxed);
+}
+
+std::size_t shm_channel::read_ring(char *buf, std::size_t size)
+{
+    ring_header *h = rx_.header;
+    std::uint64_t head = h->head.load(std::memory_order_relaxed);
+    std::uint64_t tail = h->tail.load(std::memory_order_acquire);
+
+    // Bounded by the capacity too: the peer's positions aren't trusted.
+    std::size_t capacity = rx_.mask + 1;
+    std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(tail - head, capacity));
+    n = std::min(n, size);
+    if (n == 0)
+        return 0;
+
+    std::size_t offset = head & rx_.mask;
+    std::size_t first = std::min(n, capacity - offset);
+    std::memcpy(buf, rx_.data + offset, first);
+    std::memcpy(buf + first, rx_.data, n - first);
+
+    h->head.store(head + n, std::memory_order_seq_cst);
+    answer_doorbell(h->producer_waiting, rx_.space_fd);
+    return n;
+}
+
+std::size_t shm_channel::write_ring(const struct iovec *iov, std::size_t iovcnt, std::size_t skip)
+{
+    ring_header *h = tx_.header;
+    std::uint64_t tail = h->tail.load(std::memory_order_relaxed);
+    std::uint64_t head = h->head.load(std::memory_order_acquire);
+
+    std::size_t capacity = tx_.mask + 1;
+    std::size_t room = capacity - static_cast<std::size_t>(std::min<std::uint64_t>(tail - head, capacity));
+    std::size_t copied = 0;
+    for (std::size_t i = 0; i < iovcnt && room > 0; i++)
+    {
+        const char *src = static_cast<const char*>(iov[i].iov_base);
+        std::size_t len = iov[i].iov_len;
+        if (skip >= len)
+        {
+            skip -= len;
+            continue;
+        }
+        src += skip;
+        len = std::min(len - skip, room);
+        skip = 0;
+
+        std::size_t offset = (tail + copied) & tx_.mask;
+        std::size_t first = std::min(len, capacity - offset);
+        std::memcpy(tx_.data + offset, src, first);
+        std::memcpy(tx_.data, src + first, len - first);
+        copied += len;
+        room -= len;
+    }
+
+    // One publication, and at most one doorbell, per call.
+    if (copied > 0)
+    {
+        h->tail.store(tail + copied, std::memory_order_seq_cst);
+        answer_doorbell(h->consumer_waiting, tx_.data_fd);
+    }
+    return copied;
+}
+
+std::size_t shm_channel::try_recv_into(char *buf, std::size_t size)
+{
+    std::size_t n = read_ring(buf, size);
+    if (n > 0)
+        return n;
+
+    if (peer_closed_)
+    {
+        // What the peer wrote before going away comes first.
+        n = read_ring(buf, size);
+        if (n == 0)
+            // Throw to close the connection.
+            __TCP_THROW("shm_channel closed by peer");
+        return n;
+    }
+
+    request_doorbell(rx_.header->consumer_waiting, rx_.data_fd);
+    n = read_ring(buf, size);
+
+    // The doorbell was cleared for bytes that are still there, or for
+    // the peer's end: ring it again so that they aren't missed.
+    if ((n > 0 && !rx_empty()) || peer_closed_)
+        ring_doorbell(rx_.data_fd);
+    return n;
+}
+
+bool shm_channel::poll()
+{
+    if (!rx_empty() || peer_closed_)
+        return true;
+
+    request_doorbell(rx_.header->consumer_waiting, rx_.data_fd);
+    if (rx_empty() && !peer_closed_)
+        return false;
+
+    // Same as in try_recv_into().
+    ring_doorbell(rx_.data_fd);
+    return true;
+}
+
+std::size_t shm_channel::sendv(const struct iovec *iov, std::size_t iovcnt)
+{
+    if (peer_closed_)
+        // Throw to close the connection.
+        __TCP_THROW("shm_channel closed by peer");
+
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
+
+    std::size_t copied = write_ring(iov, iovcnt, 0);
+    if (copied < total)
+    {
+        // Full: wait for room, unless the consumer made some meanwhile.
+        request_doorbell(tx_.header->producer_waiting, tx_.space_fd);
+        copied += write_ring(iov, iovcnt, copied);
+    }
+    return copied;
+}
+
+void shm_channel::wake_writer()
+{
+    ring_doorbell(tx_.space_fd);
+}
+
+void shm_channel::set_peer_closed()
+{
+    peer_closed_ = true;
+    ring_doorbell(rx_.data_fd);
+    ring_doorbell(tx_.space_fd);
+}
+
+} // namespace cdb_tcp_server
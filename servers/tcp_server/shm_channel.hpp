@@ -0,0 +1,125 @@
+#ifndef TCP_SERVER_SHM_CHANNEL_HPP
+#define TCP_SERVER_SHM_CHANNEL_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <sys/uio.h>
+
+namespace cdb_tcp_server
+{
+
+/// Forward declaration.
+class tcp_socket;
+
+/// Byte stream between two processes on the same host, through a pair
+/// of single-producer single-consumer rings in shared memory (a memfd),
+/// one per direction. Moving bytes is a memcpy: syscalls are only made
+/// to wake up a side that ran out of work, through eventfd doorbells it
+/// polls like any other fd.
+///
+/// One side create()s the channel and hands it over a connected Unix
+/// domain socket with send_to(), the other side receive_from()s it. The
+/// socket stays open alongside: the rings can't tell that the peer is
+/// gone, its end of the socket does (see set_peer_closed()).
+///
+/// Each side is used by one thread at a time, like a socket.
+class shm_channel {
+public:
+    ~shm_channel();
+    shm_channel(const shm_channel&) = delete;
+    shm_channel& operator=(const shm_channel&) = delete;
+
+    /// New channel with rings of [ring_size] bytes each, rounded up to
+    /// a power of two.
+    static std::unique_ptr<shm_channel> create(std::size_t ring_size);
+
+    /// Hand the channel over to the peer connected to [sock], with
+    /// SCM_RIGHTS. Doesn't block on a freshly connected socket.
+    void send_to(tcp_socket &sock);
+
+    /// The other side of the channel sent over [sock] by send_to().
+    /// Blocks until it arrives.
+    static std::unique_ptr<shm_channel> receive_from(tcp_socket &sock);
+
+public:
+    /// Copy up to [size] bytes out of the inbound ring. Return 0 if it's
+    /// empty, in which case data_fd() becomes readable once it isn't.
+    /// Once the peer is gone, an empty ring throws.
+    std::size_t try_recv_into(char *buf, std::size_t size);
+
+    /// Copy as much of [iov] as fits into the outbound ring. Return the
+    /// number of bytes copied; if short, space_fd() becomes readable
+    /// once there is room. Throws once the peer is gone.
+    std::size_t sendv(const struct iovec *iov, std::size_t iovcnt);
+
+    /// Whether try_recv_into() has something for the caller: bytes, or
+    /// the end of the stream. If not, data_fd() becomes readable once
+    /// it has.
+    bool poll();
+
+    /// Readable when the inbound ring may have bytes, or the peer went
+    /// away. Spurious wakeups are possible.
+    int data_fd() const { return rx_.data_fd; }
+
+    /// Readable when the outbound ring may have room.
+    int space_fd() const { return tx_.space_fd; }
+
+    /// Make space_fd() readable, for a writer that has yet to try.
+    void wake_writer();
+
+    /// The peer is gone: once the inbound ring is drained, reads throw,
+    /// and so do writes right away. Rings both doorbells, so that
+    /// whoever waits finds out.
+    void set_peer_closed();
+    bool is_peer_closed() const { return peer_closed_; }
+
+private:
+    /// Shared by both processes, at the start of each ring's page.
+    struct ring_header;
+
+    /// One direction, as mapped by this process.
+    struct ring {
+        ring_header *header;
+        char *data;
+        std::size_t mask;
+
+        /// Rung by the producer when the consumer waits for bytes, and
+        /// by the consumer when the producer waits for room.
+        int data_fd;
+        int space_fd;
+    };
+
+    shm_channel();
+
+    /// Map [map_size] bytes of [memfd_] and set [rx_] and [tx_] up, the
+    /// first ring being the inbound one if [creator].
+    void attach(std::size_t map_size, std::size_t ring_size, bool creator);
+
+    /// Copy bytes out of [rx_] / into [tx_] without waiting.
+    std::size_t read_ring(char *buf, std::size_t size);
+    std::size_t write_ring(const struct iovec *iov, std::size_t iovcnt, std::size_t skip);
+
+    bool rx_empty() const;
+
+private:
+    /// The shared memory, open until handed over: the mapping keeps
+    /// it alive.
+    int memfd_;
+    void *map_;
+    std::size_t map_size_;
+
+    /// [rx_] is read by this side and [tx_] written by it.
+    ring rx_;
+    ring tx_;
+
+    /// The four eventfds, in the order they're handed over.
+    int fds_[4];
+
+    std::atomic<bool> peer_closed_;
+};
+
+} // namespace cdb_tcp_server
+
+
+#endif
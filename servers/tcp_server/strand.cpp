@@ -0,0 +1,145 @@
+#include <exception>
+#include <thread>
+#include "reactor.hpp"
+#include "strand.hpp"
+
+namespace cdb_tcp_server
+{
+
+/// Tasks a worker runs in a row before giving other strands a turn.
+static const std::size_t max_strand_batch = 64;
+
+thread_local const strand *strand::current_ = nullptr;
+
+strand::strand(reactor *r)
+    : reactor_(r)
+    , head_(&stub_)
+    , tail_(&stub_)
+    , pending_(0)
+{
+    stub_.next.store(nullptr, std::memory_order_relaxed);
+}
+
+strand::~strand()
+{
+    // Tasks that never ran.
+    while (pool_task *t = pop())
+        t->discard();
+}
+
+void strand::push(pool_task *t)
+{
+    t->next.store(nullptr, std::memory_order_relaxed);
+    pool_task *prev = head_.exchange(t, std::memory_order_acq_rel);
+    prev->next.store(t, std::memory_order_release);
+}
+
+pool_task *strand::pop()
+{
+    pool_task *tail = tail_;
+    pool_task *next = tail->next.load(std::memory_order_acquire);
+
+    if (tail == &stub_)
+    {
+        if (next == nullptr)
+            return nullptr;
+        tail_ = tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next)
+    {
+        tail_ = next;
+        return tail;
+    }
+
+    // [tail] looks like the last node. Unless a producer is midway
+    // through push(), put the stub back behind it so that it can go.
+    if (tail != head_.load(std::memory_order_acquire))
+        return nullptr;
+
+    push(&stub_);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next)
+    {
+        tail_ = next;
+        return tail;
+    }
+    return nullptr;
+}
+
+void strand::post(const task_t &task)
+{
+    post(new function_task(task));
+}
+
+void strand::post(pool_task *task)
+{
+    push(task);
+
+    if (pending_.fetch_add(1, std::memory_order_acq_rel) == 0)
+        schedule();
+}
+
+void strand::schedule()
+{
+    // Only one runner is ever in flight: the strand is scheduled when
+    // [pending_] leaves 0, or by the runner itself.
+    runner_.owner = shared_from_this();
+    reactor_->post(&runner_);
+}
+
+void strand::runner_task::run()
+{
+    // Released before the strand may be scheduled again.
+    std::shared_ptr<strand> self = std::move(owner);
+    self->run();
+}
+
+void strand::dispatch(const task_t &task)
+{
+    if (running_in_this_thread())
+        task();
+    else
+        post(task);
+}
+
+bool strand::running_in_this_thread() const
+{
+    return current_ == this;
+}
+
+void strand::run()
+{
+    const strand *outer = current_;
+    current_ = this;
+
+    for (std::size_t i = 0; i < max_strand_batch; i++)
+    {
+        pool_task *t;
+        // Counted in [pending_], so it shows up once its producer
+        // is done linking it.
+        while ((t = pop()) == nullptr)
+            std::this_thread::yield();
+
+        // May delete itself. One that throws must not wedge the strand:
+        // [pending_] and [current_] are still to be settled.
+        try {
+            t->run();
+        } catch (const std::exception& e) {
+            // TODO: add log.
+        }
+
+        if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            current_ = outer;
+            return;
+        }
+    }
+
+    // Still busy; requeue behind the other work.
+    current_ = outer;
+    schedule();
+}
+
+} // namespace cdb_tcp_server
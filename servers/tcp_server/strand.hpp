@@ -0,0 +1,97 @@
+#ifndef TCP_SERVER_STRAND_HPP
+#define TCP_SERVER_STRAND_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include "pool_task.hpp"
+
+namespace cdb_tcp_server
+{
+
+/// Forward declaration.
+class reactor;
+
+/// Serial executor on top of a reactor's callback workers. Tasks posted
+/// to one strand run one at a time and in the order they were posted,
+/// on whichever worker picked the strand up. A strand that is already
+/// running just queues the task; only an idle one is handed to the
+/// workers.
+///
+/// Posting is lock-free: tasks go to an intrusive MPSC queue
+/// (D. Vyukov's design) drained by the worker running the strand.
+/// Posting a pool_task doesn't allocate.
+class strand : public std::enable_shared_from_this<strand> {
+public:
+    typedef inline_function<void()> task_t;
+
+    strand(reactor *r);
+    ~strand();
+
+    strand(const strand&) = delete;
+    strand& operator=(const strand&) = delete;
+
+public:
+    /// Run [task] after the tasks posted before it.
+    void post(const task_t &task);
+
+    /// Same as above without allocating. [task] must stay alive until
+    /// it has run or was discarded.
+    void post(pool_task *task);
+
+    /// Run [task] right away if the calling thread is running this
+    /// strand, post it otherwise.
+    void dispatch(const task_t &task);
+
+    /// Whether the calling thread is running a task of this strand.
+    bool running_in_this_thread() const;
+
+private:
+    struct stub_task : public pool_task {
+        void run() override {}
+    };
+
+    /// Runs the strand on a worker, keeping it alive meanwhile.
+    struct runner_task : public pool_task {
+        std::shared_ptr<strand> owner;
+        void run() override;
+        void discard() override { owner = nullptr; }
+    };
+
+    void push(pool_task *t);
+
+    /// Consumer only. nullptr if empty, or if a producer hasn't linked
+    /// its task yet.
+    pool_task *pop();
+
+    /// Hand the strand to the workers.
+    void schedule();
+
+    /// Run queued tasks, then hand the strand back to the workers if
+    /// some are left.
+    void run();
+
+private:
+    reactor *reactor_;
+
+    /// Producers swap themselves in at [head_]; the consumer follows
+    /// [tail_]. [stub_] keeps the queue non-empty.
+    std::atomic<pool_task*> head_;
+    char pad_[64];
+    pool_task *tail_;
+    stub_task stub_;
+
+    runner_task runner_;
+
+    /// Tasks posted and not run yet. The poster that moves it off 0
+    /// schedules the strand.
+    std::atomic<std::size_t> pending_;
+
+    /// Strand run by the calling thread, nullptr if none.
+    static thread_local const strand *current_;
+};
+
+} // namespace cdb_tcp_server
+
+
+#endif
@@ -1,37 +1,197 @@
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
 #include "exceptions.hpp"
 #include "tcp_client.hpp"
 
 namespace cdb_tcp_server {
 
+/// Milliseconds of steady_clock, the unit of the idle timer.
+static std::int64_t steady_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
 tcp_client::tcp_client(reactor *r)
     : reactor_(r == nullptr ? get_default_reactor() : r)
-    , on_disconnection_(nullptr) {}
+    , strand_(std::make_shared<strand>(reactor_))
+    , uring_(nullptr)
+    , write_offset_(0)
+    , write_in_flight_(false)
+    , on_disconnection_(nullptr)
+    , timer_guard_(std::make_shared<timer_guard>())
+    , idle_timeout_(0)
+    , read_deadline_(0)
+    , last_activity_(0)
+    , idle_timer_(0)
+    , read_timer_(0)
+    , idle_timer_seq_(0)
+    , read_timer_seq_(0)
+    , next_timer_seq_(0)
+    , reading_paused_(false)
+    , reading_held_(false)
+    , redeliver_(false)
+    , pending_write_bytes_(0)
+    , pending_writes_(0)
+    , rx_accounted_(0)
+    , flow_timer_(0)
+    , flow_timer_seq_(0)
+{
+    timer_guard_->client = this;
+}
 
 tcp_client::~tcp_client()
 {
+    // No timer callback may run from now on.
+    {
+        std::lock_guard<std::recursive_mutex> lock(timer_guard_->mutex);
+        timer_guard_->client = nullptr;
+    }
+
     disconnect(false);
+
+    // Completions may still be running on other workers.
+    if (uring_conn_)
+        uring_->detach(uring_conn_, true);
 }
 
-tcp_client::tcp_client(tcp_socket&& socket)
-    : reactor_(get_default_reactor())
+tcp_client::tcp_client(tcp_socket&& socket, reactor *r, std::unique_ptr<shm_channel> shm)
+    : reactor_(r == nullptr ? get_default_reactor() : r)
+    , strand_(std::make_shared<strand>(reactor_))
+    , shm_(std::move(shm))
+    , uring_(nullptr)
+    , write_offset_(0)
+    , write_in_flight_(false)
     , socket_(std::move(socket))
     , is_connected_(true)
-    , on_disconnection_(nullptr) {}
+    , on_disconnection_(nullptr)
+    , timer_guard_(std::make_shared<timer_guard>())
+    , idle_timeout_(0)
+    , read_deadline_(0)
+    , last_activity_(0)
+    , idle_timer_(0)
+    , read_timer_(0)
+    , idle_timer_seq_(0)
+    , read_timer_seq_(0)
+    , next_timer_seq_(0)
+    , reading_paused_(false)
+    , reading_held_(false)
+    , redeliver_(false)
+    , pending_write_bytes_(0)
+    , pending_writes_(0)
+    , rx_accounted_(0)
+    , flow_timer_(0)
+    , flow_timer_seq_(0)
+{
+    timer_guard_->client = this;
+    attach_reactor();
+}
+
+void tcp_client::attach_reactor()
+{
+    if (shm_)
+    {
+        for (int fd : { socket_.fd(), shm_->data_fd(), shm_->space_fd() })
+        {
+            reactor_->register_fd(fd);
+            reactor_->set_strand(fd, strand_);
+        }
+        // Nothing but the peer's end is expected on it.
+        reactor_->set_rd_callback(
+            socket_.fd(),
+            std::bind(&tcp_client::on_control_readable, this, std::placeholders::_1));
+    }
+    else if (reactor_->get_io_uring())
+    {
+        // Only so that the reactor counts it.
+        reactor_->register_fd(socket_.fd());
+        start_io_uring();
+    }
+    else
+    {
+        reactor_->register_fd(socket_.fd());
+        reactor_->set_strand(socket_.fd(), strand_);
+    }
+}
+
+void tcp_client::start_io_uring()
+{
+    uring_ = reactor_->get_io_uring();
+    sending_.clear();
+    write_offset_ = 0;
+    write_in_flight_ = false;
+
+    uring_conn_ = uring_->attach(
+        socket_.fd(),
+        std::bind(&tcp_client::on_uring_recv, this),
+        std::bind(&tcp_client::on_uring_send, this, std::placeholders::_1));
+    uring_->start_recv(uring_conn_);
+}
 
 void tcp_client::connect(const std::string &host, std::uint32_t port)
 {
     if (is_connected_)
         __TCP_THROW("tcp_client is already connected");
 
+    shm_ = nullptr;
     try {
         socket_.connect(host, port);
-        reactor_->register_fd(socket_.fd());
+    } catch (const std::runtime_error &e) {
+        socket_.close();
+        throw e;
+    }
+    on_connected();
+}
+
+void tcp_client::connect_unix(const std::string &path)
+{
+    if (is_connected_)
+        __TCP_THROW("tcp_client is already connected");
+
+    shm_ = nullptr;
+    try {
+        socket_.connect_unix(path);
+    } catch (const std::runtime_error &e) {
+        socket_.close();
+        throw e;
+    }
+    on_connected();
+}
+
+void tcp_client::connect_shm(const std::string &path)
+{
+    if (is_connected_)
+        __TCP_THROW("tcp_client is already connected");
+
+    try {
+        socket_.connect_unix(path);
+        shm_ = shm_channel::receive_from(socket_);
+    } catch (const std::runtime_error &e) {
+        socket_.close();
+        throw e;
+    }
+    on_connected();
+}
+
+void tcp_client::on_connected()
+{
+    try {
+        rx_buffer_.clear();
+        attach_reactor();
     } catch (const std::runtime_error &e) {
         socket_.close();
         throw e;
     }
 
     is_connected_ = true;
+
+    std::lock_guard<std::mutex> lock(timer_mutex_);
+    if (idle_timeout_ > 0)
+    {
+        last_activity_ = steady_ms();
+        start_idle_timer(std::chrono::milliseconds{idle_timeout_.load()});
+    }
 }
 
 void tcp_client::disconnect(bool wait)
@@ -42,12 +202,30 @@ void tcp_client::disconnect(bool wait)
     is_connected_ = false;
     clear_read_reqs();
     clear_write_reqs();
+    cancel_timers();
+
+    // Cancel what's in flight before the fd goes away.
+    if (uring_conn_)
+        uring_->detach(uring_conn_, wait);
 
-    // Unregister from reactor_.
+    // Unregister from reactor_. Wait before closing: once closed, the
+    // fd may be reused and tracked again right away.
     reactor_->unregister(socket_.fd());
-    socket_.close();
+    if (shm_)
+    {
+        reactor_->unregister(shm_->data_fd());
+        reactor_->unregister(shm_->space_fd());
+    }
     if (wait)
+    {
         reactor_->wait_on_removal_cond(socket_.fd());
+        if (shm_)
+        {
+            reactor_->wait_on_removal_cond(shm_->data_fd());
+            reactor_->wait_on_removal_cond(shm_->space_fd());
+        }
+    }
+    socket_.close();
 
     // User-provided cb.
     if (on_disconnection_) {
@@ -55,35 +233,79 @@ void tcp_client::disconnect(bool wait)
     }
 }
 
+bool tcp_client::can_hand_over() const
+{
+    return is_connected_ && !shm_ && !uring_ && rx_buffer_.empty() && pending_writes_ == 0;
+}
+
+void tcp_client::wait_for_callbacks()
+{
+    if (strand_->running_in_this_thread())
+        return;
+
+    // Runs once whatever [strand_] holds now has.
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool done = false;
+    strand_->post([&] {
+        std::lock_guard<std::mutex> lock(mutex);
+        done = true;
+        cond.notify_one();
+    });
+
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [&] { return done; });
+}
+
+void tcp_client::post(const strand::task_t &task)
+{
+    strand_->post(task);
+}
+
 void tcp_client::clear_read_reqs()
 {
     std::lock_guard<std::mutex> lock(read_request_mutex_);
 
     std::queue<read_request> empty;
     std::swap(read_requests_, empty);
+    stream_cb_ = nullptr;
+
+    if (flow_)
+        flow_->buffered_bytes -= rx_accounted_;
+    rx_accounted_ = 0;
 }
 
 void tcp_client::clear_write_reqs()
 {
     std::lock_guard<std::mutex> lock(write_request_mutex_);
 
-    std::queue<write_request> empty;
+    std::deque<write_request> empty;
     std::swap(write_requests_, empty);
+    write_offset_ = 0;
+    release_output(pending_write_bytes_, pending_writes_);
 }
 
 void tcp_client::async_read(const read_request &req)
 {
     std::lock_guard<std::mutex> lock(read_request_mutex_);
 
-    if (is_connected_)
+    if (is_connected_ && uring_)
+    {
+        read_requests_.push(req);
+        update_read_timer(true);
+
+        // Bytes that arrived earlier won't trigger on_uring_recv again.
+        if (uring_conn_->is_readable())
+            uring_->schedule_recv(uring_conn_);
+    }
+    else if (is_connected_)
     {
         // Always re-register socket_ to reactor_.
-        reactor_->set_rd_callback(
-            socket_.fd(), 
-            std::bind(&tcp_client::on_read_available, this, std::placeholders::_1/* The fd */));
+        watch_readable(true);
 
         // Append the info.
         read_requests_.push(req);
+        update_read_timer(true);
     }
     else
     {
@@ -91,31 +313,188 @@ void tcp_client::async_read(const read_request &req)
     }
 }
 
+void tcp_client::start_reading(const buffered_read_callback_t &cb)
+{
+    std::lock_guard<std::mutex> lock(read_request_mutex_);
+
+    if (!is_connected_)
+        __TCP_THROW("tcp_client is not connected");
+
+    stream_cb_ = std::make_shared<buffered_read_callback_t>(cb);
+    reading_paused_ = false;
+    reading_held_ = false;
+    if (uring_)
+    {
+        // Bytes that arrived earlier won't trigger on_uring_recv again.
+        if (uring_conn_->is_readable())
+            uring_->schedule_recv(uring_conn_);
+    }
+    else
+        // Left installed by do_read() from now on.
+        watch_readable(true);
+}
+
+void tcp_client::stop_reading()
+{
+    std::lock_guard<std::mutex> lock(read_request_mutex_);
+
+    stream_cb_ = nullptr;
+    if (is_connected_ && !uring_ && read_requests_.empty())
+        watch_readable(false);
+}
+
+void tcp_client::hold_reading()
+{
+    std::lock_guard<std::mutex> lock(read_request_mutex_);
+
+    reading_held_ = true;
+    if (is_connected_ && !uring_)
+        watch_readable(false);
+}
+
+void tcp_client::release_reading()
+{
+    std::lock_guard<std::mutex> lock(read_request_mutex_);
+
+    if (!reading_held_)
+        return;
+    reading_held_ = false;
+    redeliver_ = true;
+    if (is_connected_ && !reading_paused_)
+        resume_reading();
+}
+
 /// Same as async_read.
 void tcp_client::async_write(const write_request &req)
 {
-    std::lock_guard<std::mutex> lock(write_request_mutex_);
+    async_write(write_request(req));
+}
 
-    if (is_connected_)
+void tcp_client::async_write(write_request &&req)
+{
+    std::unique_lock<std::mutex> lock(write_request_mutex_);
+    bool write_inline = false;
+    std::size_t size = req.data.size();
+
+    if (is_connected_ && uring_)
     {
-        reactor_->set_wr_callback(
-            socket_.fd(),
-            std::bind(&tcp_client::on_write_available, this, std::placeholders::_1)
-        );
+        write_requests_.push_back(std::move(req));
+
+        // One send at a time; on_uring_send() moves on to the next.
+        if (!write_in_flight_)
+        {
+            write_in_flight_ = true;
+            write_offset_ = 0;
+            send_front();
+        }
+    }
+    else if (is_connected_)
+    {
+        write_requests_.push_back(std::move(req));
 
-        write_requests_.push(req);
+        // On the strand with nothing queued before it: send right away
+        // rather than wait for the poller to report the socket writable.
+        if (write_requests_.size() == 1 && strand_->running_in_this_thread())
+            write_inline = true;
+        else
+        {
+            watch_writable(true);
+            // Unlike a socket, the doorbell isn't ready until the
+            // peer rings it: ring it to get the first write going.
+            if (shm_ && write_requests_.size() == 1)
+                shm_->wake_writer();
+        }
     }
     else
     {
         __TCP_THROW("tcp_client is not connected");
     }
+
+    pending_write_bytes_ += size;
+    pending_writes_++;
+    if (flow_)
+        flow_->buffered_bytes += size;
+    lock.unlock();
+
+    if (write_inline)
+        write_now();
+
+    // Crossed a high mark: stop reading without waiting for the next
+    // read to notice.
+    if (flow_ && !reading_paused_
+        && ((flow_->high_watermark && pending_write_bytes_ >= flow_->high_watermark)
+            || (flow_->high_pending_writes && pending_writes_ >= flow_->high_pending_writes)))
+        update_flow();
+}
+
+void tcp_client::watch_readable(bool watch)
+{
+    reactor::event_handler_t cb = nullptr;
+    if (watch)
+        cb = std::bind(&tcp_client::on_read_available, this, std::placeholders::_1);
+
+    reactor_->set_rd_callback(shm_ ? shm_->data_fd() : socket_.fd(), cb);
+}
+
+void tcp_client::watch_writable(bool watch)
+{
+    reactor::event_handler_t cb = nullptr;
+    if (watch)
+        cb = std::bind(&tcp_client::on_write_available, this, std::placeholders::_1);
+
+    // A doorbell is rung, i.e. made readable, when there is room.
+    if (shm_)
+        reactor_->set_rd_callback(shm_->space_fd(), cb);
+    else
+        reactor_->set_wr_callback(socket_.fd(), cb);
+}
+
+void tcp_client::on_control_readable(int)
+{
+    char byte;
+    try {
+        // Spurious, or a byte the peer had no business sending.
+        socket_.try_recv_into(&byte, 1);
+        return;
+    } catch (const std::runtime_error&) {
+    }
+
+    // Readable for good now. Reads and writes find out through the
+    // channel, once what the peer wrote before going away is read.
+    reactor_->set_rd_callback(socket_.fd(), nullptr);
+    shm_->set_peer_closed();
 }
 
-/// [fd] is always socket_.fd().
+/// [fd] is always socket_.fd(), or the inbound doorbell in shm mode.
 void tcp_client::on_read_available(int)
 {
+    bool success;
+    if (auto stream_cb = do_stream_read(success))
+    {
+        // Disconnect if once operation failed.
+        if (!success)
+        {
+            // TODO: add log
+            disconnect(false);
+        }
+
+        buffered_read_result result{ success, rx_buffer_ };
+        (*stream_cb)(result);
+
+        if (success)
+        {
+            // A partial message is waiting for the rest, unless the
+            // callback held what it couldn't take yet.
+            update_read_timer(!rx_buffer_.empty() && !reading_held_);
+            update_flow();
+        }
+        return;
+    }
+
+    read_request req;
     read_result result;
-    auto user_cb = do_read(result);
+    if (!do_read(req, result))
+        return;
 
     // Disconnect if once operation failed.
     if (!result.success)
@@ -124,80 +503,676 @@ void tcp_client::on_read_available(int)
         disconnect(false);
     }
 
-    if (user_cb)
-        user_cb(result);
+    complete_read(req, result);
+}
+
+void tcp_client::complete_read(read_request &req, read_result &result)
+{
+    if (req.buffered_cb)
+    {
+        buffered_read_result buffered{ result.success, rx_buffer_ };
+        req.buffered_cb(buffered);
+    }
+    else if (req.cb)
+        req.cb(result);
 }
 
 /// Same as above.
 void tcp_client::on_write_available(int)
 {
-    write_result result;
-    auto user_cb = do_write(result);
+    // Borrow the completion list; a callback writing again finds it
+    // taken and uses one of its own.
+    std::vector<write_completion> done;
+    done.swap(write_done_);
+
+    bool success = do_write(done);
+    complete_writes(success, done);
 
+    done.clear();
+    if (done.capacity() > write_done_.capacity())
+        done.swap(write_done_);
+}
+
+void tcp_client::complete_writes(bool success, std::vector<write_completion> &done)
+{
     // Disconnect if once operation failed.
-    if (!result.success)
+    if (!success)
     {
         // TODO: add log.
         disconnect(false);
     }
 
-    if (user_cb)
-        user_cb(result);
+    for (auto &completion : done)
+        if (completion.cb)
+            completion.cb(completion.result);
+
+    if (reading_paused_ && !done.empty())
+        update_flow();
+}
+
+void tcp_client::write_now()
+{
+    std::vector<write_completion> done;
+    done.swap(write_done_);
+
+    bool success = do_write(done);
+    bool has_callbacks = false;
+    for (auto &completion : done)
+        has_callbacks = has_callbacks || completion.cb;
+
+    if (!success || has_callbacks)
+    {
+        // The caller is in the middle of a callback of its own; run the
+        // write callbacks after it, as the poller would have.
+        std::shared_ptr<timer_guard> guard = timer_guard_;
+        std::shared_ptr<std::vector<write_completion>> posted =
+            std::make_shared<std::vector<write_completion>>(std::move(done));
+        strand_->post([guard, success, posted] {
+            std::lock_guard<std::recursive_mutex> lock(guard->mutex);
+            if (guard->client)
+                guard->client->complete_writes(success, *posted);
+        });
+    }
+    else if (reading_paused_ && !done.empty())
+        update_flow();
+
+    done.clear();
+    if (done.capacity() > write_done_.capacity())
+        done.swap(write_done_);
 }
 
-tcp_client::read_callback_t tcp_client::do_read(tcp_client::read_result &result)
+bool tcp_client::do_read(read_request &req, tcp_client::read_result &result)
 {
     std::lock_guard<std::mutex> lock(read_request_mutex_);
 
     // Return if no request is pending.
-    if (read_requests_.empty()) return nullptr;
+    if (read_requests_.empty()) return false;
+
+    // Doorbells may ring for nothing; the request waits then.
+    if (shm_ && !shm_->poll()) return false;
 
     // Serve request.
-    auto &req = read_requests_.front();
-    auto cb = req.cb;
+    req = std::move(read_requests_.front());
+    read_requests_.pop();
 
     try {
-        result.data = socket_.recv(req.size);
+        if (req.buffered_cb)
+        {
+            // Read straight into the input buffer, as much as it has room for.
+            rx_buffer_.reserve(req.size);
+            if (shm_)
+                rx_buffer_.commit(shm_->try_recv_into(rx_buffer_.write_ptr(), rx_buffer_.writable()));
+            else
+                rx_buffer_.commit(socket_.recv_into(rx_buffer_.write_ptr(), rx_buffer_.writable()));
+        }
+        else if (shm_)
+        {
+            result.data.resize(req.size);
+            result.data.resize(shm_->try_recv_into(result.data.data(), req.size));
+        }
+        else
+            result.data = socket_.recv(req.size);
         result.success = true;
+        touch();
     } catch (const std::runtime_error&) {
         result.success = false;
     }
 
-    read_requests_.pop();
-    
     // Basically, when no request is pending, we don't want
     // reactor_ to poll socket_
     if (read_requests_.empty())
-        reactor_->set_rd_callback(socket_.fd(), nullptr);
+    {
+        watch_readable(false);
+        update_read_timer(false);
+    }
 
-    return cb;
+    return true;
 }
 
-tcp_client::write_callback_t tcp_client::do_write(tcp_client::write_result &result)
+/// Upper bound on the bytes drained from the socket per event in
+/// streaming mode, so that one busy connection doesn't hold a worker
+/// forever. The rest is picked up on the next event.
+static const std::size_t max_stream_drain = buffer_pool::max_block;
+
+std::size_t tcp_client::stream_read_size() const
 {
-    std::lock_guard<std::mutex> lock(write_request_mutex_);
+    // 1024 is big enough for most requests. A message that doesn't fit
+    // yet doubles it, so that large ones take a few reads.
+    return std::min<std::size_t>(std::max<std::size_t>(1024, rx_buffer_.size()),
+                                 buffer_pool::max_block);
+}
 
-    if (write_requests_.empty())    return nullptr;
+std::shared_ptr<tcp_client::buffered_read_callback_t> tcp_client::do_stream_read(bool &success)
+{
+    std::lock_guard<std::mutex> lock(read_request_mutex_);
 
-    // Serve request.
-    auto &req = write_requests_.front();
-    auto cb = req.cb;
+    if (!stream_cb_ || reading_paused_ || reading_held_)
+        return nullptr;
 
+    std::size_t drained = 0;
+    success = true;
     try {
-        socket_.send(req.data);
-        result.size = req.data.size();
-        result.success = true;
+        while (drained < max_stream_drain)
+        {
+            rx_buffer_.reserve(stream_read_size());
+            std::size_t n = shm_ ? shm_->try_recv_into(rx_buffer_.write_ptr(), rx_buffer_.writable())
+                                 : socket_.try_recv_into(rx_buffer_.write_ptr(), rx_buffer_.writable());
+            if (n == 0)
+                break;
+
+            rx_buffer_.commit(n);
+            drained += n;
+        }
     } catch (const std::runtime_error&) {
-        result.success = false;
+        // Hand over what arrived first; the failure shows up again on
+        // the next event.
+        success = drained > 0;
+    }
+
+    // Spurious wakeup.
+    if (success && drained == 0 && !(redeliver_ && !rx_buffer_.empty()))
+        return nullptr;
+
+    redeliver_ = false;
+
+    if (drained > 0)
+        touch();
+    return stream_cb_;
+}
+
+/// Upper bound on the requests gathered by a single [sendmsg].
+static const std::size_t max_write_iovecs = 64;
+
+bool tcp_client::do_write(std::vector<write_completion> &done)
+{
+    std::lock_guard<std::mutex> lock(write_request_mutex_);
+
+    bool success = true;
+    while (!write_requests_.empty())
+    {
+        // Gather the queued requests, skipping what's already sent of
+        // the first one.
+        struct iovec iov[max_write_iovecs];
+        std::size_t iovcnt = 0;
+        std::size_t total = 0;
+        for (auto it = write_requests_.begin();
+             it != write_requests_.end() && iovcnt < max_write_iovecs;
+             ++it)
+        {
+            std::size_t offset = iovcnt == 0 ? write_offset_ : 0;
+            iov[iovcnt].iov_base = const_cast<char*>(it->data.data()) + offset;
+            iov[iovcnt].iov_len = it->data.size() - offset;
+            total += iov[iovcnt].iov_len;
+            iovcnt++;
+        }
+
+        std::size_t written = 0;
+        try {
+            if (total == 0)
+                written = 0;
+            else
+                written = shm_ ? shm_->sendv(iov, iovcnt) : socket_.sendv(iov, iovcnt);
+        } catch (const std::runtime_error&) {
+            // The first unfinished request fails, like a single send would.
+            done.push_back({ write_requests_.front().cb, { false, 0 } });
+            release_output(write_requests_.front().data.size(), 1);
+            write_requests_.pop_front();
+            write_offset_ = 0;
+            success = false;
+            break;
+        }
+
+        if (written > 0)
+            touch();
+
+        // Requests whose last byte went out are done.
+        std::size_t left = written;
+        while (!write_requests_.empty())
+        {
+            auto &req = write_requests_.front();
+            std::size_t unsent = req.data.size() - write_offset_;
+            if (left < unsent)
+            {
+                write_offset_ += left;
+                break;
+            }
+
+            left -= unsent;
+            done.push_back({ req.cb, { true, req.data.size() } });
+            release_output(req.data.size(), 1);
+            write_requests_.pop_front();
+            write_offset_ = 0;
+        }
+
+        // Socket buffer is full, wait for the next writable event.
+        if (written < total)
+            break;
     }
 
-    write_requests_.pop();
     // Basically, when no request is pending, we don't want
-    // reactor_ to poll socket_
+    // reactor_ to poll socket_. Otherwise wait for room in the socket.
     if (write_requests_.empty())
-        reactor_->set_wr_callback(socket_.fd(), nullptr);
+        watch_writable(false);
+    else if (success)
+        watch_writable(true);
+
+    return success;
+}
+
+std::shared_ptr<tcp_client::buffered_read_callback_t> tcp_client::do_uring_stream_read(bool &success)
+{
+    std::lock_guard<std::mutex> lock(read_request_mutex_);
+
+    if (!stream_cb_ || reading_paused_ || reading_held_)
+        return nullptr;
+
+    std::size_t drained = 0;
+    for (;;)
+    {
+        rx_buffer_.reserve(stream_read_size());
+        std::size_t n = uring_conn_->consume(rx_buffer_.writable(), rx_buffer_.write_ptr());
+        if (n == 0)
+            break;
+
+        rx_buffer_.commit(n);
+        drained += n;
+    }
+
+    success = drained > 0 || !uring_conn_->is_closed();
+    if (success && drained == 0 && !(redeliver_ && !rx_buffer_.empty()))
+        return nullptr;
+
+    redeliver_ = false;
+
+    if (drained > 0)
+        touch();
+    return stream_cb_;
+}
+
+void tcp_client::on_uring_recv()
+{
+    // Loop once more after the last bytes, or the end of the stream
+    // would go unreported: nothing completes after it.
+    bool success;
+    while (auto stream_cb = do_uring_stream_read(success))
+    {
+        // Disconnect if once operation failed.
+        if (!success)
+        {
+            // TODO: add log.
+            disconnect(false);
+        }
+
+        buffered_read_result result{ success, rx_buffer_ };
+        (*stream_cb)(result);
+        if (!success)
+            return;
+
+        // A partial message is waiting for the rest, unless the
+        // callback held what it couldn't take yet.
+        update_read_timer(!rx_buffer_.empty() && !reading_held_);
+        update_flow();
+    }
+
+    for (;;)
+    {
+        read_request req;
+        read_result result;
+        {
+            std::lock_guard<std::mutex> lock(read_request_mutex_);
+
+            if (read_requests_.empty())
+                return;
+
+            auto &front = read_requests_.front();
+            bool consumed;
+            if (front.buffered_cb)
+            {
+                rx_buffer_.reserve(front.size);
+                std::size_t n = uring_conn_->consume(rx_buffer_.writable(), rx_buffer_.write_ptr());
+                rx_buffer_.commit(n);
+                consumed = n > 0;
+            }
+            else
+                consumed = uring_conn_->consume(front.size, result.data);
+
+            if (consumed)
+            {
+                result.success = true;
+                touch();
+            }
+            else if (uring_conn_->is_closed())
+                result.success = false;
+            else
+                return;
+
+            req = std::move(front);
+            read_requests_.pop();
+            update_read_timer(!read_requests_.empty());
+        }
+
+        // Disconnect if once operation failed.
+        if (!result.success)
+        {
+            // TODO: add log.
+            disconnect(false);
+            complete_read(req, result);
+            return;
+        }
+
+        complete_read(req, result);
+    }
+}
+
+void tcp_client::on_uring_send(int res)
+{
+    write_result result;
+    write_callback_t cb;
+    {
+        std::lock_guard<std::mutex> lock(write_request_mutex_);
+
+        // Cleared by disconnect().
+        if (write_requests_.empty())
+        {
+            write_in_flight_ = false;
+            return;
+        }
+
+        if (res < 0 || (res == 0 && write_offset_ < sending_.size()))
+            result.success = false;
+        else
+        {
+            write_offset_ += res;
+            touch();
+            // Partial write, send the rest.
+            if (write_offset_ < sending_.size())
+            {
+                send_front();
+                return;
+            }
+
+            result.success = true;
+            result.size = sending_.size();
+        }
+
+        cb = write_requests_.front().cb;
+        write_requests_.pop_front();
+        write_offset_ = 0;
+        release_output(sending_.size(), 1);
+
+        if (result.success && !write_requests_.empty())
+            send_front();
+        else
+            write_in_flight_ = false;
+    }
+
+    // Disconnect if once operation failed.
+    if (!result.success)
+    {
+        // TODO: add log.
+        disconnect(false);
+    }
+
+    if (cb)
+        cb(result);
+
+    if (reading_paused_)
+        update_flow();
+}
+
+void tcp_client::send_front()
+{
+    if (write_offset_ == 0)
+        sending_ = std::move(write_requests_.front().data);
+
+    uring_->send(uring_conn_, sending_.data() + write_offset_, sending_.size() - write_offset_);
+}
+
+void tcp_client::set_idle_timeout(std::chrono::milliseconds timeout)
+{
+    std::lock_guard<std::mutex> lock(timer_mutex_);
+
+    idle_timeout_ = timeout.count();
+    last_activity_ = steady_ms();
+    if (idle_timer_)
+    {
+        reactor_->cancel_timer(idle_timer_);
+        idle_timer_ = 0;
+    }
+
+    if (timeout.count() > 0 && is_connected_)
+        start_idle_timer(timeout);
+}
 
-    return cb;
+void tcp_client::set_read_deadline(std::chrono::milliseconds timeout)
+{
+    if (timeout.count() <= 0)
+        update_read_timer(false);
+    read_deadline_ = timeout.count();
+}
+
+reactor::timer_id tcp_client::schedule_timer(std::chrono::milliseconds delay,
+                                             void (tcp_client::*fn)(std::uint64_t),
+                                             std::uint64_t seq)
+{
+    std::shared_ptr<timer_guard> guard = timer_guard_;
+    std::shared_ptr<strand> s = strand_;
+    // Timers fire on any callback worker. Run [fn] on [strand_], after
+    // whatever reads or writes the socket now, not alongside.
+    return reactor_->schedule_timer(delay, [guard, s, fn, seq] {
+        s->post([guard, fn, seq] {
+            std::lock_guard<std::recursive_mutex> lock(guard->mutex);
+            if (guard->client)
+                (guard->client->*fn)(seq);
+        });
+    });
+}
+
+void tcp_client::start_idle_timer(std::chrono::milliseconds delay)
+{
+    idle_timer_seq_ = ++next_timer_seq_;
+    idle_timer_ = schedule_timer(delay, &tcp_client::on_idle_timer, idle_timer_seq_);
+}
+
+void tcp_client::on_idle_timer(std::uint64_t seq)
+{
+    {
+        std::lock_guard<std::mutex> lock(timer_mutex_);
+
+        if (seq != idle_timer_seq_ || idle_timer_ == 0)
+            return;
+        idle_timer_ = 0;
+        if (idle_timeout_ <= 0 || !is_connected_)
+            return;
+
+        // I/O doesn't push the timer back, only records its time.
+        // Sleep on if there was some since it was armed.
+        std::int64_t idle = steady_ms() - last_activity_;
+        if (idle < idle_timeout_)
+        {
+            start_idle_timer(std::chrono::milliseconds{idle_timeout_ - idle});
+            return;
+        }
+    }
+
+    // TODO: add log.
+    disconnect(false);
+}
+
+void tcp_client::on_read_timer(std::uint64_t seq)
+{
+    {
+        std::lock_guard<std::mutex> lock(timer_mutex_);
+
+        if (seq != read_timer_seq_ || read_timer_ == 0)
+            return;
+        read_timer_ = 0;
+    }
+
+    // TODO: add log.
+    disconnect(false);
+}
+
+void tcp_client::touch()
+{
+    if (idle_timeout_ > 0)
+        last_activity_ = steady_ms();
+}
+
+void tcp_client::update_read_timer(bool waiting)
+{
+    if (waiting && read_deadline_ <= 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(timer_mutex_);
+
+    if (waiting && read_timer_ == 0 && is_connected_)
+    {
+        read_timer_seq_ = ++next_timer_seq_;
+        read_timer_ = schedule_timer(std::chrono::milliseconds{read_deadline_.load()},
+                                     &tcp_client::on_read_timer, read_timer_seq_);
+    }
+    else if (!waiting && read_timer_ != 0)
+    {
+        reactor_->cancel_timer(read_timer_);
+        read_timer_ = 0;
+    }
+}
+
+void tcp_client::cancel_timers()
+{
+    std::lock_guard<std::mutex> lock(timer_mutex_);
+
+    for (reactor::timer_id id : { idle_timer_, read_timer_, flow_timer_ })
+        if (id)
+            reactor_->cancel_timer(id);
+    idle_timer_ = read_timer_ = flow_timer_ = 0;
+}
+
+void tcp_client::set_flow_control(const std::shared_ptr<flow_control> &fc)
+{
+    flow_ = fc;
+}
+
+/// How often a client paused by flow_control::max_buffered_bytes checks
+/// whether it may read again.
+static const std::chrono::milliseconds flow_retry_delay{10};
+
+void tcp_client::update_flow()
+{
+    if (!flow_)
+        return;
+
+    std::lock_guard<std::mutex> lock(read_request_mutex_);
+
+    if (!stream_cb_ || !is_connected_)
+        return;
+
+    account_input();
+
+    auto &fc = *flow_;
+    std::size_t bytes = pending_write_bytes_;
+    std::size_t writes = pending_writes_;
+    bool over_marks = (fc.high_watermark && bytes >= fc.high_watermark)
+                   || (fc.high_pending_writes && writes >= fc.high_pending_writes);
+    bool under_marks = (!fc.high_watermark || bytes <= fc.low_watermark)
+                    && (!fc.high_pending_writes || writes <= fc.low_pending_writes);
+    bool over_total = fc.max_buffered_bytes && fc.buffered_bytes >= fc.max_buffered_bytes;
+
+    if (!reading_paused_)
+    {
+        if (over_marks)
+        {
+            fc.watermark_pauses++;
+            pause_reading();
+        }
+        else if (over_total)
+        {
+            fc.buffered_bytes_pauses++;
+            pause_reading();
+        }
+    }
+    else if (under_marks && !over_total)
+        resume_reading();
+
+    // Other clients draining doesn't wake this one up, poll for it.
+    if (reading_paused_ && over_total)
+    {
+        std::lock_guard<std::mutex> timer_lock(timer_mutex_);
+        if (flow_timer_ == 0)
+        {
+            flow_timer_seq_ = ++next_timer_seq_;
+            flow_timer_ = schedule_timer(flow_retry_delay, &tcp_client::on_flow_timer, flow_timer_seq_);
+        }
+    }
+}
+
+void tcp_client::on_flow_timer(std::uint64_t seq)
+{
+    {
+        std::lock_guard<std::mutex> lock(timer_mutex_);
+
+        if (seq != flow_timer_seq_ || flow_timer_ == 0)
+            return;
+        flow_timer_ = 0;
+    }
+
+    update_flow();
+}
+
+void tcp_client::pause_reading()
+{
+    reading_paused_ = true;
+    if (!uring_)
+        watch_readable(false);
+}
+
+void tcp_client::resume_reading()
+{
+    reading_paused_ = false;
+    // release_reading() picks up from here.
+    if (reading_held_)
+        return;
+
+    if (uring_)
+    {
+        // What arrived meanwhile won't trigger on_uring_recv again, nor
+        // will what was left in the buffer for release_reading().
+        if (uring_conn_->is_readable() || redeliver_)
+            uring_->schedule_recv(uring_conn_);
+    }
+    else
+    {
+        watch_readable(true);
+        if (redeliver_)
+        {
+            // Nothing may arrive to trigger the poller.
+            std::shared_ptr<timer_guard> guard = timer_guard_;
+            strand_->post([guard] {
+                std::lock_guard<std::recursive_mutex> lock(guard->mutex);
+                if (guard->client)
+                    guard->client->on_read_available(-1);
+            });
+        }
+    }
+}
+
+void tcp_client::account_input()
+{
+    std::size_t size = rx_buffer_.size();
+    if (size >= rx_accounted_)
+        flow_->buffered_bytes += size - rx_accounted_;
+    else
+        flow_->buffered_bytes -= rx_accounted_ - size;
+    rx_accounted_ = size;
+}
+
+void tcp_client::release_output(std::size_t bytes, std::size_t writes)
+{
+    pending_write_bytes_ -= bytes;
+    pending_writes_ -= writes;
+    if (flow_)
+        flow_->buffered_bytes -= bytes;
 }
 
 bool tcp_client::operator==(const tcp_client &rhs) const
@@ -2,15 +2,28 @@
 #define TCP_SERVER_TCP_CLIENT_HPP
 
 #include <atomic>
+#include <chrono>
+#include <deque>
 #include <functional>
 #include <queue>
 #include <vector>
+#include "flow_control.hpp"
+#include "inline_function.hpp"
+#include "io_buffer.hpp"
+#include "io_uring_service.hpp"
 #include "reactor.hpp"
+#include "shm_channel.hpp"
+#include "strand.hpp"
 #include "tcp_socket.hpp"
 
 namespace cdb_tcp_server {
 
-/// Proactor TCP client class that utilizes reactor.
+/// Proactor TCP client class that utilizes reactor. Its read and write
+/// callbacks run on a strand of its own, so that they never overlap. If
+/// the reactor has io_uring enabled when the client connects, reads and
+/// writes are served by its io_uring_service instead. Over a shm_channel,
+/// they go through shared memory rings, and the socket only tells when
+/// the peer goes away.
 class tcp_client {
 public:
     tcp_client(reactor *r = nullptr);
@@ -18,7 +31,10 @@ public:
     ~tcp_client();
     /// Explicitly disallow move/copy.
     tcp_client(const tcp_client&) = delete;
-    tcp_client(tcp_socket&& socket);
+    /// Serve the connected [socket]. If [shm] is set, bytes go through
+    /// it instead, and [socket] is its control channel.
+    tcp_client(tcp_socket&& socket, reactor *r = nullptr,
+               std::unique_ptr<shm_channel> shm = nullptr);
     tcp_client(tcp_client&&) = delete;
     tcp_client &operator=(const tcp_client&) = delete;
     tcp_client &operator=(tcp_client&&) = delete;
@@ -46,17 +62,41 @@ public:
         std::size_t size;
     };
 
-    typedef std::function<void(read_result&)> read_callback_t;
-    typedef std::function<void(write_result&)> write_callback_t;
+    /// Info struct passed to buffered read callbacks.
+    struct buffered_read_result {
+        /// Indicator.
+        bool success;
+
+        /// The client's input buffer, holding what earlier reads left
+        /// unconsumed followed by the bytes just read. Consume what's
+        /// used; the rest stays for the next read. Not to be touched
+        /// once the next read is queued.
+        io_buffer &buffer;
+    };
+
+    typedef inline_function<void(read_result&)> read_callback_t;
+    typedef inline_function<void(write_result&)> write_callback_t;
+    typedef inline_function<void(buffered_read_result&)> buffered_read_callback_t;
 
     /// Bookkeeping info for read request.
     struct read_request
     {
-        /// Size in bytes.
+        read_request() : size(0) {}
+        /// So that {size, cb} still reads as before [buffered_cb].
+        read_request(std::size_t size, const read_callback_t &cb,
+                     const buffered_read_callback_t &buffered_cb = nullptr)
+            : size(size), cb(cb), buffered_cb(buffered_cb) {}
+
+        /// Size in bytes. For buffered reads, the room made in the input
+        /// buffer beforehand; the read may return more if it has it.
         std::size_t size;
 
         /// Callback when read is done.
         read_callback_t cb;
+
+        /// If set, bytes are read into the client's input buffer instead
+        /// of a new vector, and this is called instead of [cb].
+        buffered_read_callback_t buffered_cb;
     };
     /// Bookkeeping info for write request.
     struct write_request
@@ -72,17 +112,77 @@ public:
     std::uint32_t port() const { return socket_.port(); }
 
     void connect(const std::string &host, std::uint32_t port);
+    /// Same as above, to a Unix domain socket bound at [path].
+    void connect_unix(const std::string &path);
+    /// Same as above, to a tcp_server::listen_shm() socket: bytes then
+    /// go through the shm_channel it hands over.
+    void connect_shm(const std::string &path);
     bool is_connected() const { return is_connected_; }
 
     /// Asynchronously read without blocking the current thread.
     void async_read(const read_request&);
     /// Asynchronously write without blocking the current thread.
     void async_write(const write_request&);
+    /// Same as above, taking over [data] rather than copying it.
+    void async_write(write_request&&);
+
+    /// Streaming reads. [socket_] stays polled and, on every event, is
+    /// read until it would block; the input buffer is then passed to
+    /// [cb], as for buffered reads. [cb] stays installed until
+    /// stop_reading() or disconnection. Not to be mixed with
+    /// async_read().
+    void start_reading(const buffered_read_callback_t &cb);
+    void stop_reading();
+
+    /// Stop streaming reads until release_reading(), e.g. when the
+    /// callback has taken all the input it can for now: what it left in
+    /// the buffer waits there. Unlike stop_reading() the callback stays
+    /// installed, and flow control doesn't resume reading meanwhile.
+    void hold_reading();
+    /// Undo hold_reading(). The bytes left in the buffer are handed to
+    /// the callback again, whether or not more arrive.
+    void release_reading();
+
+    /// Disconnect once nothing was read or written for [timeout].
+    /// Zero, the default, disables it.
+    void set_idle_timeout(std::chrono::milliseconds timeout);
+
+    /// Disconnect when a read request waits longer than [timeout], or in
+    /// streaming mode when bytes left unconsumed by the callback (a
+    /// partial message) aren't consumed in that time. Zero, the
+    /// default, disables it.
+    void set_read_deadline(std::chrono::milliseconds timeout);
+
+    /// Pause streaming reads while [fc]'s limits are exceeded, and count
+    /// this client's buffered bytes against it. To be set before
+    /// start_reading(). nullptr, the default, leaves the client
+    /// unbounded.
+    void set_flow_control(const std::shared_ptr<flow_control> &fc);
+
+    /// Whether flow control currently pauses streaming reads.
+    bool is_reading_paused() const { return reading_paused_; }
+
+    /// Whether responses are still queued for the peer.
+    bool has_pending_writes() const { return pending_writes_ != 0; }
+
+    /// Whether another process could serve the connection from its fd
+    /// alone: a plain socket, neither shm nor io_uring, with nothing
+    /// buffered either way. Only meaningful once reading is stopped
+    /// and the callbacks returned.
+    bool can_hand_over() const;
 
     /// Shut down the connection actively. If [wait] is true, the call
     /// blocks until disconnection completes.
     void disconnect(bool wait);
 
+    /// Block until the reactor callbacks of this client that are queued
+    /// or running have returned. A no-op from within one of them.
+    void wait_for_callbacks();
+
+    /// Run [task] once the reactor callbacks of this client that are
+    /// queued or running have returned, in order with them.
+    void post(const strand::task_t &task);
+
     /// GETTER.
     tcp_socket &socket() { return socket_; }
     const tcp_socket &socket() const { return socket_; }
@@ -107,24 +207,162 @@ private:
     void on_read_available(int);
     void on_write_available(int);
 
+    /// shm mode. [socket_] became readable: the peer went away.
+    void on_control_readable(int);
+
+    /// Poll for input, or for room to write, on [socket_] or on the
+    /// doorbells of [shm_]; or stop polling.
+    void watch_readable(bool watch);
+    void watch_writable(bool watch);
+
     /*
     Read/write the from/to underlying [socket_] used by the above two callbacks.
     */
-    read_callback_t do_read(read_result& result);
-    write_callback_t do_write(write_result &result);
+    /// Start serving [socket_], freshly connected by connect() and the
+    /// like.
+    void on_connected();
+
+    /// Register [socket_], and [shm_]'s doorbells if any, to [reactor_],
+    /// or attach [socket_] to the io_uring_service.
+    void attach_reactor();
+
+    /// Serve the first pending read request, moved to [req]. Return
+    /// false if none is pending.
+    bool do_read(read_request &req, read_result &result);
+
+    /// Run the callback of [req].
+    void complete_read(read_request &req, read_result &result);
+
+    /// Drain [socket_] into [rx_buffer_] in streaming mode. Return the
+    /// callback to run, nullptr if there's nothing to report.
+    std::shared_ptr<buffered_read_callback_t> do_stream_read(bool &success);
+
+    /// Same for bytes received by [uring_conn_].
+    std::shared_ptr<buffered_read_callback_t> do_uring_stream_read(bool &success);
+
+    /// Room to make in [rx_buffer_] before each streaming read.
+    std::size_t stream_read_size() const;
+
+    /// A write request whose bytes are all sent, or that failed.
+    struct write_completion
+    {
+        write_callback_t cb;
+        write_result result;
+    };
+
+    /// Send as many of [write_requests_] as the socket takes, in as few
+    /// syscalls as possible. Requests that are done go to [done], in
+    /// order. Return false if the socket failed.
+    bool do_write(std::vector<write_completion> &done);
+
+    /// Run the callbacks of [done], disconnecting first if the socket
+    /// failed.
+    void complete_writes(bool success, std::vector<write_completion> &done);
+
+    /// Write straight from async_write() on [strand_], without waiting
+    /// for the poller. Callbacks are posted to [strand_].
+    void write_now();
+
+    /// Completions gathered by do_write() on [strand_]. Lent out while
+    /// in use, so that its capacity is reused across writes.
+    std::vector<write_completion> write_done_;
+
+    /*
+    io_uring path. Completions from [uring_conn_], run by the reactor's
+    callback workers.
+    */
+    void start_io_uring();
+    void on_uring_recv();
+    void on_uring_send(int res);
+
+    /*
+    Timers, scheduled on [reactor_].
+    */
+
+    /// Schedule [fn] of this client, to be called with [seq] on
+    /// [strand_]; skipped once the client is destroyed.
+    reactor::timer_id schedule_timer(std::chrono::milliseconds delay,
+                                     void (tcp_client::*fn)(std::uint64_t),
+                                     std::uint64_t seq);
+    void on_idle_timer(std::uint64_t seq);
+    void on_read_timer(std::uint64_t seq);
+
+    /// Arm the idle timer. [timer_mutex_] must be held.
+    void start_idle_timer(std::chrono::milliseconds delay);
+
+    /// Record I/O for the idle timer.
+    void touch();
+
+    /// Arm the read deadline if [waiting] and it isn't, cancel it otherwise.
+    void update_read_timer(bool waiting);
+
+    /// Cancel every timer.
+    void cancel_timers();
+
+    /*
+    Flow control, only in streaming mode.
+    */
+
+    /// Pause or resume streaming reads according to [flow_].
+    void update_flow();
+    void on_flow_timer(std::uint64_t seq);
+
+    /// [read_request_mutex_] must be held.
+    void pause_reading();
+    void resume_reading();
+
+    /// Count what [rx_buffer_] holds against [flow_].
+    /// NOTE: [read_request_mutex_] must be held.
+    void account_input();
+
+    /// [writes] write requests of [bytes] in total are done with.
+    /// NOTE: [write_request_mutex_] must be held.
+    void release_output(std::size_t bytes, std::size_t writes);
+
+    /// Send the unsent part of write_requests_.front().
+    /// NOTE: [write_request_mutex_] must be held.
+    void send_front();
 
 private:
     reactor *reactor_;
 
+    /// Runs the reactor callbacks of [socket_].
+    std::shared_ptr<strand> strand_;
+
+    /// Set in shm mode, which takes precedence over io_uring. Kept until
+    /// destruction or the next connection, so that its fds aren't
+    /// reused while reactor callbacks may still refer to them.
+    std::unique_ptr<shm_channel> shm_;
+
+    /// nullptr when the reactor path is used.
+    io_uring_service *uring_;
+    std::shared_ptr<io_uring_service::connection> uring_conn_;
+
+    /// Bytes of write_requests_.front() already sent.
+    std::size_t write_offset_;
+
+    /// io_uring only. Data of write_requests_.front(), moved out so that
+    /// it outlives clear_write_reqs() while the kernel reads it, and
+    /// whether a send is in flight.
+    std::vector<char> sending_;
+    bool write_in_flight_;
+
     /// Underlying socket.
     tcp_socket socket_;
 
     /// Indicator.
     std::atomic<bool> is_connected_ = ATOMIC_VAR_INIT(false);
 
+    /// Input buffer of buffered reads.
+    io_buffer rx_buffer_;
+
+    /// Streaming read callback, nullptr unless start_reading() is in
+    /// effect. Shared so that a running callback survives stop_reading().
+    std::shared_ptr<buffered_read_callback_t> stream_cb_;
+
     /// Pending requests to the underlying [socket_].
     std::queue<read_request> read_requests_;
-    std::queue<write_request> write_requests_;
+    std::deque<write_request> write_requests_;
 
     void clear_read_reqs();
     void clear_write_reqs();
@@ -135,6 +373,55 @@ private:
 
     /// Called when this client is disconnected.
     on_disconnection_t on_disconnection_;
+
+    /// Shared with timer callbacks and tasks posted to [strand_], which
+    /// only run while [client] is set. The destructor clears it,
+    /// waiting for a running one.
+    struct timer_guard {
+        std::recursive_mutex mutex;
+        tcp_client *client;
+    };
+    std::shared_ptr<timer_guard> timer_guard_;
+
+    /// Timeouts in milliseconds, 0 if disabled.
+    std::atomic<std::int64_t> idle_timeout_;
+    std::atomic<std::int64_t> read_deadline_;
+
+    /// Time of the last I/O, in milliseconds of steady_clock.
+    std::atomic<std::int64_t> last_activity_;
+
+    /// Armed timers, 0 if none, and the sequence number each was armed
+    /// with: a callback whose number doesn't match is stale.
+    std::mutex timer_mutex_;
+    reactor::timer_id idle_timer_;
+    reactor::timer_id read_timer_;
+    std::uint64_t idle_timer_seq_;
+    std::uint64_t read_timer_seq_;
+    std::uint64_t next_timer_seq_;
+
+    /// Flow control, nullptr if unbounded.
+    std::shared_ptr<flow_control> flow_;
+    std::atomic<bool> reading_paused_;
+
+    /// Set by hold_reading(), and [redeliver_] by release_reading() so
+    /// that the next read passes the buffer on even if nothing arrived.
+    /// Written under [read_request_mutex_].
+    std::atomic<bool> reading_held_;
+    bool redeliver_;
+
+    /// Queued output: bytes and write requests not done yet.
+    std::atomic<std::size_t> pending_write_bytes_;
+    std::atomic<std::size_t> pending_writes_;
+
+    /// Bytes of [rx_buffer_] counted in [flow_]. Guarded by
+    /// [read_request_mutex_].
+    std::size_t rx_accounted_;
+
+    /// Re-checks [flow_control::max_buffered_bytes] while paused by it,
+    /// since nothing signals when other clients drain. Guarded by
+    /// [timer_mutex_].
+    reactor::timer_id flow_timer_;
+    std::uint64_t flow_timer_seq_;
 };
 
 }
@@ -1,4 +1,6 @@
-#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <unistd.h>
 #include "exceptions.hpp"
 #include "tcp_server.hpp"
 #include "common.hpp"
@@ -8,8 +10,35 @@ namespace cdb_tcp_server
 
 tcp_server::tcp_server(reactor *r)
     : reactor_(r == nullptr ? get_default_reactor() : r)
+    , client_pool_(new slab_pool)
+    , accept_batch_(TCP_SERVER_ACCEPT_BATCH)
+    , accept_timer_(0)
+    , flow_(new flow_control)
     , on_new_connection_cb_(nullptr) {}
 
+tcp_server::tcp_server(std::size_t num_reactors, std::size_t workers_per_reactor)
+    : reactor_(nullptr)
+    , client_pool_(new slab_pool)
+    , accept_batch_(TCP_SERVER_ACCEPT_BATCH)
+    , accept_timer_(0)
+    , flow_(new flow_control)
+    , on_new_connection_cb_(nullptr)
+{
+    if (num_reactors == 0)
+        __TCP_THROW("tcp_server needs at least one reactor");
+
+    unsigned int num_cpus = std::thread::hardware_concurrency();
+    io_reactors_.reserve(num_reactors);
+    for (std::size_t i = 0; i < num_reactors; i++)
+    {
+        io_reactors_.emplace_back(new reactor{workers_per_reactor});
+        if (num_cpus)
+            io_reactors_.back()->set_cpu_affinity(i % num_cpus);
+    }
+
+    reactor_ = io_reactors_.front().get();
+}
+
 tcp_server::~tcp_server()
 {
     stop();
@@ -20,72 +49,591 @@ void tcp_server::start(const std::string &host, std::uint32_t port, const on_new
     if (is_running_)
         __TCP_THROW("tcp_server is already running");
 
-    socket_.bind(host, port);
-    socket_.listen(TCP_SERVER_BACK_LOG);
+    // Listening sockets taken over from a predecessor are used as is.
+    try
+    {
+        if (socket_.fd() == -1)
+        {
+            socket_.bind(host, port);
+            socket_.listen(TCP_SERVER_BACK_LOG);
+        }
+        else
+        {
+            socket_.host() = host;
+            socket_.port() = port;
+        }
+
+        if (!unix_path_.empty() && unix_socket_.fd() == -1)
+        {
+            unix_socket_.bind_unix(unix_path_);
+            unix_socket_.listen(TCP_SERVER_BACK_LOG);
+        }
+        if (!shm_path_.empty() && shm_socket_.fd() == -1)
+        {
+            shm_socket_.bind_unix(shm_path_);
+            shm_socket_.listen(TCP_SERVER_BACK_LOG);
+        }
+        if (!handoff_path_.empty() && handoff_socket_.fd() == -1)
+        {
+            handoff_socket_.bind_unix(handoff_path_);
+            handoff_socket_.listen(TCP_SERVER_BACK_LOG);
+        }
+    }
+    catch (const std::runtime_error &e)
+    {
+        socket_.close();
+        unix_socket_.close();
+        shm_socket_.close();
+        handoff_socket_.close();
+        throw;
+    }
 
-    // Register the listening fd.
-    reactor_->register_fd(socket_.fd(), std::bind(&tcp_server::on_read_available, this, std::placeholders::_1));
+    // Register the listening fds.
     on_new_connection_cb_ = cb;
-
     is_running_ = true;
+    for (tcp_socket *listener : { &socket_, &unix_socket_, &shm_socket_, &handoff_socket_ })
+        if (listener->fd() != -1)
+            reactor_->register_fd(listener->fd());
+    watch_listeners(true);
+
+    std::vector<tcp_socket> inherited;
+    inherited.swap(inherited_clients_);
+    for (auto &accepted : inherited)
+    {
+        try
+        {
+            add_client(std::move(accepted), false);
+        }
+        catch(const std::exception& e)
+        {
+            // Only this connection is lost.
+            // TODO: add log.
+        }
+    }
 }
 
-// The fd will always be the listening fd.
-void tcp_server::on_read_available(int)
+void tcp_server::watch_listeners(bool watch)
 {
-    try
-    {
-        // NOTE: we're limited to C++11 here, so make_shared is not available.
-        std::shared_ptr<tcp_client> client{new tcp_client(socket_.accept())};
+    reactor::event_handler_t cb = nullptr;
+    if (watch)
+        cb = std::bind(&tcp_server::on_read_available, this, std::placeholders::_1);
 
-        if (on_new_connection_cb_)
-            on_new_connection_cb_(client);
+    for (tcp_socket *listener : { &socket_, &unix_socket_, &shm_socket_, &handoff_socket_ })
+        if (listener->fd() != -1)
+            reactor_->set_rd_callback(listener->fd(), cb);
+}
+
+/// How long accepting pauses when out of fds.
+static const std::chrono::milliseconds accept_retry_delay{100};
+
+// [fd] is one of the listening fds.
+void tcp_server::on_read_available(int fd)
+{
+    if (fd == handoff_socket_.fd())
+    {
+        tcp_socket successor;
+        try
+        {
+            if (handoff_socket_.try_accept(successor) != tcp_socket::accept_status::ACCEPTED)
+                return;
+        }
+        catch(const std::exception& e)
+        {
+            // TODO: add log.
+            return;
+        }
 
-        // If client::on_disconnection_ is set by on_new_connection_cb_,
-        // make sure we'll call it too.
-        if (client->on_disconnection())
-            client->on_disconnection() = std::bind(
-                &tcp_server::on_client_disconnect, 
-                this, 
-                client,
-                client->on_disconnection());
+        // One successor at a time.
+        std::lock_guard<std::mutex> lock(handoff_mutex_);
+        if (handoff_thread_.joinable() || !is_running_)
+            successor.close();
         else
-            client->on_disconnection() = std::bind(
-                &tcp_server::on_client_disconnect, 
-                this, 
-                client, 
-                nullptr);
+            handoff_thread_ = std::thread(&tcp_server::hand_off, this, std::move(successor));
+        return;
+    }
+
+    tcp_socket &listener = fd == unix_socket_.fd() ? unix_socket_
+                         : fd == shm_socket_.fd() ? shm_socket_
+                         : socket_;
+    bool shm = &listener == &shm_socket_;
+
+    std::size_t batch = accept_batch_;
+    for (std::size_t i = 0; i < batch && is_running_; i++)
+    {
+        tcp_socket accepted;
+        tcp_socket::accept_status status;
+        try
+        {
+            status = listener.try_accept(accepted);
+        }
+        catch(const std::exception& e)
+        {
+            // The listening socket itself is broken.
+            // TODO: add log.
+            stop();
+            return;
+        }
 
-        // Append the client to internal client list.
-        clients_.emplace_back(client);
+        if (status == tcp_socket::accept_status::WOULD_BLOCK)
+            return;
+
+        if (status == tcp_socket::accept_status::NO_RESOURCES)
+        {
+            flow_->accept_pauses++;
+            pause_accepting();
+            return;
+        }
+
+        try
+        {
+            add_client(std::move(accepted), shm);
+        }
+        catch(const std::exception& e)
+        {
+            // Only this connection is lost.
+            // TODO: add log.
+        }
     }
-    catch(const std::exception& e)
+
+    // The rest of the backlog keeps the socket readable, so that the
+    // next event picks it up.
+}
+
+void tcp_server::add_client(tcp_socket &&accepted, bool shm)
+{
+    std::size_t max_connections = max_connections_;
+    if (max_connections)
     {
-        // TODO: add log.
-        stop();
+        std::lock_guard<std::mutex> lock(clients_mutex_);
+        if (clients_.size() >= max_connections)
+        {
+            flow_->rejected_connections++;
+            accepted.close();
+            return;
+        }
     }
+
+    // Best effort: raising it past net.core.busy_read takes
+    // CAP_NET_ADMIN.
+    if (std::uint32_t usec = socket_busy_poll_)
+        accepted.set_busy_poll(usec);
+
+    // The socket is fresh: handing the channel over doesn't block.
+    std::unique_ptr<shm_channel> channel;
+    if (shm)
+    {
+        try
+        {
+            channel = shm_channel::create(shm_ring_size_);
+            channel->send_to(accepted);
+        }
+        catch (const std::runtime_error &e)
+        {
+            accepted.close();
+            throw;
+        }
+    }
+
+    // The client and its control block take one pooled block.
+    std::shared_ptr<tcp_client> client = std::allocate_shared<tcp_client>(
+        slab_allocator<tcp_client>(client_pool_), std::move(accepted), pick_reactor(), std::move(channel));
+    client->set_flow_control(flow_);
+
+    // Tracked before the user sees it, so that a disconnection from
+    // within [on_new_connection_cb_] finds it.
+    connection_table::connection_id id;
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex_);
+        id = clients_.insert(client);
+    }
+
+    if (on_new_connection_cb_)
+        on_new_connection_cb_(client);
+
+    // If client::on_disconnection_ is set by on_new_connection_cb_,
+    // make sure we'll call it too. Bound to the id rather than to
+    // [client], which would keep itself alive.
+    if (client->on_disconnection())
+        client->on_disconnection() = std::bind(
+            &tcp_server::on_client_disconnect, 
+            this, 
+            id,
+            client->on_disconnection());
+    else
+        client->on_disconnection() = std::bind(
+            &tcp_server::on_client_disconnect, 
+            this, 
+            id, 
+            nullptr);
+
+    // Disconnected before the above was installed. Removing twice
+    // is harmless: the id is stale the second time.
+    if (!client->is_connected())
+        on_client_disconnect(id, nullptr);
+}
+
+void tcp_server::pause_accepting()
+{
+    std::lock_guard<std::mutex> lock(accept_timer_mutex_);
+
+    if (accept_timer_ || !is_running_)
+        return;
+
+    // The pending connections stay queued in the kernel meanwhile.
+    watch_listeners(false);
+    accept_timer_ = reactor_->schedule_timer(accept_retry_delay,
+                                             std::bind(&tcp_server::on_accept_timer, this));
+}
+
+void tcp_server::on_accept_timer()
+{
+    std::lock_guard<std::mutex> lock(accept_timer_mutex_);
+
+    if (!accept_timer_)
+        return;
+    accept_timer_ = 0;
+
+    if (is_running_)
+        watch_listeners(true);
+}
+
+reactor *tcp_server::pick_reactor()
+{
+    if (io_reactors_.empty())
+        return reactor_;
+
+    // Least-loaded, starting from a rotating index so that equally
+    // loaded reactors take turns.
+    std::size_t start = next_reactor_.fetch_add(1);
+    reactor *best = nullptr;
+    std::size_t best_load = 0;
+    for (std::size_t i = 0; i < io_reactors_.size(); i++)
+    {
+        reactor *r = io_reactors_[(start + i) % io_reactors_.size()].get();
+        std::size_t load = r->register_num();
+        if (best == nullptr || load < best_load)
+        {
+            best = r;
+            best_load = load;
+        }
+    }
+
+    return best;
 }
 
 void tcp_server::stop()
 {
+    // A handoff under way stops the server itself.
+    std::thread handoff;
+    {
+        std::lock_guard<std::mutex> lock(handoff_mutex_);
+        if (handoff_thread_.get_id() != std::this_thread::get_id())
+            handoff.swap(handoff_thread_);
+    }
+    if (handoff.joinable())
+        handoff.join();
+
     if (!is_running_)
         return;
 
     is_running_ = false;
+    {
+        std::lock_guard<std::mutex> lock(accept_timer_mutex_);
+        if (accept_timer_)
+            reactor_->cancel_timer(accept_timer_);
+        accept_timer_ = 0;
+    }
     reactor_->unregister(socket_.fd());
     socket_.close();
+    if (unix_socket_.fd() != -1)
+    {
+        reactor_->unregister(unix_socket_.fd());
+        unix_socket_.close();
+        ::unlink(unix_path_.c_str());
+    }
+    if (shm_socket_.fd() != -1)
+    {
+        reactor_->unregister(shm_socket_.fd());
+        shm_socket_.close();
+        ::unlink(shm_path_.c_str());
+    }
+    if (handoff_socket_.fd() != -1)
+    {
+        reactor_->unregister(handoff_socket_.fd());
+        handoff_socket_.close();
+        ::unlink(handoff_path_.c_str());
+    }
 
-    std::lock_guard<std::mutex> lock(clients_mutex_);
-    for (auto &c : clients_)
+    std::vector<std::shared_ptr<tcp_client>> clients;
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex_);
+        clients_.take_all(clients);
+        // Left in place: each is erased by its own release task.
+        clients.insert(clients.end(), retired_clients_.begin(), retired_clients_.end());
+    }
+
+    for (auto &c : clients)
+        c->disconnect(true);
+
+    // Clients that disconnected on their own may still be in their
+    // last callback.
+    for (auto &c : clients)
+        c->wait_for_callbacks();
+}
+
+/*
+Handoff. The predecessor sends its listening sockets, then each client it
+hands over, then DONE; each message is a handoff_message with the fds it
+carries.
+*/
+
+enum handoff_kind : std::uint32_t
+{
+    HANDOFF_LISTENERS = 1,
+    HANDOFF_CLIENT,
+    HANDOFF_DONE,
+};
+
+struct handoff_message {
+    char magic[8];
+    std::uint32_t kind;
+    /// LISTENERS: bit i is set if the i-th listening socket comes
+    /// along, in the order TCP, Unix, shm, handoff.
+    std::uint32_t listeners;
+    /// CLIENT: where the peer is.
+    std::uint32_t port;
+    char host[128];
+};
+
+static const char handoff_magic[8] = { 'c', 'd', 'b', 'h', 'o', 'f', '0', '1' };
+
+/// Fds a message carries at most.
+static const std::size_t handoff_max_fds = 4;
+
+static handoff_message make_handoff_message(handoff_kind kind)
+{
+    handoff_message msg;
+    std::memset(&msg, 0, sizeof(msg));
+    std::memcpy(msg.magic, handoff_magic, sizeof(msg.magic));
+    msg.kind = kind;
+    return msg;
+}
+
+/// Read [size] bytes from [sock] into [data], and the fds that come
+/// along into [fds]. Return false if the peer is gone first.
+static bool recv_handoff(tcp_socket &sock, void *data, std::size_t size, std::vector<int> &fds)
+{
+    char *p = static_cast<char*>(data);
+    std::size_t received = 0;
+    while (received < size)
+    {
+        int buf[handoff_max_fds];
+        std::size_t count;
+        std::size_t n = sock.recv_fds(p + received, size - received, buf, handoff_max_fds, count);
+        fds.insert(fds.end(), buf, buf + count);
+        if (n == 0)
+            return false;
+        received += n;
+    }
+    return true;
+}
+
+bool tcp_server::take_over(const std::string &path)
+{
+    if (is_running_)
+        __TCP_THROW("tcp_server is already running");
+
+    tcp_socket predecessor;
+    try
+    {
+        predecessor.connect_unix(path);
+    }
+    catch (const std::runtime_error &e)
+    {
+        // Nobody to take over from.
+        return false;
+    }
+
+    // Bound to the same paths as the predecessor's, if configured the
+    // same way; those this server doesn't listen on are closed.
+    tcp_socket *listeners[] = { &socket_, &unix_socket_, &shm_socket_, &handoff_socket_ };
+    const std::string *paths[] = { nullptr, &unix_path_, &shm_path_, &handoff_path_ };
+
+    std::vector<int> fds;
+    try
+    {
+        for (bool done = false; !done; )
+        {
+            handoff_message msg;
+            fds.clear();
+            if (!recv_handoff(predecessor, &msg, sizeof(msg), fds)
+                || std::memcmp(msg.magic, handoff_magic, sizeof(msg.magic)) != 0)
+                break;
+            msg.host[sizeof(msg.host) - 1] = '\0';
+
+            std::size_t next = 0;
+            switch (msg.kind)
+            {
+            case HANDOFF_LISTENERS:
+                for (std::size_t i = 0; i < 4 && next < fds.size(); i++)
+                {
+                    if (!(msg.listeners & (1u << i)))
+                        continue;
+
+                    int fd = fds[next++];
+                    if (paths[i] && paths[i]->empty())
+                        ::close(fd);
+                    else
+                        *listeners[i] = tcp_socket(fd, paths[i] ? *paths[i] : "", 0, tcp_socket::type::SERVER);
+                }
+                break;
+            case HANDOFF_CLIENT:
+                if (!fds.empty())
+                    inherited_clients_.emplace_back(fds[next++], msg.host, msg.port, tcp_socket::type::CLIENT);
+                break;
+            case HANDOFF_DONE:
+                done = true;
+                break;
+            }
+
+            for (; next < fds.size(); next++)
+                ::close(fds[next]);
+        }
+    }
+    catch (const std::runtime_error &e)
+    {
+        // The predecessor broke off; start with what came through.
+    }
+
+    predecessor.close();
+    return true;
+}
+
+void tcp_server::hand_off(tcp_socket successor)
+{
+    // Stop accepting: connections wait in the backlog for the successor.
+    is_running_ = false;
+    {
+        std::lock_guard<std::mutex> lock(accept_timer_mutex_);
+        if (accept_timer_)
+            reactor_->cancel_timer(accept_timer_);
+        accept_timer_ = 0;
+    }
+
+    tcp_socket *listeners[] = { &socket_, &unix_socket_, &shm_socket_, &handoff_socket_ };
+    for (tcp_socket *listener : listeners)
+        if (listener->fd() != -1)
+            reactor_->unregister(listener->fd());
+    for (tcp_socket *listener : listeners)
+        if (listener->fd() != -1)
+            reactor_->wait_on_removal_cond(listener->fd());
+
+    std::vector<std::shared_ptr<tcp_client>> clients;
+    std::vector<std::shared_ptr<tcp_client>> retired;
+    {
+        std::lock_guard<std::mutex> lock(clients_mutex_);
+        clients_.take_all(clients);
+        retired.assign(retired_clients_.begin(), retired_clients_.end());
+    }
+
+    // Let requests being served run to completion, then their
+    // responses drain.
+    for (auto &c : clients)
+        c->stop_reading();
+    for (auto &c : clients)
+        c->wait_for_callbacks();
+    for (auto &c : retired)
+        c->wait_for_callbacks();
+    retired.clear();
+    if (on_drain_cb_)
+        on_drain_cb_();
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(TCP_SERVER_HANDOFF_DRAIN_TIMEOUT);
+    for (auto &c : clients)
+        while (c->is_connected() && c->has_pending_writes() && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    if (on_handoff_cb_)
+        on_handoff_cb_();
+
+    try
+    {
+        handoff_message msg = make_handoff_message(HANDOFF_LISTENERS);
+        int fds[handoff_max_fds];
+        std::size_t fd_count = 0;
+        for (std::size_t i = 0; i < 4; i++)
+        {
+            if (listeners[i]->fd() == -1)
+                continue;
+            msg.listeners |= 1u << i;
+            fds[fd_count++] = listeners[i]->fd();
+        }
+        successor.send_fds(&msg, sizeof(msg), fds, fd_count);
+
+        for (auto &c : clients)
+        {
+            if (!c->can_hand_over())
+                continue;
+
+            msg = make_handoff_message(HANDOFF_CLIENT);
+            msg.port = c->port();
+            std::strncpy(msg.host, c->host().c_str(), sizeof(msg.host) - 1);
+            int fd = c->socket().fd();
+            successor.send_fds(&msg, sizeof(msg), &fd, 1);
+        }
+
+        msg = make_handoff_message(HANDOFF_DONE);
+        successor.send_fds(&msg, sizeof(msg), nullptr, 0);
+    }
+    catch (const std::runtime_error &e)
+    {
+        // The successor went away mid-way. It starts afresh once back.
+        // TODO: add log.
+    }
+    successor.close();
+
+    // Only this process' copies are closed: the connections go on in the
+    // successor, which also keeps the socket files.
+    for (tcp_socket *listener : listeners)
+        listener->close();
+    for (auto &c : clients)
         c->disconnect(true);
 
-    clients_.clear();
+    handed_off_ = true;
+}
+
+bool tcp_server::enable_io_uring()
+{
+    if (io_reactors_.empty())
+        return reactor_->enable_io_uring();
+
+    bool enabled = true;
+    for (auto &r : io_reactors_)
+        enabled = r->enable_io_uring() && enabled;
+    return enabled;
+}
+
+void tcp_server::set_busy_poll(std::chrono::microseconds spin, std::uint32_t socket_usec)
+{
+    socket_busy_poll_ = socket_usec;
+
+    if (io_reactors_.empty())
+        reactor_->set_busy_poll(spin);
+    for (auto &r : io_reactors_)
+        r->set_busy_poll(spin);
+}
+
+void tcp_server::set_cpu_affinity(const std::vector<int> &poll_cpus, const std::vector<int> &worker_cpus)
+{
+    for (std::size_t i = 0; i < io_reactors_.size(); i++)
+        io_reactors_[i]->set_cpu_affinity(poll_cpus.empty() ? -1 : poll_cpus[i % poll_cpus.size()],
+                                          worker_cpus.empty() ? -1 : worker_cpus[i % worker_cpus.size()]);
 }
 
 /// Called by tcp_client::diconnect(). This method simply
-/// remove [client] from the underlying bookkeeping container.
+/// remove the client from the underlying bookkeeping container.
 void 
-tcp_server::on_client_disconnect(std::shared_ptr<tcp_client> client, 
+tcp_server::on_client_disconnect(connection_table::connection_id id, 
                                  const tcp_client::on_disconnection_t &user_cb)
 {
     if (!is_running_)   return;
@@ -94,12 +642,24 @@ tcp_server::on_client_disconnect(std::shared_ptr<tcp_client> client,
     if (user_cb)
         user_cb();
 
-    /* Erase from the list. */
+    /* Erase from the table. */
     std::lock_guard<std::mutex> lock(clients_mutex_);
-    auto it = std::find(clients_.begin(), clients_.end(), client);
+    std::shared_ptr<tcp_client> client = clients_.remove(id);
+    if (!client)
+        return;
 
-    if (it != clients_.end())
-        clients_.erase(it);
+    // Kept until its callbacks are done, rather than released from
+    // within one of them; stop() and hand_off() take what's left.
+    tcp_client *retired = client.get();
+    auto it = retired_clients_.insert(retired_clients_.end(), std::move(client));
+    retired->post([this, it] {
+        std::shared_ptr<tcp_client> last;
+        {
+            std::lock_guard<std::mutex> lock(clients_mutex_);
+            last = std::move(*it);
+            retired_clients_.erase(it);
+        }
+    });
 }
 
 } // namespace cdb_tcp_server
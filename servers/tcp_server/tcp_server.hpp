@@ -3,8 +3,14 @@
 
 #include <atomic>
 #include <list>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 #include <functional>
+#include "common.hpp"
+#include "connection_table.hpp"
 #include "tcp_socket.hpp"
 #include "tcp_client.hpp"
 #include "reactor.hpp"
@@ -16,6 +22,11 @@ class tcp_server
 {
 public:
     tcp_server(reactor *r = nullptr);
+    /// Multi-reactor mode. The server owns [num_reactors] reactors with
+    /// [workers_per_reactor] callback workers each, pinned one per core.
+    /// The first one also polls the listening socket; accepted clients
+    /// go to whichever reactor tracks the fewest fds.
+    tcp_server(std::size_t num_reactors, std::size_t workers_per_reactor);
     /// Rule of 5.
     ~tcp_server();
     tcp_server(const tcp_server&) = delete;
@@ -28,21 +39,123 @@ public:
     /// Start TCP server.
     void start(const std::string &host, std::uint32_t port, const on_new_connection_cb_t &cb);
 
+    /// Also accept connections on a Unix domain socket bound to [path],
+    /// for clients on the same host. To be called before start(); the
+    /// socket file is removed by stop().
+    void listen_unix(const std::string &path) { unix_path_ = path; }
+
+    /// Same as above, but clients accepted there are handed a
+    /// shm_channel (rings of [ring_size] bytes each way) and exchange
+    /// bytes through shared memory; see tcp_client::connect_shm().
+    void listen_shm(const std::string &path, std::size_t ring_size = TCP_SERVER_SHM_RING_SIZE)
+    {
+        shm_path_ = path;
+        shm_ring_size_ = ring_size;
+    }
+
+    /// Let a successor take this server over, see take_over(), by
+    /// connecting to a Unix domain socket bound to [path]. To be called
+    /// before start(); the socket is handed over with the others.
+    void listen_handoff(const std::string &path) { handoff_path_ = path; }
+
+    typedef std::function<void()> on_handoff_cb_t;
+
+    /// [cb] is called, on a thread of its own, once a successor has
+    /// connected and the clients are drained: nothing is accepted or
+    /// read anymore, their callbacks have returned and their responses
+    /// are sent. Whatever state the clients were served from belongs to
+    /// the successor once it returns.
+    void set_handoff_callback(const on_handoff_cb_t &cb) { on_handoff_cb_ = cb; }
+
+    /// [cb] is called during a handoff once the clients' callbacks have
+    /// returned, before their responses drain. It returns once the work
+    /// those callbacks left running elsewhere is done and its responses
+    /// are written, so that they drain with the others.
+    void set_drain_callback(const on_handoff_cb_t &cb) { on_drain_cb_ = cb; }
+
+    /// Take over the server accepting handoffs at [path], if any, to
+    /// start() in its place: its listening sockets are used rather than
+    /// bound again, and its idle clients are served as if just accepted;
+    /// the others are closed. Blocks until the predecessor has drained
+    /// and stepped down. To be called after the listen_*() above and
+    /// before start(). Return false if nothing accepts at [path].
+    bool take_over(const std::string &path);
+
+    /// Whether this server was taken over by a successor, and stopped.
+    bool is_handed_off() const { return handed_off_; }
+
     /// Stop TCP server.
     void stop();
 
+    /// Serve clients accepted from now on through io_uring. Return
+    /// false if some reactor can't, in which case its clients keep
+    /// using readiness callbacks.
+    bool enable_io_uring();
+
+    /// Connections beyond [max] are closed as soon as they're accepted.
+    /// 0, the default, means no limit.
+    void set_max_connections(std::size_t max) { max_connections_ = max; }
+
+    /// At most [batch] connections are accepted per readiness event
+    /// of the listening socket, TCP_SERVER_ACCEPT_BATCH by default.
+    void set_accept_batch(std::size_t batch) { accept_batch_ = batch == 0 ? 1 : batch; }
+
+    /// Busy-poll the reactors serving this server, see
+    /// reactor::set_busy_poll(). Accepted sockets also get SO_BUSY_POLL
+    /// for [socket_usec] microseconds, unless 0.
+    void set_busy_poll(std::chrono::microseconds spin, std::uint32_t socket_usec = 0);
+
+    /// Multi-reactor mode. Pin the polling thread of the i-th reactor
+    /// to [poll_cpus][i % size] and its workers to [worker_cpus][i % size],
+    /// rather than both to core i. An empty list leaves those threads
+    /// as they are.
+    void set_cpu_affinity(const std::vector<int> &poll_cpus, const std::vector<int> &worker_cpus);
+
+    /// Limits and counters shared by every client of this server. Set
+    /// the limits before start().
+    flow_control &get_flow_control() { return *flow_; }
+
     /* GETTER. */
     tcp_socket &socket() { return socket_; }
     const tcp_socket &socket() const { return socket_; }
 
 private:
-    /// Callback when we can call socket_.accept() without blocking.
+    /// Callback when we can accept on the listening socket [fd] without
+    /// blocking. Drains the backlog, up to [accept_batch_] connections.
     void on_read_available(int fd);
 
-    /// Callback when tcp_client::disconnect() is called.
-    void on_client_disconnect(std::shared_ptr<tcp_client>, const tcp_client::on_disconnection_t &user_cb = nullptr);
+    /// Poll the listening sockets, or stop polling them.
+    void watch_listeners(bool watch);
+
+    /// Step down in favor of [successor], accepted on [handoff_socket_].
+    /// Runs on [handoff_thread_].
+    void hand_off(tcp_socket successor);
+
+    /// Track [accepted] and hand it to [on_new_connection_cb_], after
+    /// handing it a shm_channel if [shm].
+    void add_client(tcp_socket &&accepted, bool shm);
+
+    /// Out of fds: stop polling the listening socket for a while rather
+    /// than spin on it, and resume on [accept_timer_].
+    void pause_accepting();
+    void on_accept_timer();
+
+    /// Callback when tcp_client::disconnect() is called on the client
+    /// tracked as [id].
+    void on_client_disconnect(connection_table::connection_id id, const tcp_client::on_disconnection_t &user_cb = nullptr);
+
+    /// Reactor a newly accepted client should be served by.
+    reactor *pick_reactor();
 
 private:
+    /// Reactors owned in multi-reactor mode. Declared first so that
+    /// they outlive every client tracked by them.
+    std::vector<std::unique_ptr<reactor>> io_reactors_;
+
+    /// Where [pick_reactor] starts looking, so that ties rotate.
+    std::atomic<std::size_t> next_reactor_ = ATOMIC_VAR_INIT(0);
+
+    /// Polls the listening socket.
     reactor *reactor_;
 
     /// Indicator.
@@ -51,17 +164,64 @@ private:
     /// Underlying listening socket.
     tcp_socket socket_;
 
+    /// Unix domain listening socket, if [unix_path_] isn't empty.
+    std::string unix_path_;
+    tcp_socket unix_socket_;
+
+    /// Same for clients served over a shm_channel.
+    std::string shm_path_;
+    std::size_t shm_ring_size_ = TCP_SERVER_SHM_RING_SIZE;
+    tcp_socket shm_socket_;
+
+    /// Accepts a successor, if [handoff_path_] isn't empty.
+    std::string handoff_path_;
+    tcp_socket handoff_socket_;
+
+    /// Set once a successor connected. Guarded by [handoff_mutex_].
+    std::thread handoff_thread_;
+    std::mutex handoff_mutex_;
+
+    on_handoff_cb_t on_handoff_cb_;
+    on_handoff_cb_t on_drain_cb_;
+    std::atomic<bool> handed_off_ = ATOMIC_VAR_INIT(false);
+
+    /// Taken over from the predecessor, served once started.
+    std::vector<tcp_socket> inherited_clients_;
+
     /// Underlying bookkeeping container.
     /// NOTE: We've chose to use shared_ptr because the [on_new_connection_cb_]
     /// can obtain the pointer to a client and use it later. By using unique_ptr,
     /// there'd be a possibility that the user of tcp_server accidentally access
     /// a dangling ptr.
-    /// TODO: Change this to std::set
-    std::list<std::shared_ptr<tcp_client>> clients_;
+    connection_table clients_;
+
+    /// Clients removed from [clients_], released from their strand
+    /// once their callbacks, disconnect() among them, have returned.
+    /// A list, so that each erases itself in O(1) by its iterator.
+    std::list<std::shared_ptr<tcp_client>> retired_clients_;
 
     /// Thread safety.
     std::mutex clients_mutex_;
 
+    /// Memory of accepted clients, reused once they're released.
+    std::shared_ptr<slab_pool> client_pool_;
+
+    /// Limit on [clients_], 0 if none.
+    std::atomic<std::size_t> max_connections_ = ATOMIC_VAR_INIT(0);
+
+    /// Connections accepted per event.
+    std::atomic<std::size_t> accept_batch_;
+
+    /// SO_BUSY_POLL of accepted sockets, 0 to leave it alone.
+    std::atomic<std::uint32_t> socket_busy_poll_ = ATOMIC_VAR_INIT(0);
+
+    /// Armed while accepting is paused, 0 otherwise.
+    std::mutex accept_timer_mutex_;
+    reactor::timer_id accept_timer_;
+
+    /// Shared with the clients, which may outlive the server.
+    std::shared_ptr<flow_control> flow_;
+
     /// Callback when a new TCP connection is established.
     on_new_connection_cb_t on_new_connection_cb_;
 };
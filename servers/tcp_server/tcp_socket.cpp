@@ -1,9 +1,15 @@
+#include <cstddef>
 #include <cstring>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <arpa/inet.h>
 #include <errno.h>
 
@@ -49,6 +55,19 @@ tcp_socket::tcp_socket(tcp_socket &&sock)
     sock.type_ = type::UNKNOWN;
 }
 
+/// Accepted sockets are non-blocking. Block until [fd] has [events],
+/// for the operations that are meant to block.
+static void wait_for(int fd, short events)
+{
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+    while (::poll(&pfd, 1, -1) < 0)
+        if (errno != EINTR)
+            __TCP_THROW("error poll()");
+}
+
 /*
 CLIENT operations
 */
@@ -60,7 +79,15 @@ std::vector<char> tcp_socket::recv(std::size_t size)
 
     std::vector<char> data(size, 0);
     char *data_ptr = data.data();
-    ssize_t data_len = ::recv(fd_, data_ptr, size, 0);
+    ssize_t data_len;
+    while ((data_len = ::recv(fd_, data_ptr, size, 0)) < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            wait_for(fd_, POLLIN);
+        else if (errno != EINTR)
+            break;
+    }
+
     if (data_len < 0)
         // Throw to close the connection.
         __TCP_THROW("error recv()");
@@ -97,6 +124,54 @@ std::vector<char> tcp_socket::recv(std::size_t size)
     return data;
 }
 
+std::size_t tcp_socket::recv_into(char *buf, std::size_t size)
+{
+    ensure_fd();
+    ensure_type(type::CLIENT);
+
+    ssize_t data_len;
+    while ((data_len = ::recv(fd_, buf, size, 0)) < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            wait_for(fd_, POLLIN);
+        else if (errno != EINTR)
+            break;
+    }
+
+    if (data_len < 0)
+        // Throw to close the connection.
+        __TCP_THROW("error recv()");
+
+    if (data_len == 0)
+        // Throw to close the connection.
+        __TCP_THROW("nothing to read");
+
+    return data_len;
+}
+
+std::size_t tcp_socket::try_recv_into(char *buf, std::size_t size)
+{
+    ensure_fd();
+    ensure_type(type::CLIENT);
+
+    for (;;)
+    {
+        ssize_t data_len = ::recv(fd_, buf, size, MSG_DONTWAIT);
+        if (data_len > 0)
+            return static_cast<std::size_t>(data_len);
+
+        if (data_len == 0)
+            // Throw to close the connection.
+            __TCP_THROW("nothing to read");
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        if (errno != EINTR)
+            // Throw to close the connection.
+            __TCP_THROW("error recv()");
+    }
+}
+
 void tcp_socket::send(const std::vector<char> &data)
 {
     ensure_fd();
@@ -114,10 +189,11 @@ void tcp_socket::send(const std::vector<char> &data)
 #endif
         if (n < 0)
         {
-            if (errno == EINTR)
-                n = 0;
-            else
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                wait_for(fd_, POLLOUT);
+            else if (errno != EINTR)
                 __TCP_THROW("error send()");
+            n = 0;
         }
 
         data_ptr += n;
@@ -125,6 +201,34 @@ void tcp_socket::send(const std::vector<char> &data)
     }
 }
 
+std::size_t tcp_socket::sendv(const struct iovec *iov, std::size_t iovcnt)
+{
+    ensure_fd();
+    ensure_type(type::CLIENT);
+
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = const_cast<struct iovec*>(iov);
+    msg.msg_iovlen = iovcnt;
+
+    for (;;)
+    {
+#ifdef __linux__
+        // Prevent SIGPIPE from terminating the process.
+        ssize_t n = ::sendmsg(fd_, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+#else
+        ssize_t n = ::sendmsg(fd_, &msg, MSG_DONTWAIT);
+#endif
+        if (n >= 0)
+            return static_cast<std::size_t>(n);
+
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        if (errno != EINTR)
+            __TCP_THROW("error sendmsg()");
+    }
+}
+
 void tcp_socket::connect(const std::string &host, std::uint32_t port)
 {
     host_ = host;
@@ -158,6 +262,144 @@ void tcp_socket::connect(const std::string &host, std::uint32_t port)
     }
 }
 
+/// Fill [addr] with [path]. Throw if it doesn't fit.
+static socklen_t unix_address(const std::string &path, struct sockaddr_un &addr)
+{
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(addr.sun_path))
+        __TCP_THROW("invalid unix socket path");
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+    return static_cast<socklen_t>(offsetof(struct sockaddr_un, sun_path) + path.size() + 1);
+}
+
+void tcp_socket::connect_unix(const std::string &path)
+{
+    struct sockaddr_un addr;
+    socklen_t len = unix_address(path, addr);
+
+    host_ = path;
+    port_ = 0;
+
+    ensure_fd(AF_UNIX);
+    ensure_type(type::CLIENT);
+
+    if (::connect(fd_, reinterpret_cast<struct sockaddr*>(&addr), len) < 0)
+    {
+        close();
+        __TCP_THROW("error connect()");
+    }
+}
+
+void tcp_socket::send_fds(const void *data, std::size_t size, const int *fds, std::size_t fd_count)
+{
+    if (size == 0)
+        __TCP_THROW("send_fds() needs at least one byte");
+
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * fd_count), 0);
+
+    struct iovec iov{ const_cast<void*>(data), size };
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (fd_count)
+    {
+        msg.msg_control = control.data();
+        msg.msg_controllen = control.size();
+
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+        std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+    }
+
+    const char *p = static_cast<const char*>(data);
+    std::size_t sent = 0;
+    while (sent < size)
+    {
+        // Prevent SIGPIPE from terminating the process.
+        ssize_t n = ::sendmsg(fd_, &msg, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                wait_for(fd_, POLLOUT);
+            else if (errno != EINTR)
+                __TCP_THROW("error sendmsg()");
+            continue;
+        }
+
+        // The fds went along with the first byte.
+        sent += n;
+        iov.iov_base = const_cast<char*>(p + sent);
+        iov.iov_len = size - sent;
+        msg.msg_control = nullptr;
+        msg.msg_controllen = 0;
+    }
+}
+
+std::size_t tcp_socket::recv_fds(void *data, std::size_t size, int *fds, std::size_t max_fds, std::size_t &fd_count)
+{
+    // Room for a few more than expected, so that they can be closed.
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * (max_fds + 8)), 0);
+
+    struct iovec iov{ data, size };
+    struct msghdr msg;
+    std::memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+
+    int flags = 0;
+#ifdef MSG_CMSG_CLOEXEC
+    flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+    ssize_t n;
+    for (;;)
+    {
+        n = ::recvmsg(fd_, &msg, flags);
+        if (n >= 0)
+            break;
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            wait_for(fd_, POLLIN);
+        else if (errno != EINTR)
+            __TCP_THROW("error recvmsg()");
+    }
+
+    fd_count = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        std::size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        const char *p = reinterpret_cast<const char*>(CMSG_DATA(cmsg));
+        for (std::size_t i = 0; i < count; i++)
+        {
+            int fd;
+            std::memcpy(&fd, p + i * sizeof(int), sizeof(int));
+            if (fd_count < max_fds)
+                fds[fd_count++] = fd;
+            else
+                ::close(fd);
+        }
+    }
+
+    // Some fds were dropped on the way: none of them can be trusted.
+    if (msg.msg_flags & MSG_CTRUNC)
+    {
+        for (std::size_t i = 0; i < fd_count; i++)
+            ::close(fds[i]);
+        fd_count = 0;
+        __TCP_THROW("fds lost in recvmsg()");
+    }
+
+    return static_cast<std::size_t>(n);
+}
+
 /*
 SERVER operations
 */
@@ -179,11 +421,42 @@ void tcp_socket::bind(const std::string &host, std::uint32_t port)
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr = reinterpret_cast<struct sockaddr_in*>(result->ai_addr)->sin_addr;
     server_addr.sin_port = htons(port);
+    freeaddrinfo(result);
 
     if (::bind(fd_, reinterpret_cast<struct sockaddr*>(&server_addr), sizeof(server_addr)) == -1)
         __TCP_THROW("error bind()");
 }
 
+void tcp_socket::bind_unix(const std::string &path)
+{
+    struct sockaddr_un addr;
+    socklen_t len = unix_address(path, addr);
+
+    host_ = path;
+    port_ = 0;
+
+    ensure_fd(AF_UNIX);
+    ensure_type(type::SERVER);
+
+    // A socket file outlives its process. Replace it unless someone
+    // still accepts on it.
+    struct stat st;
+    if (::lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        bool in_use = probe != -1
+                   && ::connect(probe, reinterpret_cast<struct sockaddr*>(&addr), len) == 0;
+        if (probe != -1)
+            ::close(probe);
+        if (in_use)
+            __TCP_THROW("unix socket path already in use");
+        ::unlink(path.c_str());
+    }
+
+    if (::bind(fd_, reinterpret_cast<struct sockaddr*>(&addr), len) == -1)
+        __TCP_THROW("error bind()");
+}
+
 void tcp_socket::listen(std::size_t backlog)
 {
     ensure_fd();
@@ -191,20 +464,94 @@ void tcp_socket::listen(std::size_t backlog)
 
     if (::listen(fd_, backlog) == -1)
         __TCP_THROW("error listen()");
+
+    // So that the accept loop stops once the backlog is drained.
+    int flags = ::fcntl(fd_, F_GETFL, 0);
+    if (flags == -1 || ::fcntl(fd_, F_SETFL, flags | O_NONBLOCK) == -1)
+        __TCP_THROW("error fcntl()");
 }
 
 tcp_socket tcp_socket::accept()
+{
+    tcp_socket accepted;
+    for (;;)
+    {
+        switch (try_accept(accepted))
+        {
+        case accept_status::ACCEPTED:
+            return accepted;
+        case accept_status::WOULD_BLOCK:
+            wait_for(fd_, POLLIN);
+            break;
+        case accept_status::NO_RESOURCES:
+            __TCP_THROW("error accept()");
+        }
+    }
+}
+
+tcp_socket::accept_status tcp_socket::try_accept(tcp_socket &accepted)
 {
     ensure_fd();
     ensure_type(type::SERVER);
 
-    struct sockaddr_in client_info;
-    socklen_t client_info_len = sizeof(client_info);
-    int client_fd = ::accept(fd_, reinterpret_cast<struct sockaddr*>(&client_info), &client_info_len);
-    if (client_fd == -1)
-        __TCP_THROW("error accept()");
+    for (;;)
+    {
+        struct sockaddr_storage client_info;
+        socklen_t client_info_len = sizeof(client_info);
+#ifdef __linux__
+        int client_fd = ::accept4(fd_, reinterpret_cast<struct sockaddr*>(&client_info), &client_info_len,
+                                  SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+        int client_fd = ::accept(fd_, reinterpret_cast<struct sockaddr*>(&client_info), &client_info_len);
+        if (client_fd != -1)
+        {
+            ::fcntl(client_fd, F_SETFL, ::fcntl(client_fd, F_GETFL, 0) | O_NONBLOCK);
+            ::fcntl(client_fd, F_SETFD, FD_CLOEXEC);
+        }
+#endif
+        if (client_fd != -1)
+        {
+            if (client_info.ss_family == AF_INET)
+            {
+                // Responses go out as soon as they're written; Nagle
+                // would hold the second of two behind a delayed ACK.
+                int nodelay = 1;
+                ::setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+                auto *in = reinterpret_cast<struct sockaddr_in*>(&client_info);
+                accepted = tcp_socket{client_fd, inet_ntoa(in->sin_addr), in->sin_port, type::CLIENT};
+            }
+            else
+                // Unix domain peers are unnamed.
+                accepted = tcp_socket{client_fd, host_, 0, type::CLIENT};
+            return accept_status::ACCEPTED;
+        }
 
-    return {client_fd, inet_ntoa(client_info.sin_addr), client_info.sin_port, type::CLIENT};
+        switch (errno)
+        {
+        case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+        case EWOULDBLOCK:
+#endif
+            return accept_status::WOULD_BLOCK;
+
+        case EMFILE:
+        case ENFILE:
+        case ENOBUFS:
+        case ENOMEM:
+            return accept_status::NO_RESOURCES;
+
+        // The peer gave up while queued, or got interrupted: try the
+        // next one.
+        case EINTR:
+        case ECONNABORTED:
+        case EPROTO:
+            break;
+
+        default:
+            __TCP_THROW("error accept()");
+        }
+    }
 }
 
 void tcp_socket::close()
@@ -218,16 +565,28 @@ void tcp_socket::close()
     type_ = type::UNKNOWN;
 }
 
-void tcp_socket::ensure_fd()
+bool tcp_socket::set_busy_poll(std::uint32_t usec)
+{
+#ifdef SO_BUSY_POLL
+    int optval = static_cast<int>(usec);
+    return ::setsockopt(fd_, SOL_SOCKET, SO_BUSY_POLL, &optval, sizeof(optval)) == 0;
+#else
+    (void)usec;
+    return false;
+#endif
+}
+
+void tcp_socket::ensure_fd(int domain)
 {
     if (fd_ != -1)
         return;
 
-    fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    fd_ = ::socket(domain, SOCK_STREAM, 0);
     type_ = type::UNKNOWN;
 
     int optval = 1;
-    ::setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
+    if (domain == AF_INET)
+        ::setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
 
 #ifdef __APPLE__
     // Prevent SIGPIPE from terminating the process.
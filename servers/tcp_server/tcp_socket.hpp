@@ -3,13 +3,28 @@
 
 #include <string>
 #include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 namespace cdb_tcp_server
 {
 
-/// A simple wrapper around socket interface provided by *nix.
+/// A simple wrapper around socket interface provided by *nix. Stream
+/// sockets over TCP/IPv4, or over Unix domain sockets for peers on the
+/// same host.
 class tcp_socket {
 public:
+    /// Outcome of try_accept().
+    enum class accept_status
+    {
+        /// A connection was accepted.
+        ACCEPTED,
+        /// The backlog is empty.
+        WOULD_BLOCK,
+        /// Out of fds or kernel memory; the connection stays queued.
+        NO_RESOURCES,
+    };
+
     /// Type of the socket.
     enum class type
     {
@@ -45,12 +60,40 @@ public:
     /// Read in at most [size] bytes.
     std::vector<char> recv(std::size_t size);
 
+    /// Same as above, into caller-provided memory. Return the number of
+    /// bytes read.
+    std::size_t recv_into(char *buf, std::size_t size);
+
+    /// Same as above without blocking. Return 0 if nothing is available
+    /// yet; a closed connection still throws.
+    std::size_t try_recv_into(char *buf, std::size_t size);
+
     /// Write at most [size] bytes.
     void send(const std::vector<char> &data);
 
+    /// Write as much of [iov] as the socket takes without blocking, in
+    /// a single syscall. Return the number of bytes written, 0 if it
+    /// would block.
+    std::size_t sendv(const struct iovec *iov, std::size_t iovcnt);
+
     /// Connect to remote server.
     void connect(const std::string &host, std::uint32_t port);
 
+    /// Connect to the Unix domain socket bound at [path].
+    void connect_unix(const std::string &path);
+
+    /// Unix domain sockets only. Write [size] bytes of [data] along with
+    /// [fds] (SCM_RIGHTS), which the peer receives as fds of its own.
+    /// Blocks until all of it is written, even if non-blocking.
+    void send_fds(const void *data, std::size_t size, const int *fds, std::size_t fd_count);
+
+    /// Read what send_fds() wrote: up to [size] bytes into [data], and
+    /// up to [max_fds] fds, close-on-exec, into [fds] ([fd_count] is
+    /// set to their number; extra ones are closed). Blocks until
+    /// something arrives. Return the number of bytes read, 0 if the
+    /// peer closed the connection.
+    std::size_t recv_fds(void *data, std::size_t size, int *fds, std::size_t max_fds, std::size_t &fd_count);
+
 public:
     /*
     SERVER operations.
@@ -58,9 +101,22 @@ public:
 
     /// Bind to address [host:port].
     void bind(const std::string &host, uint32_t port);
+
+    /// Bind a Unix domain socket to [path]. A socket file left there by
+    /// a process that's gone is replaced; one still accepting throws.
+    void bind_unix(const std::string &path);
+
+    /// The listening socket is made non-blocking.
     void listen(std::size_t backlog);
+
+    /// Block until a connection is accepted.
     tcp_socket accept(void);
 
+    /// Accept a connection into [accepted] without blocking. Accepted
+    /// sockets are non-blocking and close-on-exec, TCP ones TCP_NODELAY. Those accepted on a
+    /// Unix domain socket take its path as host and 0 as port.
+    accept_status try_accept(tcp_socket &accepted);
+
 public:
     /*
     Helpers.
@@ -74,6 +130,11 @@ public:
     type get_type() const { return type_; }
     void set_type(type t) { type_ = t; }
 
+    /// Have the kernel busy-poll the device queue for up to [usec]
+    /// microseconds when a read finds nothing (SO_BUSY_POLL), 0 to
+    /// stop. Return false if unsupported or not permitted.
+    bool set_busy_poll(std::uint32_t usec);
+
     /// Underlying socket.
     int fd() const { return fd_; }
     int &fd() { return fd_; }
@@ -82,7 +143,9 @@ public:
     bool operator!=(const tcp_socket &rhs) const;
 
 private:
-    void ensure_fd();
+    /// Create the socket if there is none yet, of [domain] (AF_INET or
+    /// AF_UNIX).
+    void ensure_fd(int domain = AF_INET);
     void ensure_type(type t);
 
 private:
@@ -1,10 +1,28 @@
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 #include "thread_pool.hpp"
 
 namespace cdb_tcp_server
 {
 
+bool set_thread_affinity(std::thread &t, int cpu)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return ::pthread_setaffinity_np(t.native_handle(), sizeof(set), &set) == 0;
+#else
+    (void)t;
+    (void)cpu;
+    return false;
+#endif
+}
+
 thread_pool::thread_pool(std::size_t thread_num)
-    : stop_(false), thread_num_(thread_num)
+    : stop_(false), thread_num_(thread_num), cpu_(-1), spin_(0), queued_(0)
 {
     workers_.reserve(thread_num);
     for (std::size_t i = 0; i < thread_num; i++)
@@ -21,12 +39,12 @@ void thread_pool::init_worker()
 {
     while (!should_stop())
     {
-        task_t task = fetch_task();
+        pool_task *task = fetch_task();
 
         if (task)
         {
             try {
-                task();
+                task->run();
             } catch (const std::exception& e) {
                 // TODO: add log.
             }
@@ -34,24 +52,47 @@ void thread_pool::init_worker()
     }
 }
 
-thread_pool::task_t thread_pool::fetch_task()
+pool_task *thread_pool::fetch_task()
 {
+    if (spin_.load(std::memory_order_relaxed) > 0)
+        spin_for_task();
+
     std::unique_lock<std::mutex> lock(tasks_mutex);
 
     tasks_cond.wait(lock, [&] { return this->should_stop() || !tasks_.empty(); });
     if (should_stop() || tasks_.empty())
         return nullptr;
 
-    task_t task = std::move(tasks_.front());
+    pool_task *task = tasks_.front();
     tasks_.pop();
+    queued_.fetch_sub(1, std::memory_order_relaxed);
     return task;
 }
 
+void thread_pool::spin_for_task()
+{
+    auto deadline = std::chrono::steady_clock::now()
+                  + std::chrono::microseconds(spin_.load(std::memory_order_relaxed));
+
+    while (queued_.load(std::memory_order_relaxed) == 0 && !should_stop())
+    {
+        if (std::chrono::steady_clock::now() >= deadline)
+            return;
+        cpu_relax();
+    }
+}
+
 void thread_pool::add_task(const task_t &task)
+{
+    add_task(new function_task(task));
+}
+
+void thread_pool::add_task(pool_task *task)
 {
     std::lock_guard<std::mutex> lock(tasks_mutex);
 
     tasks_.push(task);
+    queued_.fetch_add(1, std::memory_order_relaxed);
     tasks_cond.notify_all();
 }
 
@@ -66,6 +107,14 @@ void thread_pool::stop()
     // Prevent join from being called multiple times on the same
     // worker.
     workers_.clear();
+
+    std::lock_guard<std::mutex> lock(tasks_mutex);
+    while (!tasks_.empty())
+    {
+        tasks_.front()->discard();
+        tasks_.pop();
+    }
+    queued_ = 0;
 }
 
 bool thread_pool::should_stop()
@@ -79,7 +128,11 @@ void thread_pool::set_thread_num(std::size_t num)
 
     if (workers_.size() < thread_num_)
         while (workers_.size() < thread_num_)
+        {
             workers_.push_back(std::thread(std::bind(&thread_pool::init_worker, this)));
+            if (cpu_ != -1)
+                set_thread_affinity(workers_.back(), cpu_);
+        }
     else
         // Since [thread_num_] is updated, some fast workers
         // will exit their loops.
@@ -91,4 +144,16 @@ std::size_t thread_pool::get_thread_num() const
     return thread_num_;
 }
 
+void thread_pool::set_cpu_affinity(int cpu)
+{
+    cpu_ = cpu;
+    for (auto &worker : workers_)
+        set_thread_affinity(worker, cpu);
+}
+
+void thread_pool::set_spin(std::chrono::microseconds spin)
+{
+    spin_ = spin.count() > 0 ? spin.count() : 0;
+}
+
 } // namespace cdb_tcp_server
@@ -3,15 +3,32 @@
 
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <mutex>
 #include <condition_variable>
 #include <vector>
 #include <queue>
 #include <functional>
+#include "pool_task.hpp"
 
 namespace cdb_tcp_server
 {
 
+/// Pin [t] to [cpu]. Return false if the platform doesn't support it
+/// or the call fails.
+bool set_thread_affinity(std::thread &t, int cpu);
+
+/// Hint the CPU that the calling thread is spinning.
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
 /// Simple thread pool.
 class thread_pool {
 public:
@@ -23,15 +40,27 @@ public:
 
 public:
     /// Only allow void(*)() task type.
-    typedef std::function<void()> task_t;
+    typedef inline_function<void()> task_t;
 
     /// Task to be performed by workers.
     void add_task(const task_t &task);
 
+    /// Same as above without allocating. [task] must stay alive until
+    /// it has run or was discarded.
+    void add_task(pool_task *task);
+
     /// Number of underlying workers.
     void set_thread_num(std::size_t num);
     std::size_t get_thread_num() const;
 
+    /// Pin every worker, including those added later, to [cpu].
+    void set_cpu_affinity(int cpu);
+
+    /// Idle workers watch for tasks for [spin] before sleeping on
+    /// [tasks_cond], so that a task added meanwhile starts without a
+    /// wakeup. 0, the default, sleeps right away.
+    void set_spin(std::chrono::microseconds spin);
+
     /// Stop the thread pool.
     void stop();
 
@@ -43,8 +72,11 @@ private:
     /// Worker initialization.
     void init_worker();
 
-    /// Fetch a task from tasks_.
-    task_t fetch_task();
+    /// Fetch a task from tasks_. nullptr if the worker should stop.
+    pool_task *fetch_task();
+
+    /// Spin until [tasks_] looks non-empty or [spin_] has passed.
+    void spin_for_task();
 
     /// Return true to terminate a worker.
     bool should_stop();
@@ -58,8 +90,16 @@ private:
     /// Number of thread workers.
     std::atomic<std::size_t> thread_num_;
 
-    /// Underlying tasks to run by [workers_]
-    std::queue<task_t> tasks_;
+    /// CPU the workers are pinned to. -1 if not pinned.
+    int cpu_;
+
+    /// Microseconds idle workers spin for.
+    std::atomic<std::int64_t> spin_;
+
+    /// Underlying tasks to run by [workers_]. [queued_] mirrors its size
+    /// for the spinning workers, which don't take the lock.
+    std::queue<pool_task*> tasks_;
+    std::atomic<std::size_t> queued_;
 
     /// Thread safety.
     std::mutex tasks_mutex;
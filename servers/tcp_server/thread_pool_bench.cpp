@@ -0,0 +1,112 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include "thread_pool.hpp"
+#include "work_stealing_pool.hpp"
+
+using cdb_tcp_server::thread_pool;
+using cdb_tcp_server::work_stealing_pool;
+
+/// Compares thread_pool and work_stealing_pool on two workloads:
+///
+///   dispatch: one thread adds every task, like the reactor's polling
+///             thread does.
+///   fan-out:  one thread adds tasks that each add [fan_out] tasks from
+///             inside the pool.
+///
+/// Usage: thread_pool_bench [tasks]
+
+/// Tasks spin for about this many iterations, roughly the cost of a
+/// small callback.
+static const int task_work = 200;
+static const std::size_t fan_out = 16;
+
+static std::atomic<std::size_t> done;
+static std::size_t expected;
+static std::mutex done_mutex;
+static std::condition_variable done_cond;
+
+static void do_work()
+{
+    volatile int sink = 0;
+    for (int i = 0; i < task_work; i++)
+        sink = sink + i;
+
+    if (done.fetch_add(1) + 1 == expected)
+    {
+        std::lock_guard<std::mutex> lock(done_mutex);
+        done_cond.notify_all();
+    }
+}
+
+static void wait_done()
+{
+    std::unique_lock<std::mutex> lock(done_mutex);
+    done_cond.wait(lock, [] { return done.load() == expected; });
+}
+
+template <typename Pool>
+static double run_dispatch(std::size_t workers, std::size_t tasks)
+{
+    Pool pool(workers);
+    done = 0;
+    expected = tasks;
+
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < tasks; i++)
+        pool.add_task(&do_work);
+    wait_done();
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double>(end - start).count();
+}
+
+template <typename Pool>
+static double run_fan_out(std::size_t workers, std::size_t tasks)
+{
+    Pool pool(workers);
+    std::size_t parents = tasks / fan_out;
+    done = 0;
+    expected = parents * fan_out;
+
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < parents; i++)
+        pool.add_task([&pool] {
+            for (std::size_t j = 0; j < fan_out; j++)
+                pool.add_task(&do_work);
+        });
+    wait_done();
+    auto end = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double>(end - start).count();
+}
+
+static void report(const char *workload, const char *pool, std::size_t workers,
+                   std::size_t tasks, double seconds)
+{
+    std::printf("%-9s %-19s %3zu workers  %8.3f ms  %7.2f Mtasks/s\n",
+                workload, pool, workers, seconds * 1e3, tasks / seconds / 1e6);
+}
+
+int main(int argc, char **argv)
+{
+    std::size_t tasks = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+    const std::size_t worker_nums[] = { 2, 8, 32 };
+
+    for (std::size_t workers : worker_nums)
+    {
+        report("dispatch", "thread_pool", workers, tasks,
+               run_dispatch<thread_pool>(workers, tasks));
+        report("dispatch", "work_stealing_pool", workers, tasks,
+               run_dispatch<work_stealing_pool>(workers, tasks));
+        report("fan-out", "thread_pool", workers, tasks,
+               run_fan_out<thread_pool>(workers, tasks));
+        report("fan-out", "work_stealing_pool", workers, tasks,
+               run_fan_out<work_stealing_pool>(workers, tasks));
+    }
+
+    return 0;
+}
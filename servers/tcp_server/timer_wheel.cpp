@@ -0,0 +1,188 @@
+#include "timer_wheel.hpp"
+
+namespace cdb_tcp_server
+{
+
+const unsigned timer_wheel::slot_bits;
+const std::size_t timer_wheel::slots;
+const std::size_t timer_wheel::levels;
+
+timer_wheel::timer_wheel()
+    : free_list_(-1)
+    , size_(0)
+    , current_(0)
+{
+    for (auto &head : heads_)
+        head = -1;
+    for (auto &n : level_size_)
+        n = 0;
+}
+
+timer_wheel::timer_id timer_wheel::schedule(std::uint64_t ticks, const callback_t &cb)
+{
+    std::int32_t idx;
+    if (free_list_ != -1)
+    {
+        idx = free_list_;
+        free_list_ = nodes_[idx].next;
+    }
+    else
+    {
+        idx = static_cast<std::int32_t>(nodes_.size());
+        nodes_.push_back(node());
+        nodes_[idx].generation = 0;
+    }
+
+    auto &n = nodes_[idx];
+    n.active = true;
+    n.expiry = current_ + (ticks == 0 ? 1 : ticks);
+    n.cb = cb;
+    insert(idx);
+    size_++;
+
+    // Generations start at 1 so that no id is 0.
+    return (static_cast<timer_id>(n.generation + 1) << 32) | static_cast<std::uint32_t>(idx);
+}
+
+bool timer_wheel::cancel(timer_id id)
+{
+    std::uint32_t idx = static_cast<std::uint32_t>(id);
+    std::uint32_t generation = static_cast<std::uint32_t>(id >> 32) - 1;
+    if (idx >= nodes_.size())
+        return false;
+
+    auto &n = nodes_[idx];
+    if (!n.active || n.generation != generation)
+        return false;
+
+    unlink(idx);
+    release(idx);
+    size_--;
+    return true;
+}
+
+void timer_wheel::advance(std::uint64_t now, std::vector<callback_t> &expired)
+{
+    // Nothing to walk through.
+    if (size_ == 0 && now > current_)
+        current_ = now;
+
+    while (current_ < now)
+    {
+        current_++;
+
+        // Whenever a level wraps around, the next slot of the level
+        // above gets close enough to be spread over the levels below.
+        for (std::size_t level = 1; level < levels; level++)
+        {
+            if ((current_ & ((std::uint64_t{1} << (slot_bits * level)) - 1)) != 0)
+                break;
+            cascade(level, (current_ >> (slot_bits * level)) & (slots - 1));
+        }
+
+        auto &head = heads_[current_ & (slots - 1)];
+        while (head != -1)
+        {
+            std::int32_t idx = head;
+            unlink(idx);
+            expired.push_back(std::move(nodes_[idx].cb));
+            release(idx);
+            size_--;
+        }
+
+        if (size_ == 0)
+            current_ = now;
+    }
+}
+
+std::int64_t timer_wheel::next_timeout() const
+{
+    if (size_ == 0)
+        return -1;
+
+    // Upper levels cascade when level 0 wraps around.
+    std::int64_t timeout = -1;
+    if (size_ != level_size_[0])
+        timeout = slots - (current_ & (slots - 1));
+
+    if (level_size_[0] != 0)
+    {
+        for (std::size_t i = 1; i < slots; i++)
+        {
+            if (timeout != -1 && static_cast<std::int64_t>(i) >= timeout)
+                break;
+            if (heads_[(current_ + i) & (slots - 1)] != -1)
+                return i;
+        }
+    }
+
+    return timeout;
+}
+
+void timer_wheel::insert(std::int32_t idx)
+{
+    auto &n = nodes_[idx];
+    std::uint64_t delta = n.expiry - current_;
+
+    std::size_t level = 0;
+    while (level + 1 < levels && delta >= (std::uint64_t{1} << (slot_bits * (level + 1))))
+        level++;
+
+    // Beyond the wheel's range. Park in the farthest slot, the timer
+    // is placed again when that slot cascades.
+    std::uint64_t expiry = n.expiry;
+    std::uint64_t range = std::uint64_t{1} << (slot_bits * levels);
+    if (delta >= range)
+        expiry = current_ + range - 1;
+
+    std::size_t slot = (expiry >> (slot_bits * level)) & (slots - 1);
+    n.list = static_cast<std::uint32_t>(level * slots + slot);
+
+    auto &head = heads_[n.list];
+    n.prev = -1;
+    n.next = head;
+    if (head != -1)
+        nodes_[head].prev = idx;
+    head = idx;
+    level_size_[level]++;
+}
+
+void timer_wheel::unlink(std::int32_t idx)
+{
+    auto &n = nodes_[idx];
+    if (n.prev != -1)
+        nodes_[n.prev].next = n.next;
+    else
+        heads_[n.list] = n.next;
+
+    if (n.next != -1)
+        nodes_[n.next].prev = n.prev;
+
+    level_size_[n.list / slots]--;
+}
+
+void timer_wheel::release(std::int32_t idx)
+{
+    auto &n = nodes_[idx];
+    n.active = false;
+    n.generation++;
+    n.cb = nullptr;
+    n.next = free_list_;
+    free_list_ = idx;
+}
+
+void timer_wheel::cascade(std::size_t level, std::size_t slot)
+{
+    std::int32_t idx = heads_[level * slots + slot];
+    heads_[level * slots + slot] = -1;
+
+    while (idx != -1)
+    {
+        std::int32_t next = nodes_[idx].next;
+        level_size_[level]--;
+        insert(idx);
+        idx = next;
+    }
+}
+
+} // namespace cdb_tcp_server
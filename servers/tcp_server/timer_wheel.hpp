@@ -0,0 +1,99 @@
+#ifndef TCP_SERVER_TIMER_WHEEL_HPP
+#define TCP_SERVER_TIMER_WHEEL_HPP
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+#include "inline_function.hpp"
+
+namespace cdb_tcp_server
+{
+
+/// Hierarchical timer wheel counting in abstract ticks. Level 0 has
+/// one slot per tick; each further level has slots [slots] times as
+/// wide and is cascaded down one level whenever the level below wraps
+/// around. Scheduling and cancelling are O(1).
+///
+/// Not thread-safe; the reactor guards it and drives it from its
+/// polling thread.
+class timer_wheel {
+public:
+    timer_wheel();
+
+    timer_wheel(const timer_wheel&) = delete;
+    timer_wheel& operator=(const timer_wheel&) = delete;
+
+public:
+    typedef inline_function<void()> callback_t;
+
+    /// Identifies a scheduled timer. Never 0, and never reused for
+    /// another timer.
+    typedef std::uint64_t timer_id;
+
+    /// Fire [cb] once [ticks] ticks have passed, at least one.
+    timer_id schedule(std::uint64_t ticks, const callback_t &cb);
+
+    /// Return false if [id] already fired or was cancelled.
+    bool cancel(timer_id id);
+
+    /// Move time forward to [now], appending the callbacks of expired
+    /// timers to [expired] in expiry order.
+    void advance(std::uint64_t now, std::vector<callback_t> &expired);
+
+    /// Ticks until the wheel needs to be advanced again, -1 if no
+    /// timer is scheduled. That's when the first timer expires or
+    /// when a cascade may bring one closer, whichever comes first.
+    std::int64_t next_timeout() const;
+
+    /// Current time.
+    std::uint64_t now() const { return current_; }
+
+    /// Number of timers scheduled.
+    std::size_t size() const { return size_; }
+
+private:
+    static const unsigned slot_bits = 6;
+    static const std::size_t slots = 1 << slot_bits;
+    static const std::size_t levels = 4;
+
+    /// Links are indices into [nodes_]; -1 is null.
+    struct node {
+        std::int32_t prev;
+        std::int32_t next;
+
+        /// Bumped whenever the node is freed, so that stale ids don't match.
+        std::uint32_t generation;
+        bool active;
+
+        /// List the node is on, as level * slots + slot.
+        std::uint32_t list;
+        std::uint64_t expiry;
+        callback_t cb;
+    };
+
+    /// Put [idx] on the list its expiry falls in.
+    void insert(std::int32_t idx);
+    void unlink(std::int32_t idx);
+    void release(std::int32_t idx);
+
+    /// Re-insert everything in slot [slot] of [level].
+    void cascade(std::size_t level, std::size_t slot);
+
+private:
+    std::vector<node> nodes_;
+    std::int32_t free_list_;
+
+    /// Head of every slot's list.
+    std::int32_t heads_[levels * slots];
+
+    /// Timers per level.
+    std::size_t level_size_[levels];
+    std::size_t size_;
+
+    std::uint64_t current_;
+};
+
+} // namespace cdb_tcp_server
+
+
+#endif
@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include "tcp_server.hpp"
+
+using cdb_tcp_server::shm_channel;
+using cdb_tcp_server::tcp_server;
+using cdb_tcp_server::tcp_client;
+using cdb_tcp_server::tcp_socket;
+
+/// Compares the transports a same-host client can reach a tcp_server
+/// through: TCP loopback, a Unix domain socket and a shm_channel. One
+/// server listens on all of them and echoes lines back; a blocking
+/// client does round trips, one request at a time, then in batches of
+/// [batch] requests written at once, over each transport in turn. Over
+/// the shm_channel, the client sleeps on its doorbells when it has to
+/// wait, as the server does.
+///
+/// Usage: transport_bench [requests] [batch]
+
+static const std::uint32_t bench_port = 3004;
+static const char bench_path[] = "/tmp/cdb_transport_bench.sock";
+static const char bench_shm_path[] = "/tmp/cdb_transport_bench_shm.sock";
+static const char request[] = "GET key:000000000000\n";
+static const std::size_t request_size = sizeof(request) - 1;
+
+/// Echo every complete line back.
+static void echo(tcp_client *client, tcp_client::buffered_read_result &result)
+{
+    if (!result.success)
+        return;
+
+    auto &buffer = result.buffer;
+    while (const void *eol = std::memchr(buffer.data(), '\n', buffer.size()))
+    {
+        std::size_t n = static_cast<const char*>(eol) - buffer.data() + 1;
+        client->async_write({ std::vector<char>(buffer.data(), buffer.data() + n), nullptr });
+        buffer.consume(n);
+    }
+}
+
+static int connect_tcp()
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    int nodelay = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+
+    struct sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(bench_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0)
+    {
+        std::perror("connect");
+        std::exit(2);
+    }
+    return fd;
+}
+
+static int connect_unix()
+{
+    int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    std::strcpy(addr.sun_path, bench_path);
+    if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0)
+    {
+        std::perror("connect");
+        std::exit(2);
+    }
+    return fd;
+}
+
+static void wait_readable(int fd)
+{
+    struct pollfd pfd{ fd, POLLIN, 0 };
+    ::poll(&pfd, 1, -1);
+}
+
+/// Send [batch] requests at once and wait for all the responses.
+static void round_trip(int fd, const std::string &requests)
+{
+    if (::send(fd, requests.data(), requests.size(), 0) != static_cast<ssize_t>(requests.size()))
+    {
+        std::perror("send");
+        std::exit(2);
+    }
+
+    static char response[65536];
+    std::size_t received = 0;
+    while (received < requests.size())
+    {
+        ssize_t n = ::recv(fd, response, std::min(sizeof(response), requests.size() - received), 0);
+        if (n <= 0)
+        {
+            std::perror("recv");
+            std::exit(2);
+        }
+        received += n;
+    }
+}
+
+/// Same as above over [channel].
+static void shm_round_trip(shm_channel &channel, const std::string &requests)
+{
+    std::size_t sent = 0;
+    while (sent < requests.size())
+    {
+        struct iovec iov{ const_cast<char*>(requests.data()) + sent, requests.size() - sent };
+        sent += channel.sendv(&iov, 1);
+        if (sent < requests.size())
+            wait_readable(channel.space_fd());
+    }
+
+    static char response[65536];
+    std::size_t received = 0;
+    while (received < requests.size())
+    {
+        std::size_t n = channel.try_recv_into(response, std::min(sizeof(response), requests.size() - received));
+        if (n == 0)
+            wait_readable(channel.data_fd());
+        received += n;
+    }
+}
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    std::size_t idx = static_cast<std::size_t>(p * (sorted.size() - 1));
+    return sorted[idx];
+}
+
+typedef std::function<void(const std::string&)> round_trip_t;
+
+static void run(const char *name, const round_trip_t &round_trip, std::size_t requests, std::size_t batch)
+{
+    std::string requests_str;
+    for (std::size_t i = 0; i < batch; i++)
+        requests_str += request;
+
+    for (int i = 0; i < 1000; i++)
+        round_trip(requests_str);
+
+    std::size_t rounds = std::max<std::size_t>(requests / batch, 1);
+    std::vector<double> latencies;
+    latencies.reserve(rounds);
+
+    auto begin = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < rounds; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        round_trip(requests_str);
+        std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+        latencies.push_back(elapsed.count());
+    }
+    std::chrono::duration<double> total = std::chrono::steady_clock::now() - begin;
+
+    std::sort(latencies.begin(), latencies.end());
+    std::printf("%-6s batch %-4zu  %10.0f requests/s  p50 %8.2f us  p99 %8.2f us\n",
+                name, batch, rounds * batch / total.count(),
+                percentile(latencies, 0.50), percentile(latencies, 0.99));
+}
+
+int main(int argc, char **argv)
+{
+    std::size_t requests = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    std::size_t batch = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 32;
+    if (batch == 0 || batch * request_size > 65536)
+    {
+        std::fprintf(stderr, "batch out of range\n");
+        return 2;
+    }
+
+    tcp_server server{1, 1};
+    server.listen_unix(bench_path);
+    server.listen_shm(bench_shm_path);
+    server.start("127.0.0.1", bench_port, [](std::shared_ptr<tcp_client> client) {
+        // Raw pointer: the server keeps the client alive.
+        tcp_client *c = client.get();
+        client->start_reading([c](tcp_client::buffered_read_result &result) { echo(c, result); });
+    });
+
+    int tcp_fd = connect_tcp();
+    int unix_fd = connect_unix();
+
+    // Kept open: the server disconnects once it's closed.
+    tcp_socket control;
+    control.connect_unix(bench_shm_path);
+    std::unique_ptr<shm_channel> channel = shm_channel::receive_from(control);
+
+    round_trip_t over_tcp = [tcp_fd](const std::string &r) { round_trip(tcp_fd, r); };
+    round_trip_t over_unix = [unix_fd](const std::string &r) { round_trip(unix_fd, r); };
+    round_trip_t over_shm = [&channel](const std::string &r) { shm_round_trip(*channel, r); };
+
+    run("tcp", over_tcp, requests, 1);
+    run("unix", over_unix, requests, 1);
+    run("shm", over_shm, requests, 1);
+    run("tcp", over_tcp, requests, batch);
+    run("unix", over_unix, requests, batch);
+    run("shm", over_shm, requests, batch);
+
+    ::close(tcp_fd);
+    ::close(unix_fd);
+    control.close();
+    server.stop();
+    return 0;
+}
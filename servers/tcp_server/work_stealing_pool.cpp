@@ -0,0 +1,494 @@
+#include <algorithm>
+#include "thread_pool.hpp"
+#include "work_stealing_pool.hpp"
+
+namespace cdb_tcp_server
+{
+
+/// Capacity of each worker's deque and of the injection queue. Both
+/// must be powers of 2.
+static const std::size_t deque_capacity = 4096;
+static const std::size_t injection_capacity = 16384;
+
+/// Rounds of [find_task] an idle worker does before parking.
+static const int spin_rounds = 32;
+
+const std::size_t work_stealing_pool::max_workers;
+
+thread_local work_stealing_pool::worker *work_stealing_pool::current_worker_ = nullptr;
+
+/*
+task_deque.
+*/
+
+work_stealing_pool::task_deque::task_deque(std::size_t capacity)
+    : top_(0)
+    , bottom_(0)
+    , buffer_(capacity)
+    , mask_(static_cast<std::int64_t>(capacity) - 1)
+{
+    for (auto &slot : buffer_)
+        slot.store(nullptr, std::memory_order_relaxed);
+}
+
+bool work_stealing_pool::task_deque::push(pool_task *task)
+{
+    std::int64_t b = bottom_.load(std::memory_order_relaxed);
+    std::int64_t t = top_.load(std::memory_order_acquire);
+
+    if (b - t > mask_)
+        return false;
+
+    buffer_[b & mask_].store(task, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+    return true;
+}
+
+pool_task *work_stealing_pool::task_deque::pop()
+{
+    std::int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t t = top_.load(std::memory_order_relaxed);
+
+    if (t > b)
+    {
+        // Empty.
+        bottom_.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    pool_task *task = buffer_[b & mask_].load(std::memory_order_relaxed);
+    if (t == b)
+    {
+        // Last task, race against thieves.
+        if (!top_.compare_exchange_strong(t, t + 1,
+                                          std::memory_order_seq_cst,
+                                          std::memory_order_relaxed))
+            task = nullptr;
+        bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return task;
+}
+
+pool_task *work_stealing_pool::task_deque::steal()
+{
+    std::int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    std::int64_t b = bottom_.load(std::memory_order_acquire);
+
+    if (t >= b)
+        return nullptr;
+
+    pool_task *task = buffer_[t & mask_].load(std::memory_order_relaxed);
+    if (!top_.compare_exchange_strong(t, t + 1,
+                                      std::memory_order_seq_cst,
+                                      std::memory_order_relaxed))
+        return nullptr;
+    return task;
+}
+
+/*
+task_queue.
+*/
+
+work_stealing_pool::task_queue::task_queue(std::size_t capacity)
+    : buffer_(capacity)
+    , mask_(capacity - 1)
+    , enqueue_pos_(0)
+    , dequeue_pos_(0)
+{
+    for (std::size_t i = 0; i < capacity; i++)
+    {
+        buffer_[i].sequence.store(i, std::memory_order_relaxed);
+        buffer_[i].task = nullptr;
+    }
+}
+
+bool work_stealing_pool::task_queue::push(pool_task *task)
+{
+    cell *c;
+    std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+        c = &buffer_[pos & mask_];
+        std::size_t seq = c->sequence.load(std::memory_order_acquire);
+        std::intptr_t diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos);
+
+        if (diff == 0)
+        {
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            // Full.
+            return false;
+        else
+            pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+
+    c->task = task;
+    c->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+pool_task *work_stealing_pool::task_queue::pop()
+{
+    cell *c;
+    std::size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+        c = &buffer_[pos & mask_];
+        std::size_t seq = c->sequence.load(std::memory_order_acquire);
+        std::intptr_t diff = static_cast<std::intptr_t>(seq) - static_cast<std::intptr_t>(pos + 1);
+
+        if (diff == 0)
+        {
+            if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            // Empty.
+            return nullptr;
+        else
+            pos = dequeue_pos_.load(std::memory_order_relaxed);
+    }
+
+    pool_task *task = c->task;
+    c->sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return task;
+}
+
+/*
+work_stealing_pool.
+*/
+
+work_stealing_pool::worker::worker(work_stealing_pool *pool, std::size_t idx)
+    : pool(pool)
+    , idx(idx)
+    , tasks(deque_capacity)
+    , seed(static_cast<std::uint32_t>(idx) * 2654435761u + 1) {}
+
+work_stealing_pool::work_stealing_pool(std::size_t thread_num)
+    : num_slots_(0)
+    , injected_(injection_capacity)
+    , overflow_size_(0)
+    , stop_(false)
+    , thread_num_(std::min(thread_num, max_workers))
+    , cpu_(-1)
+    , spin_(0)
+    , num_parked_(0)
+    , wakeups_(0)
+{
+    for (auto &slot : workers_)
+        slot.store(nullptr, std::memory_order_relaxed);
+
+    for (std::size_t i = 0; i < thread_num_; i++)
+        spawn_worker(i);
+}
+
+work_stealing_pool::~work_stealing_pool()
+{
+    stop();
+
+    for (auto &slot : workers_)
+        delete slot.load();
+}
+
+void work_stealing_pool::spawn_worker(std::size_t idx)
+{
+    worker *w = workers_[idx].load(std::memory_order_relaxed);
+    if (!w)
+    {
+        w = new worker(this, idx);
+        workers_[idx].store(w, std::memory_order_release);
+    }
+
+    w->thread = std::thread(&work_stealing_pool::init_worker, this, w);
+    if (cpu_ != -1)
+        set_thread_affinity(w->thread, cpu_);
+
+    if (num_slots_.load() < idx + 1)
+        num_slots_.store(idx + 1);
+}
+
+void work_stealing_pool::init_worker(worker *w)
+{
+    current_worker_ = w;
+
+    while (pool_task *task = fetch_task(w))
+    {
+        try {
+            task->run();
+        } catch (const std::exception& e) {
+            // TODO: add log.
+        }
+    }
+
+    // Retired by set_thread_num(): hand what's left over to the
+    // remaining workers.
+    if (!stop_)
+    {
+        bool handed_over = false;
+        while (pool_task *task = w->tasks.pop())
+        {
+            if (!injected_.push(task))
+            {
+                std::lock_guard<std::mutex> lock(overflow_mutex_);
+                overflow_.push(task);
+                overflow_size_++;
+            }
+            handed_over = true;
+        }
+        if (handed_over)
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (num_parked_.load() > 0)
+                unpark_one();
+        }
+    }
+
+    current_worker_ = nullptr;
+}
+
+pool_task *work_stealing_pool::fetch_task(worker *w)
+{
+    for (;;)
+    {
+        for (int i = 0; i < spin_rounds; i++)
+        {
+            if (should_stop(w))
+                return nullptr;
+            if (pool_task *task = find_task(w))
+                return task;
+            std::this_thread::yield();
+        }
+
+        // Busy-poll mode: keep looking, without giving up the core.
+        if (std::int64_t spin = spin_.load(std::memory_order_relaxed))
+        {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(spin);
+            do
+            {
+                if (should_stop(w))
+                    return nullptr;
+                if (pool_task *task = find_task(w))
+                    return task;
+                cpu_relax();
+            } while (std::chrono::steady_clock::now() < deadline);
+        }
+
+        // Announce we're about to park, then look once more: a task
+        // added before [num_parked_] was bumped is seen here, one
+        // added after it will unpark us.
+        num_parked_.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (pool_task *task = find_task(w))
+        {
+            num_parked_.fetch_sub(1);
+            return task;
+        }
+
+        std::unique_lock<std::mutex> lock(park_mutex_);
+        park_cond_.wait(lock, [&] { return wakeups_ > 0 || should_stop(w); });
+        if (wakeups_ > 0)
+            wakeups_--;
+        num_parked_.fetch_sub(1);
+    }
+}
+
+pool_task *work_stealing_pool::find_task(worker *w)
+{
+    if (pool_task *task = w->tasks.pop())
+        return task;
+    if (pool_task *task = pop_injected())
+        return task;
+    return steal_task(w);
+}
+
+pool_task *work_stealing_pool::pop_injected()
+{
+    if (pool_task *task = injected_.pop())
+        return task;
+
+    if (overflow_size_.load() == 0)
+        return nullptr;
+
+    std::lock_guard<std::mutex> lock(overflow_mutex_);
+    if (overflow_.empty())
+        return nullptr;
+
+    pool_task *task = overflow_.front();
+    overflow_.pop();
+    overflow_size_--;
+    return task;
+}
+
+pool_task *work_stealing_pool::steal_task(worker *w)
+{
+    std::size_t n = num_slots_.load();
+    if (n < 2)
+        return nullptr;
+
+    // xorshift32, so that thieves don't all start with the same victim.
+    w->seed ^= w->seed << 13;
+    w->seed ^= w->seed >> 17;
+    w->seed ^= w->seed << 5;
+
+    std::size_t start = w->seed % n;
+    for (std::size_t i = 0; i < n; i++)
+    {
+        std::size_t victim_idx = (start + i) % n;
+        if (victim_idx == w->idx)
+            continue;
+
+        worker *victim = workers_[victim_idx].load(std::memory_order_acquire);
+        if (!victim)
+            continue;
+
+        if (pool_task *task = victim->tasks.steal())
+            return task;
+    }
+    return nullptr;
+}
+
+bool work_stealing_pool::should_stop(const worker *w) const
+{
+    return stop_ || w->idx >= thread_num_;
+}
+
+void work_stealing_pool::add_task(const task_t &task)
+{
+    add_task(new function_task(task));
+}
+
+void work_stealing_pool::add_task(pool_task *t)
+{
+    worker *w = current_worker_;
+
+    // Called from one of our own workers, e.g. a callback scheduling
+    // more work: keep it local, thieves will balance it out.
+    if (!(w && w->pool == this && !should_stop(w) && w->tasks.push(t)))
+    {
+        if (!injected_.push(t))
+        {
+            std::lock_guard<std::mutex> lock(overflow_mutex_);
+            overflow_.push(t);
+            overflow_size_++;
+        }
+    }
+
+    // Pairs with the fence in fetch_task().
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (num_parked_.load() > 0)
+        unpark_one();
+}
+
+void work_stealing_pool::unpark_one()
+{
+    std::lock_guard<std::mutex> lock(park_mutex_);
+
+    if (wakeups_ < num_parked_.load())
+    {
+        wakeups_++;
+        park_cond_.notify_one();
+    }
+}
+
+void work_stealing_pool::stop()
+{
+    std::lock_guard<std::mutex> management_lock(management_mutex_);
+
+    stop_ = true;
+    {
+        std::lock_guard<std::mutex> lock(park_mutex_);
+        park_cond_.notify_all();
+    }
+
+    for (std::size_t i = 0; i < num_slots_; i++)
+    {
+        worker *w = workers_[i].load();
+        if (w && w->thread.joinable())
+            w->thread.join();
+    }
+
+    drop_pending_tasks();
+}
+
+void work_stealing_pool::drop_pending_tasks()
+{
+    for (std::size_t i = 0; i < num_slots_; i++)
+    {
+        worker *w = workers_[i].load();
+        if (!w)
+            continue;
+        while (pool_task *task = w->tasks.pop())
+            task->discard();
+    }
+
+    while (pool_task *task = pop_injected())
+        task->discard();
+}
+
+void work_stealing_pool::set_thread_num(std::size_t num)
+{
+    std::lock_guard<std::mutex> management_lock(management_mutex_);
+
+    if (stop_)
+        return;
+
+    num = std::min(num, max_workers);
+    thread_num_.store(num);
+
+    if (num < num_slots_)
+    {
+        // Wake the retired workers and wait until they have handed
+        // their deques over.
+        {
+            std::lock_guard<std::mutex> lock(park_mutex_);
+            park_cond_.notify_all();
+        }
+        for (std::size_t i = num; i < num_slots_; i++)
+        {
+            worker *w = workers_[i].load();
+            if (w && w->thread.joinable())
+                w->thread.join();
+        }
+    }
+
+    for (std::size_t i = 0; i < num; i++)
+    {
+        worker *w = workers_[i].load();
+        if (!w || !w->thread.joinable())
+            spawn_worker(i);
+    }
+}
+
+std::size_t work_stealing_pool::get_thread_num() const
+{
+    return thread_num_;
+}
+
+void work_stealing_pool::set_cpu_affinity(int cpu)
+{
+    std::lock_guard<std::mutex> management_lock(management_mutex_);
+
+    cpu_ = cpu;
+    for (std::size_t i = 0; i < num_slots_; i++)
+    {
+        worker *w = workers_[i].load();
+        if (w && w->thread.joinable())
+            set_thread_affinity(w->thread, cpu);
+    }
+}
+
+void work_stealing_pool::set_spin(std::chrono::microseconds spin)
+{
+    spin_ = spin.count() > 0 ? spin.count() : 0;
+}
+
+} // namespace cdb_tcp_server
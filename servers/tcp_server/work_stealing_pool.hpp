@@ -0,0 +1,193 @@
+#ifndef TCP_SERVER_WORK_STEALING_POOL_HPP
+#define TCP_SERVER_WORK_STEALING_POOL_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+#include "pool_task.hpp"
+
+namespace cdb_tcp_server
+{
+
+/// Work-stealing thread pool with the same interface as thread_pool.
+///
+/// Each worker owns a deque it pushes to and pops from at the bottom;
+/// idle workers steal from the top of the others'. Tasks added from
+/// outside the pool (e.g. by the polling thread) go to a lock-free
+/// injection queue shared by all workers. Idle workers park on a
+/// condition variable and are woken one at a time, only when some
+/// worker is actually parked.
+class work_stealing_pool {
+public:
+    work_stealing_pool(std::size_t thread_num);
+    ~work_stealing_pool();
+
+    work_stealing_pool(const work_stealing_pool&) = delete;
+    work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+
+public:
+    /// Only allow void(*)() task type.
+    typedef inline_function<void()> task_t;
+
+    /// Task to be performed by workers.
+    void add_task(const task_t &task);
+
+    /// Same as above without allocating. [task] must stay alive until
+    /// it has run or was discarded.
+    void add_task(pool_task *task);
+
+    /// Number of underlying workers.
+    void set_thread_num(std::size_t num);
+    std::size_t get_thread_num() const;
+
+    /// Pin every worker, including those added later, to [cpu].
+    void set_cpu_affinity(int cpu);
+
+    /// Idle workers keep looking for tasks for [spin] before parking.
+    /// 0, the default, parks after a few rounds.
+    void set_spin(std::chrono::microseconds spin);
+
+    /// Stop the thread pool. Tasks that haven't started are dropped.
+    void stop();
+
+    /// Upper bound on the number of workers.
+    static const std::size_t max_workers = 256;
+
+private:
+    /// Chase-Lev deque of a fixed capacity. The owner pushes and pops
+    /// at the bottom, any thread may steal from the top.
+    class task_deque {
+    public:
+        task_deque(std::size_t capacity);
+
+        /// Owner only. Return false if the deque is full.
+        bool push(pool_task *task);
+        /// Owner only. nullptr if empty.
+        pool_task *pop();
+        /// Any thread. nullptr if empty or if another thief won.
+        pool_task *steal();
+
+    private:
+        /// [top_] is written by thieves, [bottom_] by the owner; keep
+        /// them on separate cache lines.
+        std::atomic<std::int64_t> top_;
+        char pad_[64];
+        std::atomic<std::int64_t> bottom_;
+        std::vector<std::atomic<pool_task*>> buffer_;
+        std::int64_t mask_;
+    };
+
+    /// Bounded lock-free MPMC queue (D. Vyukov's design).
+    class task_queue {
+    public:
+        task_queue(std::size_t capacity);
+
+        /// Return false if the queue is full.
+        bool push(pool_task *task);
+        /// nullptr if empty.
+        pool_task *pop();
+
+    private:
+        struct cell {
+            std::atomic<std::size_t> sequence;
+            pool_task *task;
+        };
+
+        std::vector<cell> buffer_;
+        std::size_t mask_;
+        std::atomic<std::size_t> enqueue_pos_;
+        char pad_[64];
+        std::atomic<std::size_t> dequeue_pos_;
+    };
+
+    struct worker {
+        worker(work_stealing_pool *pool, std::size_t idx);
+
+        work_stealing_pool *pool;
+        std::size_t idx;
+        task_deque tasks;
+        std::thread thread;
+
+        /// State of the xorshift generator used to pick victims.
+        std::uint32_t seed;
+    };
+
+    /*
+    Worker operations.
+    */
+
+    /// Worker loop.
+    void init_worker(worker *w);
+
+    /// Find something to run, parking if there's nothing. nullptr
+    /// means the worker should exit.
+    pool_task *fetch_task(worker *w);
+
+    /// Own deque, then the injection queue, then the others' deques.
+    pool_task *find_task(worker *w);
+    pool_task *pop_injected();
+    pool_task *steal_task(worker *w);
+
+    /// Return true to terminate [w].
+    bool should_stop(const worker *w) const;
+
+    /// Start the worker in slot [idx].
+    void spawn_worker(std::size_t idx);
+
+    /// Wake a single parked worker, if any.
+    void unpark_one();
+
+    /// Delete the tasks nobody will run. Workers must be joined.
+    void drop_pending_tasks();
+
+    /// Worker run by the calling thread, nullptr outside of any pool.
+    static thread_local worker *current_worker_;
+
+private:
+    /// Workers. A slot is allocated once and kept until the pool is
+    /// destroyed so that thieves can always dereference it.
+    std::array<std::atomic<worker*>, max_workers> workers_;
+    std::atomic<std::size_t> num_slots_;
+
+    /// Tasks added from outside the pool.
+    task_queue injected_;
+
+    /// Spill-over once [injected_] is full.
+    std::queue<pool_task*> overflow_;
+    std::mutex overflow_mutex_;
+    std::atomic<std::size_t> overflow_size_;
+
+    /// Flag indicates whether the pool should stop.
+    std::atomic<bool> stop_;
+
+    /// Number of thread workers.
+    std::atomic<std::size_t> thread_num_;
+
+    /// CPU the workers are pinned to. -1 if not pinned.
+    std::atomic<int> cpu_;
+
+    /// Microseconds idle workers spin for.
+    std::atomic<std::int64_t> spin_;
+
+    /// Parking. [wakeups_] counts unpark requests not yet consumed and
+    /// never exceeds [num_parked_].
+    std::mutex park_mutex_;
+    std::condition_variable park_cond_;
+    std::atomic<std::size_t> num_parked_;
+    std::size_t wakeups_;
+
+    /// Serializes set_thread_num() and stop().
+    std::mutex management_mutex_;
+};
+
+} // namespace cdb_tcp_server
+
+
+#endif